@@ -62,30 +62,490 @@
  *  - Some features are excluded
  *    - e.g. "Lateral Liquid" and "Retroflex Liquid" are combined as "Liquid"
  *  - Place of articulation for the consonant w is set as "Labial", instead of "Bilabial"
+ *    (see --profile w-bilabial)
  *  - Finding a common feature between consonants and vowels is not supported in this code
  *
  *
  * How to compile and run the code:
- *  $> gcc commonFeatureFinder.c -o commonFeature
- *  $> ./commonFeature (on Mac)
- *  $> .\commonFeature.exe (on Windows)
+ *  $> gcc -O2 -pthread commonFeatureFinder.c -lm -o commonFeature
+ *  $> ./commonFeature (on Linux or Mac)
+ *  The code needs POSIX threads, mmap and sockets: on Windows, compile and
+ *  run it under WSL or Cygwin.
+ *
+ *
+ * Batch mode and output formats:
+ *  $> ./commonFeature --format jsonl < queries.txt
+ *  With --format, the questions are not asked. Queries are read from the
+ *  standard input until the end of file, each written as
+ *  "<num> <segment>... <0 if consonant, 1 if vowel>", and the results are
+ *  written through one large output buffer. A segment can also be written
+ *  as its IPA symbol (e.g. "3 p b m 0"). A redirected file is mapped into
+ *  memory and parsed in place; a malformed token stops the run and is
+ *  reported with its byte offset. Queries are answered in batches by one
+ *  worker per processor (--threads), and written in their order.
+ *  - text:   the same sentences as the interactive mode
+ *  - jsonl:  one JSON object per query, null if there is no common value
+ *  - csv:    one row per query, one column per dimension
+ *  - binary: one byte per dimension (the code of the value, 0 if there is
+ *            no common value), 8 bytes per query, 0xFF bytes if invalid
+ *  $> ./commonFeature --explain --format jsonl < queries.txt
+ *  For every dimension, also reports the value most segments share (as
+ *  their value or sub value), how many share it and the outliers.
+ *  $> ./commonFeature --threshold 0.9 --format jsonl < queries.txt
+ *  Reports every value shared by at least 90% of the segments of each
+ *  query, with its support, instead of the common features.
+ *  $> ./commonFeature --cache 65536 --format jsonl < queries.txt
+ *  Answers repeated queries from a cache keyed on the first two segments
+ *  and the set of the others, shared by every worker without a lock, and
+ *  prints its hits, misses and contention at the end.
+ *  $> ./commonFeature --format jsonl --log queries.log < queries.txt
+ *  $> ./commonFeature --replay queries.log --replay-rate recorded --format jsonl
+ *  Records every query and the time it was read in a binary log, through a
+ *  buffer per thread, and answers the logged queries again in the same
+ *  order, as fast as possible or at the recorded times, reporting the
+ *  throughput and the percentiles of the latency.
+ *  $> ./commonFeature --serve 7000 --format jsonl
+ *  Answers the queries of TCP clients, one line per request, with one
+ *  event loop per worker that reads, answers and writes every connection
+ *  without blocking; an idle connection costs a few hundred bytes.
+ *
+ *
+ * Engines and verification:
+ *  $> ./commonFeature --verify
+ *  Queries are answered from a table of the features of each segment
+ *  (--engine table, the default), or with the helper functions
+ *  (--engine reference). --verify compares the table engine against the
+ *  helper functions on every short sequence, every subset and random
+ *  multisets, using every processor, and reports every divergence.
+ *
+ * Dialect profiles:
+ *  $> ./commonFeature --profile split --format jsonl < queries.txt
+ *  A profile splits, merges or changes segments of the feature table at
+ *  startup: "split" separates e/ej, o/ow and ɹ/r (e and o as simple
+ *  vowels), "w-bilabial" makes w Bilabial, "cot-caught" merges ɔ into ɑ.
+ *  A file gives one rule per line: "split e ej", "merge ɔ ɑ" or
+ *  "set w place Labial/Bilabial". New segments are numbered after the
+ *  last one (e.g. ej is vowel 16).
+ *
+ *
+ * Instrumentation:
+ *  $> gcc -O2 -pthread -DFEATURE_STATS commonFeatureFinder.c -lm -o commonFeature
+ *  $> ./commonFeature --stats --format jsonl < queries.txt
+ *  Counts the calls of each dimension, the position at which each one
+ *  exits early and the latency of each query. The counters are printed at
+ *  the end with --stats, or whenever SIGUSR1 is received in batch or
+ *  server mode.
+ *  Without -DFEATURE_STATS, the counters and their updates are not
+ *  compiled and --stats is refused.
+ *  $> gcc -O2 -pthread -DFEATURE_PERF commonFeatureFinder.c -lm -o commonFeature
+ *  $> ./commonFeature --perf --engine reference --format binary < queries.txt
+ *  On Linux, counts the cycles, instructions, branch misses and L1 and
+ *  last-level cache misses of every dimension with perf_event_open, by the
+ *  number of segments of the query, and prints them per call at the end.
+ *
+ *
+ * Corpora:
+ *  A corpus has one transcribed word per line, each segment written as its
+ *  IPA symbol and separated by spaces (e.g. "s t ɹ i t"). It is read into
+ *  memory and shared between one worker per processor (--threads).
+ *  $> ./commonFeature --cooccurrence corpus.txt --format csv
+ *  Counts how often each feature value is followed by another between
+ *  adjacent segments, also among segments sharing another feature (e.g. a
+ *  Nasal followed by a Stop with the same place).
+ *  $> ./commonFeature --syllabify corpus.txt --format jsonl
+ *  Splits every word into onset, nucleus and coda by the sonority of the
+ *  manner of articulation and the maximal onset principle, and reports the
+ *  common features of every onset and coda. The corpus is read in blocks.
+ *  $> ./commonFeature --ngram corpus.txt --model model.bin
+ *  $> ./commonFeature --score words.txt --model model.bin --format csv
+ *  Trains an n-gram model (--ngram-order, 3) over feature classes (voicing
+ *  and manner of consonants, height of vowels) and scores every word by its
+ *  log2 probability (a 4-byte float per word in binary format).
+ *  $> ./commonFeature --cmudict cmudict.dict --lexicon cmudict.lex
+ *  Imports a CMU Pronouncing Dictionary (ARPAbet phones with stress) into
+ *  a binary lexicon, which every corpus mode maps and reads in place
+ *  (e.g. --syllabify cmudict.lex).
+ *
+ *
+ * Inventories:
+ *  An inventory is "consonants", "vowels", "all", or a file with one
+ *  segment per line: its symbol alone for a segment of the table, or its
+ *  symbol and values ("x Labial/Bilabial Stop Voiced" for a consonant,
+ *  "y High Front Tensed Unrounded Simple_Vowel" for a vowel, "-" for none).
+ *  $> ./commonFeature --economy all
+ *  Finds the smallest set of dimensions, and of feature values, that still
+ *  gives every segment of the inventory a different feature vector.
+ *  $> ./commonFeature --hierarchy consonants --order place,manner,voicing
+ *  Contrastive specification of every segment by successive division in
+ *  the order of the dimensions. Without --order, every ordering of the
+ *  dimensions is ranked by depth and number of specifications.
+ *  $> ./commonFeature --cluster all --linkage average
+ *  Clusters the segments by the number of features that tell them apart
+ *  with the nearest-neighbour chain, and writes the dendrogram (Newick in
+ *  text format, the merges in jsonl and csv, a SciPy linkage in binary).
+ *  $> ./commonFeature --compare languages.txt --segments global.txt --format csv
+ *  Compares every pair of languages (a name and the symbols of its
+ *  segments per line) by the Jaccard similarity of their segments and of
+ *  their feature values, with bitsets compared in tiles by every worker.
+ *  $> ./commonFeature --universals languages.txt --min-support 0.05 --min-confidence 0.95
+ *  Finds the implicational universals of the same languages: "every
+ *  language with X also has Y" and "with X and Y, also Z", between feature
+ *  values and segments, ranked by confidence and support.
+ *
+ *
+ * Feature itemsets:
+ *  $> ./commonFeature --itemsets onsets.txt --min-support 0.01
+ *  Each line is a set of segments (e.g. an onset cluster "s t ɹ"), and its
+ *  items are the values and sub values of its segments. Reports every
+ *  combination of values found in at least the support of the sets (a
+ *  fraction, or a count if 1 or more), mined in parallel with Eclat.
+ *
+ *
+ * Pattern search:
+ *  $> ./commonFeature --match "[Nasal][Stop & Voiceless]" --corpus corpus.txt
+ *  Lists every word that has the pattern of segment classes (values,
+ *  symbols, C, V and . combined with !, & and |, ^ and $ for the start and
+ *  end of the word), matched with a bit-parallel Shift-And automaton.
+ *  $> ./commonFeature --index cmudict.lex --index-file cmudict.idx
+ *  $> ./commonFeature --index-file cmudict.idx --match "^[Nasal] V"
+ *  $> ./commonFeature --index-file cmudict.idx --format jsonl < patterns.txt
+ *  Writes a positional index of the words (compressed posting lists of
+ *  the words with each segment at each of the first and last positions,
+ *  or anywhere), then answers patterns by intersecting its postings: the
+ *  matching words of one pattern, or the count of each pattern of a file.
+ *
+ *
+ * Lexicon tries:
+ *  $> ./commonFeature --trie cmudict.lex --prefix "[Voiced & Stop] V" --rest "[Voiced]"
+ *  Stores the distinct words of a corpus in a succinct (LOUDS) trie whose
+ *  nodes summarize the values of the segments below them, and lists the
+ *  words that start with the pattern and continue with segments of the
+ *  class, skipping the subtrees whose summary cannot match.
  *
  **********************************************************************/
 
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#if defined(FEATURE_PERF) && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// Dimensions of the common features: three for consonants, five for vowels
+#define NUM_DIMENSIONS 8
+#define MAX_VALUES 10
+
+enum Dimension {
+  DIM_PLACE, DIM_MANNER, DIM_VOICING,
+  DIM_HEIGHT, DIM_BACKNESS, DIM_TENSENESS, DIM_ROUNDEDNESS, DIM_DIPHTHONG
+};
+
+//===================================================================//
+//========================= Instrumentation =========================//
+//===================================================================//
+// Compiled in with -DFEATURE_STATS only; otherwise the macros are empty.
+//  - calls and completed (not exited early) calls of each dimension
+//  - histogram of the position at which each dimension exits early
+//  - histogram of the latency of each query in nanoseconds
+// Histograms are log-linear (HDR-style): exact below 8, then 8 buckets for
+// every power of two.
+#define STATS_SUB_BUCKETS 8
+#define STATS_BUCKETS (64 * STATS_SUB_BUCKETS)
+
+unsigned long long nowNanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int statsBucket(unsigned long long value) {
+  int msb;
+
+  if (value < STATS_SUB_BUCKETS) {
+    return (int)value;
+  }
+  msb = 63 - __builtin_clzll(value);
+  return (msb - 2) * STATS_SUB_BUCKETS + (int)((value >> (msb - 3)) & 7);
+}
+
+// Smallest value of the bucket
+unsigned long long statsBucketValue(int bucket) {
+  if (bucket < STATS_SUB_BUCKETS) {
+    return bucket;
+  }
+  return (unsigned long long)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS)
+         << (bucket / STATS_SUB_BUCKETS - 1);
+}
+
+// Value below which the fraction of the histogram lies: the end of its
+// bucket, so an upper bound (up to 1/8 above the values of the bucket)
+unsigned long long statsPercentile(const unsigned long long histogram[],
+                                   double fraction) {
+  unsigned long long total = 0;
+  unsigned long long seen = 0;
+  int b;
+
+  for (b = 0; b < STATS_BUCKETS; b++) {
+    total += histogram[b];
+  }
+  for (b = 0; b < STATS_BUCKETS; b++) {
+    seen += histogram[b];
+    if (total > 0 && seen >= fraction * total) {
+      return statsBucketValue(b + 1);
+    }
+  }
+  return 0;
+}
+
+#ifdef FEATURE_STATS
+unsigned long long statsCalls[NUM_DIMENSIONS];
+unsigned long long statsCompleted[NUM_DIMENSIONS];
+unsigned long long statsExits[NUM_DIMENSIONS][STATS_BUCKETS];
+unsigned long long statsLatency[STATS_BUCKETS];
+unsigned long long statsLatencyMax;
+volatile sig_atomic_t statsRequested = 0;
+
+#define STATS_ADD(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+#define STATS_CALL(dimension) STATS_ADD(statsCalls[dimension])
+#define STATS_EXIT(dimension, position) \
+  STATS_ADD(statsExits[dimension][statsBucket(position)])
+#define STATS_COMPLETE(dimension) STATS_ADD(statsCompleted[dimension])
+#define STATS_QUERY_BEGIN() unsigned long long statsStart = nowNanoseconds()
+#define STATS_QUERY_END() statsRecordLatency(nowNanoseconds() - statsStart)
+
+// Count the latency of a query, and keep the longest exactly
+void statsRecordLatency(unsigned long long latency) {
+  unsigned long long longest = __atomic_load_n(&statsLatencyMax, __ATOMIC_RELAXED);
+
+  STATS_ADD(statsLatency[statsBucket(latency)]);
+  while (latency > longest &&
+         !__atomic_compare_exchange_n(&statsLatencyMax, &longest, latency, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+#else
+#define STATS_CALL(dimension)
+#define STATS_EXIT(dimension, position)
+#define STATS_COMPLETE(dimension)
+#define STATS_QUERY_BEGIN()
+#define STATS_QUERY_END()
+#endif
+
+// Hardware counters of the kernels, compiled in with -DFEATURE_PERF on
+// Linux only and enabled with --perf: every dimension of every query is
+// counted with perf_event_open (cycles, instructions, branch misses, L1
+// data and last-level cache read misses), by the number of segments of the
+// query (1, 2, 3-4, 5-8, ... 129+). Each thread opens its own group of
+// counters, read with one read() before and after each dimension, and the
+// cost of the reads themselves (the least of empty measurements) is
+// subtracted. Events the processor does not have are left out.
+#if defined(FEATURE_PERF) && defined(__linux__)
+#define PERF_EVENTS 5
+#define PERF_SIZE_BUCKETS 9
+
+typedef struct {
+  unsigned int type;
+  unsigned long long config;
+  const char *name;
+} PerfEvent;
+
+const PerfEvent perfEvents[PERF_EVENTS] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                       PERF_COUNT_HW_CACHE_RESULT_MISS << 16, "L1D-misses"},
+  {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                       PERF_COUNT_HW_CACHE_RESULT_MISS << 16, "LLC-misses"}
+};
+
+// Counters of one thread
+typedef struct {
+  int leader;                              // -1 if not opened yet, -2 if failed
+  int numOpened;
+  int fds[PERF_EVENTS];                    // Of each event opened, the leader first
+  int opened[PERF_EVENTS];                 // Event of each value read
+  unsigned long long bias[PERF_EVENTS];    // Counted by the reads themselves
+  unsigned long long start[PERF_EVENTS];
+} PerfCounters;
+
+int perfEnabled = 0;
+int perfFailures = 0;                      // Threads whose group could not be opened
+int perfAvailable[PERF_EVENTS];
+unsigned long long perfCalls[NUM_DIMENSIONS][PERF_SIZE_BUCKETS];
+unsigned long long perfCounts[NUM_DIMENSIONS][PERF_SIZE_BUCKETS][PERF_EVENTS];
+__thread PerfCounters perfCounters = {-1, 0, {0}, {0}, {0}, {0}};
+
+// Read the counters of the group into values, by event. Return 0 on failure.
+int perfRead(const PerfCounters *counters, unsigned long long values[]) {
+  unsigned long long group[1 + PERF_EVENTS];
+  int i;
+
+  if (read(counters->leader, group, sizeof(group)) <
+      (long)(sizeof(unsigned long long) * (1 + counters->numOpened))) {
+    return 0;
+  }
+  for (i = 0; i < counters->numOpened; i++) {
+    values[counters->opened[i]] = group[1 + i];
+  }
+  return 1;
+}
+
+// Open the group of the thread and measure the cost of reading it
+void perfOpen(PerfCounters *counters) {
+  struct perf_event_attr attribute;
+  unsigned long long before[PERF_EVENTS];
+  unsigned long long after[PERF_EVENTS];
+  int e;
+  int k;
+
+  counters->numOpened = 0;
+  counters->leader = -1;
+  for (e = 0; e < PERF_EVENTS; e++) {
+    int fd;
+    memset(&attribute, 0, sizeof(attribute));
+    attribute.size = sizeof(attribute);
+    attribute.type = perfEvents[e].type;
+    attribute.config = perfEvents[e].config;
+    attribute.read_format = PERF_FORMAT_GROUP;
+    attribute.disabled = counters->leader < 0;
+    attribute.exclude_kernel = 1;
+    attribute.exclude_hv = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attribute, 0, -1, counters->leader, 0);
+    if (fd < 0) {
+      if (e == 0) {
+        // Reported once, and counted for printPerf
+        if (__atomic_fetch_add(&perfFailures, 1, __ATOMIC_RELAXED) == 0) {
+          fprintf(stderr, "perf_event_open: %s\n", strerror(errno));
+        }
+        counters->leader = -2;
+        return ;
+      }
+      continue;
+    }
+    if (counters->leader < 0) {
+      counters->leader = fd;
+    }
+    counters->fds[counters->numOpened] = fd;
+    counters->opened[counters->numOpened++] = e;
+    __atomic_store_n(&perfAvailable[e], 1, __ATOMIC_RELAXED);
+  }
+  ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+  for (e = 0; e < PERF_EVENTS; e++) {
+    counters->bias[e] = ~0ULL;
+  }
+  for (k = 0; k < 64; k++) {
+    if (perfRead(counters, before) && perfRead(counters, after)) {
+      for (e = 0; e < counters->numOpened; e++) {
+        int event = counters->opened[e];
+        if (after[event] - before[event] < counters->bias[event]) {
+          counters->bias[event] = after[event] - before[event];
+        }
+      }
+    }
+  }
+}
+
+void perfStart(void) {
+  PerfCounters *counters = &perfCounters;
+
+  if (counters->leader == -1) {
+    perfOpen(counters);
+  }
+  if (counters->leader >= 0 && !perfRead(counters, counters->start)) {
+    counters->leader = -2;
+  }
+}
+
+// Close the group of the thread, before it ends
+void perfClose(void) {
+  PerfCounters *counters = &perfCounters;
+  int i;
+
+  if (counters->leader >= 0) {
+    for (i = counters->numOpened - 1; i >= 0; i--) {
+      close(counters->fds[i]);
+    }
+  }
+  counters->leader = -1;
+  counters->numOpened = 0;
+}
+
+// Bucket of the number of segments: 1, 2, 3-4, 5-8, ..., 129+
+int perfSizeBucket(int num) {
+  int bucket = num <= 1 ? 0 : 64 - __builtin_clzll((unsigned long long)num - 1);
+
+  return bucket < PERF_SIZE_BUCKETS ? bucket : PERF_SIZE_BUCKETS - 1;
+}
+
+void perfStop(int dimension, int num) {
+  PerfCounters *counters = &perfCounters;
+  unsigned long long end[PERF_EVENTS];
+  int bucket = perfSizeBucket(num);
+  int e;
+
+  if (counters->leader < 0 || !perfRead(counters, end)) {
+    return ;
+  }
+  __atomic_fetch_add(&perfCalls[dimension][bucket], 1, __ATOMIC_RELAXED);
+  for (e = 0; e < counters->numOpened; e++) {
+    int event = counters->opened[e];
+    unsigned long long delta = end[event] - counters->start[event];
+    delta = delta > counters->bias[event] ? delta - counters->bias[event] : 0;
+    __atomic_fetch_add(&perfCounts[dimension][bucket][event], delta, __ATOMIC_RELAXED);
+  }
+}
+
+#define PERF_START() \
+  do { if (perfEnabled) perfStart(); } while (0)
+#define PERF_STOP(dimension, num) \
+  do { if (perfEnabled) perfStop(dimension, num); } while (0)
+#define PERF_CLOSE() \
+  do { if (perfEnabled) perfClose(); } while (0)
+#else
+#define PERF_START()
+#define PERF_STOP(dimension, num)
+#define PERF_CLOSE()
+#endif
 
 //===================================================================//
 //==================== Consonant Helper Function ====================//
 //===================================================================//
-void conPlaceArticulation(int intArray[], int num) {
+void conPlaceArticulation(int intArray[], int num, char common[]) {
   char place[20];
   char subPlace[20] = "";
   char previousPlace[20] = "";
   char previousSubPlace[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_PLACE);
+  strcpy(common, "");
   while (i < num) {
     // printf("i = %d, intArray[i] = %d\n", i, intArray[i]);
     if (intArray[i] == 1 || intArray[i] == 2 || intArray[i] == 3) {
@@ -129,6 +589,7 @@ void conPlaceArticulation(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_PLACE, i);
       return ;
     }
 
@@ -151,6 +612,7 @@ void conPlaceArticulation(int intArray[], int num) {
           strcpy(previousSubPlace, "");
         }
         else {
+          STATS_EXIT(DIM_PLACE, i);
           return ;
         }
       }
@@ -161,6 +623,7 @@ void conPlaceArticulation(int intArray[], int num) {
           strcpy(previousSubPlace, "");
         }
         else {
+          STATS_EXIT(DIM_PLACE, i);
           return ;
         }
       }
@@ -171,11 +634,13 @@ void conPlaceArticulation(int intArray[], int num) {
           strcpy(previousSubPlace, "");
         }
         else {
+          STATS_EXIT(DIM_PLACE, i);
           return ;
         }
       }
       // Place of Articulation doesn't match
       else {
+        STATS_EXIT(DIM_PLACE, i);
         return ;
       }
     }
@@ -183,17 +648,20 @@ void conPlaceArticulation(int intArray[], int num) {
     i++;
   }
 
-  printf("The common place of articulation is: %s\n", previousPlace);
+  strcpy(common, previousPlace);
+  STATS_COMPLETE(DIM_PLACE);
   return ;
 }
 
-void conMannerArticulation(int intArray[], int num) {
+void conMannerArticulation(int intArray[], int num, char common[]) {
   char manner[20];
   char subManner[20] = "";
   char previousManner[20] = "";
   char previousSubManner[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_MANNER);
+  strcpy(common, "");
   while (i < num) {
     if (intArray[i] == 1 || intArray[i] == 2 ||
         intArray[i] == 8 || intArray[i] == 9 ||
@@ -225,6 +693,7 @@ void conMannerArticulation(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_MANNER, i);
       return ;
     }
 
@@ -247,6 +716,7 @@ void conMannerArticulation(int intArray[], int num) {
           strcpy(previousSubManner, "");
         }
         else {
+          STATS_EXIT(DIM_MANNER, i);
           return ;
         }
       }
@@ -257,6 +727,7 @@ void conMannerArticulation(int intArray[], int num) {
           strcpy(previousSubManner, "");
         }
         else {
+          STATS_EXIT(DIM_MANNER, i);
           return ;
         }
       }
@@ -267,11 +738,13 @@ void conMannerArticulation(int intArray[], int num) {
           strcpy(previousSubManner, "");
         }
         else {
+          STATS_EXIT(DIM_MANNER, i);
           return ;
         }
       }
       // Manner of Articulation doesn't match
       else {
+        STATS_EXIT(DIM_MANNER, i);
         return ;
       }
     }
@@ -279,15 +752,18 @@ void conMannerArticulation(int intArray[], int num) {
     i++;
   }
 
-  printf("The common manner of articulation is: %s\n", previousManner);
+  strcpy(common, previousManner);
+  STATS_COMPLETE(DIM_MANNER);
   return ;
 }
 
-void conVoicing(int intArray[], int num) {
+void conVoicing(int intArray[], int num, char common[]) {
   char voice[20];
   char previousVoice[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_VOICING);
+  strcpy(common, "");
   while (i < num) {
     if (intArray[i] == 1 || intArray[i] == 4 || intArray[i] == 6 ||
         intArray[i] == 8 || intArray[i] == 11 || intArray[i] == 15 ||
@@ -304,6 +780,7 @@ void conVoicing(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_VOICING, i);
       return ;
     }
 
@@ -318,6 +795,7 @@ void conVoicing(int intArray[], int num) {
       }
       // Voicing doesn't match
       else {
+        STATS_EXIT(DIM_VOICING, i);
         return ;
       }
     }
@@ -325,18 +803,21 @@ void conVoicing(int intArray[], int num) {
     i++;
   }
 
-  printf("The common voicing is: %s\n", previousVoice);
+  strcpy(common, previousVoice);
+  STATS_COMPLETE(DIM_VOICING);
   return ;
 }
 
 //===================================================================//
 //====================== Vowel Helper Function ======================//
 //===================================================================//
-void vowHeight(int intArray[], int num) {
+void vowHeight(int intArray[], int num, char common[]) {
   char height[20];
   char previousHeight[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_HEIGHT);
+  strcpy(common, "");
   while (i < num) {
     if (intArray[i] == 1 || intArray[i] == 2 ||
         intArray[i] == 3 || intArray[i] == 4) {
@@ -353,6 +834,7 @@ void vowHeight(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_HEIGHT, i);
       return ;
     }
 
@@ -367,6 +849,7 @@ void vowHeight(int intArray[], int num) {
       }
       // Height doesn't match
       else {
+        STATS_EXIT(DIM_HEIGHT, i);
         return ;
       }
     }
@@ -374,15 +857,18 @@ void vowHeight(int intArray[], int num) {
     i++;
   }
 
-  printf("The common height of the tongue is: %s\n", previousHeight);
+  strcpy(common, previousHeight);
+  STATS_COMPLETE(DIM_HEIGHT);
   return ;
 }
 
-void vowBackness(int intArray[], int num) {
+void vowBackness(int intArray[], int num, char common[]) {
   char backness[20];
   char previousBackness[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_BACKNESS);
+  strcpy(common, "");
   while (i < num) {
     if (intArray[i] == 1 || intArray[i] == 2 ||
         intArray[i] == 5 || intArray[i] == 6 || intArray[i] == 12) {
@@ -398,6 +884,7 @@ void vowBackness(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_BACKNESS, i);
       return ;
     }
 
@@ -412,6 +899,7 @@ void vowBackness(int intArray[], int num) {
       }
       // Backness doesn't match
       else {
+        STATS_EXIT(DIM_BACKNESS, i);
         return ;
       }
     }
@@ -419,15 +907,18 @@ void vowBackness(int intArray[], int num) {
     i++;
   }
 
-  printf("The common backness of the tongue is: %s\n", previousBackness);
+  strcpy(common, previousBackness);
+  STATS_COMPLETE(DIM_BACKNESS);
   return ;
 }
 
-void vowTenseness(int intArray[], int num) {
+void vowTenseness(int intArray[], int num, char common[]) {
   char tenseness[20];
   char previousTenseness[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_TENSENESS);
+  strcpy(common, "");
   while (i < num) {
     if (intArray[i] == 1 || intArray[i] == 3 || intArray[i] == 5 ||
         intArray[i] == 9 || intArray[i] == 10 || intArray[i] == 13 ||
@@ -441,6 +932,7 @@ void vowTenseness(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_TENSENESS, i);
       return ;
     }
 
@@ -455,6 +947,7 @@ void vowTenseness(int intArray[], int num) {
       }
       // Tenseness doesn't match
       else {
+        STATS_EXIT(DIM_TENSENESS, i);
         return ;
       }
     }
@@ -462,15 +955,18 @@ void vowTenseness(int intArray[], int num) {
     i++;
   }
 
-  printf("The common tenseness of the vocal tract is: %s\n", previousTenseness);
+  strcpy(common, previousTenseness);
+  STATS_COMPLETE(DIM_TENSENESS);
   return ;
 }
 
-void vowRoundedness(int intArray[], int num) {
+void vowRoundedness(int intArray[], int num, char common[]) {
   char roundedness[20];
   char previousRoundedness[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_ROUNDEDNESS);
+  strcpy(common, "");
   while (i < num) {
     if (intArray[i] == 3 || intArray[i] == 4 ||
         intArray[i] == 9 || intArray[i] == 10 || intArray[i] == 11) {
@@ -484,6 +980,7 @@ void vowRoundedness(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_ROUNDEDNESS, i);
       return ;
     }
 
@@ -498,6 +995,7 @@ void vowRoundedness(int intArray[], int num) {
       }
       // Roundedness doesn't match
       else {
+        STATS_EXIT(DIM_ROUNDEDNESS, i);
         return ;
       }
     }
@@ -505,17 +1003,20 @@ void vowRoundedness(int intArray[], int num) {
     i++;
   }
 
-  printf("The common roundedness of the lips is: %s\n", previousRoundedness);
+  strcpy(common, previousRoundedness);
+  STATS_COMPLETE(DIM_ROUNDEDNESS);
   return ;
 }
 
-void vowDiphthong(int intArray[], int num) {
+void vowDiphthong(int intArray[], int num, char common[]) {
   char diphthong[20];
   char subDiphthong[20] = "";
   char previousDiphthong[20] = "";
   char previousSubDiphthong[20] = "";
   int i = 0;
 
+  STATS_CALL(DIM_DIPHTHONG);
+  strcpy(common, "");
   while (i < num) {
     if (intArray[i] == 1 || intArray[i] == 2 || intArray[i] == 3 ||
         intArray[i] == 4 || intArray[i] == 6 || intArray[i] == 7 ||
@@ -534,6 +1035,7 @@ void vowDiphthong(int intArray[], int num) {
     }
     // Out of range
     else {
+      STATS_EXIT(DIM_DIPHTHONG, i);
       return ;
     }
 
@@ -556,6 +1058,7 @@ void vowDiphthong(int intArray[], int num) {
           strcpy(previousSubDiphthong, "");
         }
         else {
+          STATS_EXIT(DIM_DIPHTHONG, i);
           return ;
         }
       }
@@ -566,6 +1069,7 @@ void vowDiphthong(int intArray[], int num) {
           strcpy(previousSubDiphthong, "");
         }
         else {
+          STATS_EXIT(DIM_DIPHTHONG, i);
           return ;
         }
       }
@@ -576,11 +1080,13 @@ void vowDiphthong(int intArray[], int num) {
           strcpy(previousSubDiphthong, "");
         }
         else {
+          STATS_EXIT(DIM_DIPHTHONG, i);
           return ;
         }
       }
       // Simple/complex vowel doesn't match
       else {
+        STATS_EXIT(DIM_DIPHTHONG, i);
         return ;
       }
     }
@@ -588,52 +1094,9436 @@ void vowDiphthong(int intArray[], int num) {
     i++;
   }
 
-  printf("The common simple/complex vowel is: %s\n", previousDiphthong);
+  strcpy(common, previousDiphthong);
+  STATS_COMPLETE(DIM_DIPHTHONG);
   return ;
 }
 
-//==================================================================//
-//============================== Main ==============================//
 //===================================================================//
-int main() {
-  int num;
-  int intArray[7];
-  int consonantVowel;
+//========================= Common Features =========================//
+//===================================================================//
+// First dimension and number of dimensions of consonants (0) and vowels (1)
+const int firstDimension[2] = {DIM_PLACE, DIM_HEIGHT};
+const int numDimensions[2] = {3, 5};
 
-  // Number of consonants/vowels to compare
-  printf("How many consonants/vowels?\n");
-  scanf("%d", &num);
+// Name of each dimension in JSON Lines and CSV output
+const char *dimensionKeys[NUM_DIMENSIONS] = {
+  "place", "manner", "voicing",
+  "height", "backness", "tenseness", "roundedness", "diphthong"
+};
 
-  // Create an array of consonants/vowels
-  for (int i = 0; i < num; i++) {
-    printf("Enter intArray[%d].\n", i);
-    scanf("%d", &intArray[i]);
+// Description of each dimension in text output
+const char *dimensionDescriptions[NUM_DIMENSIONS] = {
+  "place of articulation", "manner of articulation", "voicing",
+  "height of the tongue", "backness of the tongue",
+  "tenseness of the vocal tract", "roundedness of the lips",
+  "simple/complex vowel"
+};
+
+// Every value the helper functions can find, in the order of their codes.
+// Code 0 ("") means there is no common value in the dimension.
+const char *featureValues[NUM_DIMENSIONS][MAX_VALUES] = {
+  {"", "Labial", "Bilabial", "Labiodental", "Dental", "Alveolar",
+   "Alveopalatal", "Palatal", "Velar", "Glottal"},
+  {"", "Stop", "Nasal", "Fricative", "Affricate", "Liquid", "Glide"},
+  {"", "Voiced", "Voiceless"},
+  {"", "High", "Mid", "Low"},
+  {"", "Front", "Central", "Back"},
+  {"", "Tensed", "Laxed"},
+  {"", "Rounded", "Unrounded"},
+  {"", "Simple Vowel", "Diphthong", "Major Diphthong", "Minor Diphthong"}
+};
+
+// Code of the value in the dimension, 0 if the value is unknown
+int featureCode(int dimension, const char value[]) {
+  int code = 1;
+
+  while (code < MAX_VALUES && featureValues[dimension][code] != NULL) {
+    if (strcmp(value, featureValues[dimension][code]) == 0) {
+      return code;
+    }
+    code++;
   }
 
-  printf("Vowel or consonant? Enter 0 if consonant, 1 if vowel.\n");
-  scanf("%d", &consonantVowel);
+  return 0;
+}
+
+// Find the common features of the consonants (consonantVowel == 0) or
+// vowels (consonantVowel == 1) with the helper functions, and store the
+// code of each dimension
+void referenceFindCommonFeatures(int intArray[], int num, int consonantVowel,
+                        unsigned char common[]) {
+  char value[20];
+
+  memset(common, 0, NUM_DIMENSIONS);
 
-  // If input is consonant
   if (consonantVowel == 0) {
-    conPlaceArticulation(intArray, num);
-    conMannerArticulation(intArray, num);
-    conVoicing(intArray, num);
+    PERF_START();
+    conPlaceArticulation(intArray, num, value);
+    PERF_STOP(DIM_PLACE, num);
+    common[DIM_PLACE] = featureCode(DIM_PLACE, value);
+    PERF_START();
+    conMannerArticulation(intArray, num, value);
+    PERF_STOP(DIM_MANNER, num);
+    common[DIM_MANNER] = featureCode(DIM_MANNER, value);
+    PERF_START();
+    conVoicing(intArray, num, value);
+    PERF_STOP(DIM_VOICING, num);
+    common[DIM_VOICING] = featureCode(DIM_VOICING, value);
   }
-  // If input is vowel
   else if (consonantVowel == 1) {
-    vowHeight(intArray, num);
-    vowBackness(intArray, num);
-    vowTenseness(intArray, num);
-    vowRoundedness(intArray, num);
-    vowDiphthong(intArray, num);
+    PERF_START();
+    vowHeight(intArray, num, value);
+    PERF_STOP(DIM_HEIGHT, num);
+    common[DIM_HEIGHT] = featureCode(DIM_HEIGHT, value);
+    PERF_START();
+    vowBackness(intArray, num, value);
+    PERF_STOP(DIM_BACKNESS, num);
+    common[DIM_BACKNESS] = featureCode(DIM_BACKNESS, value);
+    PERF_START();
+    vowTenseness(intArray, num, value);
+    PERF_STOP(DIM_TENSENESS, num);
+    common[DIM_TENSENESS] = featureCode(DIM_TENSENESS, value);
+    PERF_START();
+    vowRoundedness(intArray, num, value);
+    PERF_STOP(DIM_ROUNDEDNESS, num);
+    common[DIM_ROUNDEDNESS] = featureCode(DIM_ROUNDEDNESS, value);
+    PERF_START();
+    vowDiphthong(intArray, num, value);
+    PERF_STOP(DIM_DIPHTHONG, num);
+    common[DIM_DIPHTHONG] = featureCode(DIM_DIPHTHONG, value);
+  }
+}
+
+//===================================================================//
+//=========================== Feature Table =========================//
+//===================================================================//
+// The features the helper functions assign to each consonant and vowel,
+// so that a query can be answered with integer comparisons only.
+// A segment may have a sub value (e.g. Labial and Bilabial for p).
+#define MAX_SEGMENT_NUMBER 31
+
+typedef struct {
+  const char *symbol;
+  unsigned char value[NUM_DIMENSIONS];     // Code of the value, 0 if none
+  unsigned char subValue[NUM_DIMENSIONS];  // Code of the sub value, 0 if none
+} Segment;
+
+Segment segmentTable[2][MAX_SEGMENT_NUMBER + 1];
+int segmentCount[2];
+
+// Value and sub value of each dimension, separated by '/'
+const char *consonantFeatures[][4] = {
+  // symbol, place, manner, voicing
+  {"p", "Labial/Bilabial", "Stop", "Voiceless"},
+  {"b", "Labial/Bilabial", "Stop", "Voiced"},
+  {"m", "Labial/Bilabial", "Nasal/Stop", "Voiced"},
+  {"f", "Labial/Labiodental", "Fricative", "Voiceless"},
+  {"v", "Labial/Labiodental", "Fricative", "Voiced"},
+  {"θ", "Dental", "Fricative", "Voiceless"},
+  {"ð", "Dental", "Fricative", "Voiced"},
+  {"t", "Alveolar", "Stop", "Voiceless"},
+  {"d", "Alveolar", "Stop", "Voiced"},
+  {"n", "Alveolar", "Nasal/Stop", "Voiced"},
+  {"s", "Alveolar", "Fricative", "Voiceless"},
+  {"z", "Alveolar", "Fricative", "Voiced"},
+  {"l", "Alveolar", "Liquid", "Voiced"},
+  {"ɹ/r", "Alveolar", "Liquid", "Voiced"},
+  {"ʃ", "Alveopalatal", "Fricative", "Voiceless"},
+  {"ʒ", "Alveopalatal", "Fricative", "Voiced"},
+  {"ʧ", "Alveopalatal", "Affricate", "Voiceless"},
+  {"ʤ", "Alveopalatal", "Affricate", "Voiced"},
+  {"j", "Palatal", "Glide", "Voiced"},
+  {"k", "Velar", "Stop", "Voiceless"},
+  {"g", "Velar", "Stop", "Voiced"},
+  {"ŋ", "Velar", "Nasal/Stop", "Voiced"},
+  {"w", "Labial/Velar", "Glide", "Voiced"},
+  {"ʔ", "Glottal", "Stop", "Voiceless"},
+  {"h", "Glottal", "Fricative", "Voiceless"},
+  {NULL, NULL, NULL, NULL}
+};
+
+const char *vowelFeatures[][6] = {
+  // symbol, height, backness, tenseness, roundedness, simple/complex vowel
+  {"i", "High", "Front", "Tensed", "Unrounded", "Simple Vowel"},
+  {"ɪ", "High", "Front", "Laxed", "Unrounded", "Simple Vowel"},
+  {"u", "High", "Back", "Tensed", "Rounded", "Simple Vowel"},
+  {"ʊ", "High", "Back", "Laxed", "Rounded", "Simple Vowel"},
+  {"e/ej", "Mid", "Front", "Tensed", "Unrounded", "Diphthong/Minor Diphthong"},
+  {"ɛ", "Mid", "Front", "Laxed", "Unrounded", "Simple Vowel"},
+  {"ə", "Mid", "Central", "Laxed", "Unrounded", "Simple Vowel"},
+  {"ʌ", "Mid", "Central", "Laxed", "Unrounded", "Simple Vowel"},
+  {"o/ow", "Mid", "Back", "Tensed", "Rounded", "Diphthong/Minor Diphthong"},
+  {"ɔj", "Mid", "Back", "Tensed", "Rounded", "Diphthong/Major Diphthong"},
+  {"ɔ", "Mid", "Back", "Laxed", "Rounded", "Simple Vowel"},
+  {"æ", "Low", "Front", "Laxed", "Unrounded", "Simple Vowel"},
+  {"aj", "Low", "Central", "Tensed", "Unrounded", "Diphthong/Major Diphthong"},
+  {"aw", "Low", "Central", "Tensed", "Unrounded", "Diphthong/Major Diphthong"},
+  {"ɑ", "Low", "Back", "Tensed", "Unrounded", "Simple Vowel"},
+  {NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+// Store the codes of "Value" or "Value/Sub Value"
+void setSegmentFeature(Segment *segment, int dimension, const char feature[]) {
+  char value[40];
+  const char *separator = strchr(feature, '/');
+
+  if (separator == NULL) {
+    segment->value[dimension] = featureCode(dimension, feature);
+    segment->subValue[dimension] = 0;
   }
-  // Invalid input
   else {
-    printf("Invalid Input\n");
+    memcpy(value, feature, separator - feature);
+    value[separator - feature] = '\0';
+    segment->value[dimension] = featureCode(dimension, value);
+    segment->subValue[dimension] = featureCode(dimension, separator + 1);
+  }
+}
+
+void initSegmentTable(void) {
+  int number;
+  int d;
+
+  memset(segmentTable, 0, sizeof(segmentTable));
+  for (number = 1; consonantFeatures[number - 1][0] != NULL; number++) {
+    segmentTable[0][number].symbol = consonantFeatures[number - 1][0];
+    for (d = 0; d < numDimensions[0]; d++) {
+      setSegmentFeature(&segmentTable[0][number], firstDimension[0] + d,
+                        consonantFeatures[number - 1][d + 1]);
+    }
+  }
+  segmentCount[0] = number - 1;
+
+  for (number = 1; vowelFeatures[number - 1][0] != NULL; number++) {
+    segmentTable[1][number].symbol = vowelFeatures[number - 1][0];
+    for (d = 0; d < numDimensions[1]; d++) {
+      setSegmentFeature(&segmentTable[1][number], firstDimension[1] + d,
+                        vowelFeatures[number - 1][d + 1]);
+    }
+  }
+  segmentCount[1] = number - 1;
+}
+
+// Common value of one dimension, following the helper functions exactly:
+// the first two segments choose the value (their shared value, or the sub
+// value of one that is the value or sub value of the other), and every
+// other segment must have it as its value or sub value. This makes the
+// answer depend on the order, e.g. m n p has no common manner but m p n
+// has Stop.
+int tableCommonValue(const int intArray[], int num, int consonantVowel,
+                     int dimension) {
+  const Segment *table = segmentTable[consonantVowel];
+  unsigned int count = (unsigned int)segmentCount[consonantVowel];
+  int value;
+  int subValue;
+  int i;
+
+  STATS_CALL(dimension);
+  if (num <= 0 || (unsigned int)intArray[0] - 1 >= count) {
+    STATS_EXIT(dimension, 0);
     return 0;
   }
+  value = table[intArray[0]].value[dimension];
+  subValue = table[intArray[0]].subValue[dimension];
+
+  if (num > 1) {
+    const Segment *second;
+    if ((unsigned int)intArray[1] - 1 >= count) {
+      STATS_EXIT(dimension, 1);
+      return 0;
+    }
+    second = &table[intArray[1]];
+
+    if (second->value[dimension] == value) {
+      // Value is shared
+    }
+    else if (subValue != 0 && second->subValue[dimension] != 0) {
+      if (second->subValue[dimension] != subValue) {
+        STATS_EXIT(dimension, 1);
+        return 0;
+      }
+      value = subValue;
+    }
+    else if (subValue != 0) {
+      if (second->value[dimension] != subValue) {
+        STATS_EXIT(dimension, 1);
+        return 0;
+      }
+      value = subValue;
+    }
+    else if (second->subValue[dimension] != value) {
+      STATS_EXIT(dimension, 1);
+      return 0;
+    }
+  }
+
+  for (i = 2; i < num; i++) {
+    if ((unsigned int)intArray[i] - 1 >= count ||
+        (table[intArray[i]].value[dimension] != value &&
+         table[intArray[i]].subValue[dimension] != value)) {
+      STATS_EXIT(dimension, i);
+      return 0;
+    }
+  }
+
+  STATS_COMPLETE(dimension);
+  return value;
+}
+
+void tableFindCommonFeatures(const int intArray[], int num, int consonantVowel,
+                             unsigned char common[]) {
+  int d;
+
+  memset(common, 0, NUM_DIMENSIONS);
+  if (consonantVowel != 0 && consonantVowel != 1) {
+    return ;
+  }
+  for (d = firstDimension[consonantVowel];
+       d < firstDimension[consonantVowel] + numDimensions[consonantVowel]; d++) {
+    PERF_START();
+    common[d] = tableCommonValue(intArray, num, consonantVowel, d);
+    PERF_STOP(d, num);
+  }
+}
+
+//===================================================================//
+//=========================== Result Cache ==========================//
+//===================================================================//
+// The answer to a query depends on its first two segments, in order, and
+// only on the set of the other segments: their order and duplicates do not
+// matter. A query is canonicalized to one 64-bit key:
+//  - bits 0-31:  set of the other segments (bit 0 for any out of range)
+//  - bits 32-36: first segment, bits 37-41: second segment (0 if invalid)
+//  - bit 42 if there is a second segment, bit 43 if there is a first one
+//  - bit 44: the kind, bit 45: always set, so that no key is 0
+// The cache (--cache) is one table shared by every worker, in open
+// addressing: a slot is a single 64-bit word holding a key and, in bits
+// 46-63, its answer (the code of every dimension of its kind, in as few
+// bits as the values of the dimension need), or 0 if it is empty, so that
+// it is read and replaced whole with one atomic operation. A key is looked
+// for in the CACHE_PROBES slots of the cache line where it hashes, and
+// stored with a compare-and-swap in an empty slot of the line, or else
+// over one picked in turn. Readers write nothing shared, and the counters
+// are kept in one cache line per worker.
+#define CACHE_PROBES 8
+#define CACHE_KEY_BITS 46
+#define CACHE_KEY_MASK ((1ULL << CACHE_KEY_BITS) - 1)
+#define CACHE_COUNTER_SLOTS 256
+
+// Counters of the workers that share a slot (of more than
+// CACHE_COUNTER_SLOTS workers)
+typedef struct {
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long probes;      // Slots read by lookups
+  unsigned long long stores;
+  unsigned long long evictions;   // Stores over another key
+  unsigned long long races;       // Compare-and-swaps lost to another thread
+  char padding[64 - 6 * sizeof(unsigned long long)];
+} CacheCounters;
+
+unsigned long long *cacheSlots;
+unsigned int cacheLines = 0;      // Lines of CACHE_PROBES slots (a power of two), 0 if off
+int cacheAnswerBits[NUM_DIMENSIONS];
+CacheCounters cacheCounters[CACHE_COUNTER_SLOTS];
+__thread int threadWorker = 0;    // Worker the thread runs (see runParallel), 0 if none
+__thread unsigned int threadCacheVictim;
+
+// Allocate a cache of at least the number of entries
+void initCache(long long entries) {
+  int d;
+
+  cacheLines = 1;
+  while ((long long)cacheLines * CACHE_PROBES < entries) {
+    cacheLines *= 2;
+  }
+  cacheSlots = calloc((size_t)cacheLines * CACHE_PROBES, sizeof(unsigned long long));
+  for (d = 0; d < NUM_DIMENSIONS; d++) {
+    int count = 1;
+    while (count < MAX_VALUES && featureValues[d][count] != NULL) {
+      count++;
+    }
+    cacheAnswerBits[d] = 32 - __builtin_clz((unsigned int)count - 1);
+  }
+}
+
+unsigned long long cacheKey(const int intArray[], int num, int consonantVowel) {
+  unsigned int count = (unsigned int)segmentCount[consonantVowel];
+  unsigned long long key = 1ULL << 45 | (unsigned long long)consonantVowel << 44;
+  unsigned int others = 0;
+  int i;
+
+  if (num > 0) {
+    key |= 1ULL << 43;
+    key |= (unsigned long long)((unsigned int)intArray[0] - 1 < count ? intArray[0] : 0) << 32;
+  }
+  if (num > 1) {
+    key |= 1ULL << 42;
+    key |= (unsigned long long)((unsigned int)intArray[1] - 1 < count ? intArray[1] : 0) << 37;
+  }
+  for (i = 2; i < num; i++) {
+    others |= 1U << ((unsigned int)intArray[i] - 1 < count ? intArray[i] : 0);
+  }
+  return key | others;
+}
+
+// Counters of the worker: the workers of one run of runParallel have a
+// slot each
+CacheCounters *cacheThreadCounters(void) {
+  return &cacheCounters[threadWorker % CACHE_COUNTER_SLOTS];
+}
+
+// First slot of the line of the key
+unsigned long long *cacheLine(unsigned long long key) {
+  unsigned long long hash = key * 0x9E3779B97F4A7C15ULL;
+
+  return cacheSlots + (size_t)((hash >> 32) & (cacheLines - 1)) * CACHE_PROBES;
+}
 
-  printf("========END========\n");
+// Copy the cached answer of the key into common. Return 0 on a miss.
+int cacheLookup(unsigned long long key, unsigned char common[]) {
+  CacheCounters *counters = cacheThreadCounters();
+  unsigned long long *line = cacheLine(key);
+  int consonantVowel = (int)(key >> 44 & 1);
+  int p;
 
+  for (p = 0; p < CACHE_PROBES; p++) {
+    unsigned long long slot = __atomic_load_n(&line[p], __ATOMIC_RELAXED);
+    unsigned long long answer;
+    int d;
+    if ((slot & CACHE_KEY_MASK) != key) {
+      if (slot == 0) {
+        // Keys fill a line from its first slot, and are never removed
+        p++;
+        break;
+      }
+      continue;
+    }
+    answer = slot >> CACHE_KEY_BITS;
+    memset(common, 0, NUM_DIMENSIONS);
+    for (d = firstDimension[consonantVowel];
+         d < firstDimension[consonantVowel] + numDimensions[consonantVowel]; d++) {
+      common[d] = (unsigned char)(answer & ((1U << cacheAnswerBits[d]) - 1));
+      answer >>= cacheAnswerBits[d];
+    }
+    __atomic_fetch_add(&counters->probes, p + 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->hits, 1, __ATOMIC_RELAXED);
+    return 1;
+  }
+  __atomic_fetch_add(&counters->probes, p, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&counters->misses, 1, __ATOMIC_RELAXED);
   return 0;
 }
+
+void cacheStore(unsigned long long key, const unsigned char common[]) {
+  CacheCounters *counters = cacheThreadCounters();
+  unsigned long long *line = cacheLine(key);
+  unsigned long long entry = key;
+  unsigned long long slot;
+  int consonantVowel = (int)(key >> 44 & 1);
+  int shift = CACHE_KEY_BITS;
+  int p;
+  int d;
+
+  for (d = firstDimension[consonantVowel];
+       d < firstDimension[consonantVowel] + numDimensions[consonantVowel]; d++) {
+    entry |= (unsigned long long)common[d] << shift;
+    shift += cacheAnswerBits[d];
+  }
+
+  for (p = 0; p < CACHE_PROBES; p++) {
+    slot = __atomic_load_n(&line[p], __ATOMIC_RELAXED);
+    if ((slot & CACHE_KEY_MASK) == key) {
+      // Stored by another thread since the lookup
+      return ;
+    }
+    if (slot == 0) {
+      if (__atomic_compare_exchange_n(&line[p], &slot, entry, 0, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&counters->stores, 1, __ATOMIC_RELAXED);
+        return ;
+      }
+      __atomic_fetch_add(&counters->races, 1, __ATOMIC_RELAXED);
+      if ((slot & CACHE_KEY_MASK) == key) {
+        return ;
+      }
+    }
+  }
+
+  // The line is full: replace a slot picked in turn by the thread
+  p = (int)(threadCacheVictim++ % CACHE_PROBES);
+  slot = __atomic_load_n(&line[p], __ATOMIC_RELAXED);
+  if (__atomic_compare_exchange_n(&line[p], &slot, entry, 0, __ATOMIC_RELAXED,
+                                  __ATOMIC_RELAXED)) {
+    __atomic_fetch_add(&counters->stores, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->evictions, 1, __ATOMIC_RELAXED);
+  }
+  else {
+    __atomic_fetch_add(&counters->races, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Write the counters of the cache to the standard error
+void printCacheStats(void) {
+  CacheCounters total;
+  unsigned long long used = 0;
+  size_t e;
+  int s;
+
+  memset(&total, 0, sizeof(total));
+  for (s = 0; s < CACHE_COUNTER_SLOTS; s++) {
+    total.hits += __atomic_load_n(&cacheCounters[s].hits, __ATOMIC_RELAXED);
+    total.misses += __atomic_load_n(&cacheCounters[s].misses, __ATOMIC_RELAXED);
+    total.probes += __atomic_load_n(&cacheCounters[s].probes, __ATOMIC_RELAXED);
+    total.stores += __atomic_load_n(&cacheCounters[s].stores, __ATOMIC_RELAXED);
+    total.evictions += __atomic_load_n(&cacheCounters[s].evictions, __ATOMIC_RELAXED);
+    total.races += __atomic_load_n(&cacheCounters[s].races, __ATOMIC_RELAXED);
+  }
+  for (e = 0; e < (size_t)cacheLines * CACHE_PROBES; e++) {
+    used += __atomic_load_n(&cacheSlots[e], __ATOMIC_RELAXED) != 0;
+  }
+  fprintf(stderr, "cache: %llu hits, %llu misses (%.1f%% hits), %llu of %llu entries used\n",
+          total.hits, total.misses,
+          total.hits + total.misses > 0 ? 100.0 * total.hits / (total.hits + total.misses)
+                                        : 0.0,
+          used, (unsigned long long)cacheLines * CACHE_PROBES);
+  fprintf(stderr, "cache: %.2f slots read per lookup, %llu stores, %llu evictions, "
+          "%llu lost races\n",
+          total.hits + total.misses > 0 ? (double)total.probes / (total.hits + total.misses)
+                                        : 0.0,
+          total.stores, total.evictions, total.races);
+}
+
+//===================================================================//
+//============================== Engines ============================//
+//===================================================================//
+// Engine answering the queries. The helper functions stay the reference
+// that every other engine is verified against (see --verify).
+enum Engine { ENGINE_REFERENCE, ENGINE_TABLE };
+
+const char *engineNames[] = {"reference", "table"};
+int engine = ENGINE_TABLE;
+
+void findCommonFeatures(int intArray[], int num, int consonantVowel,
+                        unsigned char common[]) {
+  unsigned long long key = 0;
+
+  STATS_QUERY_BEGIN();
+  if (cacheLines > 0 && (consonantVowel == 0 || consonantVowel == 1)) {
+    key = cacheKey(intArray, num, consonantVowel);
+  }
+  if (key == 0 || !cacheLookup(key, common)) {
+    if (engine == ENGINE_REFERENCE) {
+      referenceFindCommonFeatures(intArray, num, consonantVowel, common);
+    }
+    else {
+      tableFindCommonFeatures(intArray, num, consonantVowel, common);
+    }
+    if (key != 0) {
+      cacheStore(key, common);
+    }
+  }
+  STATS_QUERY_END();
+}
+
+//===================================================================//
+//========================= Output Functions ========================//
+//===================================================================//
+enum OutputFormat {
+  FORMAT_TEXT, FORMAT_JSONL, FORMAT_CSV, FORMAT_BINARY
+};
+
+const char *formatNames[] = {"text", "jsonl", "csv", "binary"};
+
+// Every result is appended to one large buffer, which is written out only
+// when it is full or when the program finishes
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+char outputBuffer[OUTPUT_BUFFER_SIZE];
+size_t outputLength = 0;
+
+// Output of a thread kept in memory instead, to be written later in order
+// (see the parallel batch mode)
+typedef struct {
+  char *bytes;
+  size_t length;
+  size_t capacity;
+} OutputCapture;
+
+__thread OutputCapture *outputCapture;
+
+void outputFlush(void) {
+  if (outputCapture != NULL) {
+    return ;
+  }
+  if (outputLength > 0) {
+    fwrite(outputBuffer, 1, outputLength, stdout);
+    outputLength = 0;
+  }
+  fflush(stdout);
+}
+
+void outputBytes(const char *data, size_t length) {
+  if (outputCapture != NULL) {
+    if (outputCapture->length + length > outputCapture->capacity) {
+      outputCapture->capacity = 2 * (outputCapture->length + length);
+      outputCapture->bytes = realloc(outputCapture->bytes, outputCapture->capacity);
+    }
+    memcpy(outputCapture->bytes + outputCapture->length, data, length);
+    outputCapture->length += length;
+    return ;
+  }
+  if (outputLength + length > OUTPUT_BUFFER_SIZE) {
+    outputFlush();
+    // Too large to be buffered
+    if (length > OUTPUT_BUFFER_SIZE) {
+      fwrite(data, 1, length, stdout);
+      return ;
+    }
+  }
+
+  memcpy(outputBuffer + outputLength, data, length);
+  outputLength += length;
+}
+
+void outputString(const char string[]) {
+  outputBytes(string, strlen(string));
+}
+
+void outputInt(long long value) {
+  char digits[24];
+  int length = sizeof(digits);
+  unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value
+                                           : (unsigned long long)value;
+
+  do {
+    digits[--length] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0) {
+    digits[--length] = '-';
+  }
+
+  outputBytes(digits + length, sizeof(digits) - length);
+}
+
+// Text inside a JSON string, with its quotes, backslashes and control
+// characters escaped
+void outputJsonText(const char text[]) {
+  static const char hex[] = "0123456789abcdef";
+  char escape[6] = {'\\', 'u', '0', '0', 0, 0};
+  size_t start = 0;
+  size_t i;
+
+  for (i = 0; text[i] != '\0'; i++) {
+    unsigned char c = (unsigned char)text[i];
+    if (c == '"' || c == '\\' || c < 0x20) {
+      outputBytes(text + start, i - start);
+      if (c == '"' || c == '\\') {
+        escape[1] = (char)c;
+        outputBytes(escape, 2);
+        escape[1] = 'u';
+      }
+      else {
+        escape[4] = hex[c >> 4];
+        escape[5] = hex[c & 15];
+        outputBytes(escape, 6);
+      }
+      start = i + 1;
+    }
+  }
+  outputBytes(text + start, i - start);
+}
+
+// Why the last query of the thread was malformed. While queryErrorKept is
+// set (by the server, which answers the client with it), the errors of the
+// queries are kept here instead of being written to the standard error.
+#define QUERY_ERROR_SIZE 160
+__thread int queryErrorKept = 0;
+__thread char queryError[QUERY_ERROR_SIZE];
+
+void reportQueryError(const char message[]) {
+  if (queryErrorKept) {
+    snprintf(queryError, sizeof(queryError), "%s", message);
+  }
+  else {
+    fprintf(stderr, "%s\n", message);
+  }
+}
+
+// Called once before the first record
+void outputHeader(int format) {
+  int d;
+
+  if (format == FORMAT_CSV) {
+    outputString("kind,segments");
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      outputString(",");
+      outputString(dimensionKeys[d]);
+    }
+    outputString("\n");
+  }
+}
+
+// Write the common features of one query.
+//  - text:   the sentences of the interactive mode, ending with ========END========
+//  - jsonl:  one JSON object per line, null if there is no common value
+//  - csv:    kind, space-separated segments and one column per dimension
+//  - binary: fixed-width record of one byte per dimension (NUM_DIMENSIONS
+//            bytes, the value code or 0), every byte 0xFF for invalid input
+void outputRecord(int format, int consonantVowel, int intArray[], int num,
+                  const unsigned char common[]) {
+  int valid = (consonantVowel == 0 || consonantVowel == 1);
+  int first = valid ? firstDimension[consonantVowel] : 0;
+  int last = valid ? first + numDimensions[consonantVowel] : 0;
+  int d;
+  int i;
+
+  if (format == FORMAT_TEXT) {
+    if (!valid) {
+      outputString("Invalid Input");
+      if (queryErrorKept && queryError[0] != '\0') {
+        outputString(": ");
+        outputString(queryError);
+      }
+      outputString("\n");
+      return ;
+    }
+    for (d = first; d < last; d++) {
+      if (common[d] != 0) {
+        outputString("The common ");
+        outputString(dimensionDescriptions[d]);
+        outputString(" is: ");
+        outputString(featureValues[d][common[d]]);
+        outputString("\n");
+      }
+    }
+    outputString("========END========\n");
+  }
+  else if (format == FORMAT_JSONL) {
+    outputString(!valid ? "{\"kind\":null" :
+                 consonantVowel == 0 ? "{\"kind\":\"consonant\"" :
+                                       "{\"kind\":\"vowel\"");
+    outputString(",\"segments\":[");
+    for (i = 0; i < num; i++) {
+      if (i > 0) {
+        outputString(",");
+      }
+      outputInt(intArray[i]);
+    }
+    outputString("]");
+    if (!valid) {
+      outputString(",\"error\":\"Invalid Input");
+      if (queryErrorKept && queryError[0] != '\0') {
+        outputString(": ");
+        outputJsonText(queryError);
+      }
+      outputString("\"");
+    }
+    for (d = first; d < last; d++) {
+      outputString(",\"");
+      outputString(dimensionKeys[d]);
+      if (common[d] != 0) {
+        outputString("\":\"");
+        outputString(featureValues[d][common[d]]);
+        outputString("\"");
+      }
+      else {
+        outputString("\":null");
+      }
+    }
+    outputString("}\n");
+  }
+  else if (format == FORMAT_CSV) {
+    outputString(!valid ? "invalid," :
+                 consonantVowel == 0 ? "consonant," : "vowel,");
+    for (i = 0; i < num; i++) {
+      if (i > 0) {
+        outputString(" ");
+      }
+      outputInt(intArray[i]);
+    }
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      outputString(",");
+      if (d >= first && d < last && common[d] != 0) {
+        outputString(featureValues[d][common[d]]);
+      }
+    }
+    outputString("\n");
+  }
+  else if (format == FORMAT_BINARY) {
+    char record[NUM_DIMENSIONS];
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      record[d] = valid ? (char)common[d] : (char)0xFF;
+    }
+    outputBytes(record, NUM_DIMENSIONS);
+  }
+}
+
+// Little-endian bytes of the value
+void putLittleEndian(unsigned char bytes[], unsigned long long value, int size) {
+  int k;
+
+  for (k = 0; k < size; k++) {
+    bytes[k] = (unsigned char)(value >> (8 * k));
+  }
+}
+
+unsigned long long getLittleEndian(const unsigned char bytes[], int size) {
+  unsigned long long value = 0;
+  int k;
+
+  for (k = size - 1; k >= 0; k--) {
+    value = value << 8 | bytes[k];
+  }
+  return value;
+}
+
+//===================================================================//
+//========================= Input Functions =========================//
+//===================================================================//
+// Symbols accepted in place of the assigned numbers. Merged entries can be
+// written either way (e.g. "e" or "ej"), and ʧ/ʤ also as "tʃ"/"dʒ".
+// A profile may change them (see Profiles).
+#define MAX_SYMBOLS 128
+
+typedef struct {
+  const char *symbol;
+  int consonantVowel;
+  int number;
+} SymbolEntry;
+
+const SymbolEntry defaultSymbols[] = {
+  {"p", 0, 1}, {"b", 0, 2}, {"m", 0, 3}, {"f", 0, 4}, {"v", 0, 5},
+  {"θ", 0, 6}, {"ð", 0, 7}, {"t", 0, 8}, {"d", 0, 9}, {"n", 0, 10},
+  {"s", 0, 11}, {"z", 0, 12}, {"l", 0, 13}, {"ɹ", 0, 14}, {"r", 0, 14},
+  {"ʃ", 0, 15}, {"ʒ", 0, 16}, {"ʧ", 0, 17}, {"tʃ", 0, 17}, {"ʤ", 0, 18},
+  {"dʒ", 0, 18}, {"j", 0, 19}, {"k", 0, 20}, {"g", 0, 21}, {"ɡ", 0, 21},
+  {"ŋ", 0, 22}, {"w", 0, 23}, {"ʔ", 0, 24}, {"h", 0, 25},
+  {"i", 1, 1}, {"ɪ", 1, 2}, {"u", 1, 3}, {"ʊ", 1, 4}, {"e", 1, 5},
+  {"ej", 1, 5}, {"ɛ", 1, 6}, {"ə", 1, 7}, {"ʌ", 1, 8}, {"o", 1, 9},
+  {"ow", 1, 9}, {"ɔj", 1, 10}, {"ɔ", 1, 11}, {"æ", 1, 12}, {"aj", 1, 13},
+  {"aw", 1, 14}, {"ɑ", 1, 15},
+  {NULL, 0, 0}
+};
+
+SymbolEntry segmentSymbols[MAX_SYMBOLS];
+int numSymbols = 0;
+
+// Open-addressing index from the bytes of a symbol (packed into 8 bytes)
+// to its entry, so that a token is looked up with one or two probes
+#define SYMBOL_INDEX_SIZE 256
+#define MAX_SYMBOL_LENGTH 8
+unsigned long long symbolIndexKeys[SYMBOL_INDEX_SIZE];
+int symbolIndexEntries[SYMBOL_INDEX_SIZE];
+
+// Character classes of the scanner
+enum CharClass { CHAR_OTHER, CHAR_SPACE, CHAR_DIGIT, CHAR_SIGN };
+unsigned char charClass[256];
+
+unsigned long long packSymbol(const char *bytes, size_t length) {
+  unsigned long long key = 0;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    key |= (unsigned long long)(unsigned char)bytes[i] << (8 * i);
+  }
+  return key;
+}
+
+unsigned int symbolSlot(unsigned long long key) {
+  return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 56) % SYMBOL_INDEX_SIZE;
+}
+
+void addSymbol(int entry) {
+  const char *symbol = segmentSymbols[entry].symbol;
+  unsigned long long key = packSymbol(symbol, strlen(symbol));
+  unsigned int slot = symbolSlot(key);
+
+  while (symbolIndexKeys[slot] != 0 && symbolIndexKeys[slot] != key) {
+    slot = (slot + 1) % SYMBOL_INDEX_SIZE;
+  }
+  symbolIndexKeys[slot] = key;
+  symbolIndexEntries[slot] = entry;
+}
+
+void buildSymbolIndex(void) {
+  int entry;
+
+  memset(symbolIndexKeys, 0, sizeof(symbolIndexKeys));
+  for (entry = 0; entry < numSymbols; entry++) {
+    addSymbol(entry);
+  }
+}
+
+void initSymbolIndex(void) {
+  int entry;
+
+  for (numSymbols = 0; defaultSymbols[numSymbols].symbol != NULL; numSymbols++) {
+    segmentSymbols[numSymbols] = defaultSymbols[numSymbols];
+  }
+  buildSymbolIndex();
+
+  memset(charClass, CHAR_OTHER, sizeof(charClass));
+  charClass[' '] = charClass['\t'] = charClass['\n'] = CHAR_SPACE;
+  charClass['\r'] = charClass['\v'] = charClass['\f'] = CHAR_SPACE;
+  charClass[','] = CHAR_SPACE;
+  for (entry = '0'; entry <= '9'; entry++) {
+    charClass[entry] = CHAR_DIGIT;
+  }
+  charClass['-'] = CHAR_SIGN;
+}
+
+// Entry of the symbol, -1 if the bytes are not a known symbol
+int findSymbol(const char *bytes, size_t length) {
+  unsigned long long key;
+  unsigned int slot;
+
+  if (length == 0 || length > MAX_SYMBOL_LENGTH) {
+    return -1;
+  }
+  key = packSymbol(bytes, length);
+  slot = symbolSlot(key);
+  while (symbolIndexKeys[slot] != 0) {
+    if (symbolIndexKeys[slot] == key) {
+      return symbolIndexEntries[slot];
+    }
+    slot = (slot + 1) % SYMBOL_INDEX_SIZE;
+  }
+  return -1;
+}
+
+// The scanner maps a regular file into memory, or reads other inputs
+// (pipes, terminals) in large blocks, and parses the tokens in place
+#define INPUT_BLOCK_SIZE (1 << 20)
+
+typedef struct {
+  const char *data;     // Bytes of the input available to the scanner
+  size_t length;
+  size_t position;
+  long long offset;     // Byte offset of data[0] in the input
+  char *buffer;         // Block-read buffer, NULL if the input is mapped
+  size_t mappedLength;
+  int fd;
+  int eof;
+} InputScanner;
+
+enum TokenType { TOKEN_EOF, TOKEN_INT, TOKEN_SYMBOL, TOKEN_ERROR };
+
+typedef struct {
+  int type;
+  int value;            // Integer, or assigned number of the symbol
+  int consonantVowel;   // Kind of the symbol, -1 for integers
+  long long offset;     // Byte offset of the token in the input
+  const char *text;     // Bytes of the token, valid until the next token
+  int length;
+} Token;
+
+// Open the file, or the standard input if path is NULL. Return 0 on failure.
+int scannerOpen(InputScanner *scanner, const char *path) {
+  memset(scanner, 0, sizeof(*scanner));
+  scanner->fd = 0;
+  if (path != NULL) {
+    scanner->fd = open(path, O_RDONLY);
+    if (scanner->fd < 0) {
+      fprintf(stderr, "Cannot open %s\n", path);
+      return 0;
+    }
+  }
+
+  {
+    struct stat status;
+    if (fstat(scanner->fd, &status) == 0 && S_ISREG(status.st_mode) &&
+        status.st_size > 0) {
+      void *mapped = mmap(NULL, (size_t)status.st_size, PROT_READ,
+                          MAP_PRIVATE, scanner->fd, 0);
+      if (mapped != MAP_FAILED) {
+        madvise(mapped, (size_t)status.st_size, MADV_SEQUENTIAL);
+        scanner->data = mapped;
+        scanner->length = scanner->mappedLength = (size_t)status.st_size;
+        scanner->eof = 1;
+        return 1;
+      }
+    }
+  }
+
+  scanner->buffer = malloc(INPUT_BLOCK_SIZE);
+  scanner->data = scanner->buffer;
+  return 1;
+}
+
+void scannerClose(InputScanner *scanner) {
+  if (scanner->mappedLength > 0) {
+    munmap((void *)scanner->data, scanner->mappedLength);
+  }
+  free(scanner->buffer);
+  if (scanner->fd > 0) {
+    close(scanner->fd);
+  }
+  memset(scanner, 0, sizeof(*scanner));
+}
+
+// Keep the bytes from keep onwards and read the next block after them.
+// Return 0 if there is nothing more to read.
+int scannerRefill(InputScanner *scanner, size_t keep) {
+  size_t kept = scanner->length - keep;
+  long bytes;
+
+  if (scanner->eof || kept == INPUT_BLOCK_SIZE) {
+    return 0;
+  }
+  memmove(scanner->buffer, scanner->buffer + keep, kept);
+  scanner->offset += keep;
+  scanner->position -= keep;
+  scanner->length = kept;
+
+  bytes = read(scanner->fd, scanner->buffer + kept, INPUT_BLOCK_SIZE - kept);
+  if (bytes <= 0) {
+    scanner->eof = 1;
+    return 0;
+  }
+  scanner->length += bytes;
+  return 1;
+}
+
+// Read the rest of the input into memory, where a mapped file already is.
+// Return 0 if it does not fit.
+int scannerReadAll(InputScanner *scanner) {
+  size_t capacity = INPUT_BLOCK_SIZE;
+  long bytes;
+
+  while (!scanner->eof) {
+    if (scanner->length == capacity) {
+      char *buffer = realloc(scanner->buffer, capacity * 2);
+      if (buffer == NULL) {
+        fprintf(stderr, "The input does not fit in memory\n");
+        return 0;
+      }
+      scanner->buffer = buffer;
+      scanner->data = buffer;
+      capacity *= 2;
+    }
+    bytes = read(scanner->fd, scanner->buffer + scanner->length,
+                 capacity - scanner->length);
+    if (bytes <= 0) {
+      scanner->eof = 1;
+    }
+    else {
+      scanner->length += bytes;
+    }
+  }
+  return 1;
+}
+
+// Byte offset of the next unread byte
+long long scannerOffset(const InputScanner *scanner) {
+  return scanner->offset + scanner->position;
+}
+
+int scanToken(InputScanner *scanner, Token *token) {
+  const unsigned char *bytes;
+  size_t start;
+  size_t end;
+  int refilled;
+
+  // Skip separators
+  while (1) {
+    bytes = (const unsigned char *)scanner->data;
+    while (scanner->position < scanner->length &&
+           charClass[bytes[scanner->position]] == CHAR_SPACE) {
+      scanner->position++;
+    }
+    if (scanner->position < scanner->length) {
+      break;
+    }
+    if (!scannerRefill(scanner, scanner->position)) {
+      token->type = TOKEN_EOF;
+      token->offset = scannerOffset(scanner);
+      token->length = 0;
+      return TOKEN_EOF;
+    }
+  }
+
+  // Find the end of the token, reading the next block if it is cut off
+  start = scanner->position;
+  end = start;
+  while (1) {
+    bytes = (const unsigned char *)scanner->data;
+    while (end < scanner->length && charClass[bytes[end]] != CHAR_SPACE) {
+      end++;
+    }
+    if (end < scanner->length) {
+      break;
+    }
+    // The kept bytes move to the front even if nothing more is read
+    scanner->position = start;
+    refilled = scannerRefill(scanner, start);
+    end = scanner->position + (end - start);
+    start = scanner->position;
+    if (!refilled) {
+      break;
+    }
+  }
+  scanner->position = end;
+
+  token->offset = scanner->offset + start;
+  token->text = scanner->data + start;
+  token->length = (int)(end - start);
+  token->consonantVowel = -1;
+
+  // Integer
+  if (charClass[bytes[start]] == CHAR_DIGIT ||
+      (charClass[bytes[start]] == CHAR_SIGN && end - start > 1)) {
+    size_t i = start + (bytes[start] == '-');
+    int value = 0;
+    int digits = 0;
+    while (i < end && charClass[bytes[i]] == CHAR_DIGIT && digits < 9) {
+      value = value * 10 + (bytes[i] - '0');
+      digits++;
+      i++;
+    }
+    if (i == end) {
+      token->type = TOKEN_INT;
+      token->value = bytes[start] == '-' ? -value : value;
+      return TOKEN_INT;
+    }
+  }
+  // IPA symbol
+  else {
+    int entry = findSymbol(token->text, end - start);
+    if (entry >= 0) {
+      token->type = TOKEN_SYMBOL;
+      token->value = segmentSymbols[entry].number;
+      token->consonantVowel = segmentSymbols[entry].consonantVowel;
+      return TOKEN_SYMBOL;
+    }
+  }
+
+  token->type = TOKEN_ERROR;
+  return TOKEN_ERROR;
+}
+
+void reportMalformed(const Token *token, const char expected[]) {
+  char message[QUERY_ERROR_SIZE];
+
+  if (token->type == TOKEN_EOF) {
+    snprintf(message, sizeof(message), "Unexpected end of input at byte %lld: expected %s",
+             token->offset, expected);
+  }
+  else {
+    snprintf(message, sizeof(message), "Malformed token at byte %lld: '%.*s' (expected %s)",
+             token->offset, token->length > 32 ? 32 : token->length,
+             token->text, expected);
+  }
+  reportQueryError(message);
+}
+
+// One query: the segments to compare and their kind
+typedef struct {
+  int *intArray;
+  int num;
+  int capacity;
+  int consonantVowel;
+} Query;
+
+// Make room for num segments. Return 0 (after reporting) if there is no
+// memory for them.
+int queryReserve(Query *query, int num) {
+  int capacity;
+  int *intArray;
+
+  if (num <= query->capacity) {
+    return 1;
+  }
+  capacity = query->capacity <= INT_MAX / 2 && 2 * query->capacity > num
+                 ? 2 * query->capacity : num;
+  if ((size_t)capacity > SIZE_MAX / sizeof(int) ||
+      (intArray = realloc(query->intArray, sizeof(int) * (size_t)capacity)) == NULL) {
+    char message[QUERY_ERROR_SIZE];
+    snprintf(message, sizeof(message), "No memory for a query of %d segments", num);
+    reportQueryError(message);
+    return 0;
+  }
+  query->intArray = intArray;
+  query->capacity = capacity;
+  return 1;
+}
+
+// Whether the symbols of a query are of its kind, given the offset of the
+// first symbol of each kind (-1 if none). Return 0 (after reporting) if not.
+int symbolKindsMatch(const long long symbolOffset[2], int consonantVowel) {
+  char message[QUERY_ERROR_SIZE];
+
+  // A symbol of the other kind cannot be compared
+  if ((consonantVowel == 0 || consonantVowel == 1) &&
+      symbolOffset[1 - consonantVowel] >= 0) {
+    snprintf(message, sizeof(message), "Malformed token at byte %lld: %s given in a %s query",
+             symbolOffset[1 - consonantVowel],
+             consonantVowel == 0 ? "vowel" : "consonant",
+             consonantVowel == 0 ? "consonant" : "vowel");
+    reportQueryError(message);
+    return 0;
+  }
+  return 1;
+}
+
+// Read "<num> <segment>... <0|1>", where a segment is an assigned number or
+// an IPA symbol of the same kind. Return 1 if a query was read, 0 at the end
+// of the input and -1 (after reporting the byte offset) if it is malformed.
+int scanQuery(InputScanner *scanner, Query *query) {
+  Token token;
+  long long symbolOffset[2] = {-1, -1};
+  int i;
+
+  if (scanToken(scanner, &token) == TOKEN_EOF) {
+    return 0;
+  }
+  if (token.type != TOKEN_INT || token.value < 0) {
+    reportMalformed(&token, "the number of consonants/vowels");
+    return -1;
+  }
+  query->num = token.value;
+  if (!queryReserve(query, query->num)) {
+    return -1;
+  }
+
+  for (i = 0; i < query->num; i++) {
+    if (scanToken(scanner, &token) == TOKEN_SYMBOL) {
+      if (symbolOffset[token.consonantVowel] < 0) {
+        symbolOffset[token.consonantVowel] = token.offset;
+      }
+    }
+    else if (token.type != TOKEN_INT) {
+      reportMalformed(&token, "a consonant/vowel");
+      return -1;
+    }
+    query->intArray[i] = token.value;
+  }
+
+  if (scanToken(scanner, &token) != TOKEN_INT) {
+    reportMalformed(&token, "0 if consonant, 1 if vowel");
+    return -1;
+  }
+  query->consonantVowel = token.value;
+  if (!symbolKindsMatch(symbolOffset, query->consonantVowel)) {
+    return -1;
+  }
+  return 1;
+}
+
+//===================================================================//
+//=========================== Explanations ==========================//
+//===================================================================//
+// How many segments of a query have each value of each dimension, as their
+// value or sub value. The segment numbers are counted first, in four
+// interleaved histograms so that a run of the same number does not wait on
+// one counter, and each number then adds its count to the values of its
+// features: one pass over the query, and a few hundred additions.
+typedef struct {
+  int count[NUM_DIMENSIONS][MAX_VALUES];      // Value or sub value
+  int mainCount[NUM_DIMENSIONS][MAX_VALUES];  // Value only
+} ValueCounts;
+
+void countValues(const int intArray[], int num, int consonantVowel,
+                 ValueCounts *counts) {
+  int histogram[4][MAX_SEGMENT_NUMBER + 1];
+  const Segment *table = segmentTable[consonantVowel];
+  unsigned int numSegments = (unsigned int)segmentCount[consonantVowel];
+  int first = firstDimension[consonantVowel];
+  int last = first + numDimensions[consonantVowel];
+  int number;
+  int d;
+  int i;
+
+  // Numbers out of range go to the unused bin 0
+  memset(histogram, 0, sizeof(histogram));
+  for (i = 0; i + 4 <= num; i += 4) {
+    histogram[0][(unsigned int)intArray[i] - 1 < numSegments ? intArray[i] : 0]++;
+    histogram[1][(unsigned int)intArray[i + 1] - 1 < numSegments ? intArray[i + 1] : 0]++;
+    histogram[2][(unsigned int)intArray[i + 2] - 1 < numSegments ? intArray[i + 2] : 0]++;
+    histogram[3][(unsigned int)intArray[i + 3] - 1 < numSegments ? intArray[i + 3] : 0]++;
+  }
+  for (; i < num; i++) {
+    histogram[0][(unsigned int)intArray[i] - 1 < numSegments ? intArray[i] : 0]++;
+  }
+
+  memset(counts, 0, sizeof(*counts));
+  for (number = 1; number <= (int)numSegments; number++) {
+    int occurrences = histogram[0][number] + histogram[1][number] +
+                      histogram[2][number] + histogram[3][number];
+    if (occurrences == 0) {
+      continue;
+    }
+    for (d = first; d < last; d++) {
+      counts->count[d][table[number].value[d]] += occurrences;
+      counts->mainCount[d][table[number].value[d]] += occurrences;
+      counts->count[d][table[number].subValue[d]] += occurrences;
+    }
+  }
+}
+
+// Why a dimension has no common value: the value that most segments have
+// (as their value or sub value), how many have it, and the segments that
+// do not (the outliers). Unlike the common value, the majority does not
+// depend on the order; a tie goes to the value that more segments have as
+// their main value (e.g. Nasal for m n), then to the lower code.
+int explainMode = 0;
+
+typedef struct {
+  unsigned char majority[NUM_DIMENSIONS];  // Code of the value, 0 if none
+  int support[NUM_DIMENSIONS];             // Segments that have it
+} Explanation;
+
+void explainQuery(const int intArray[], int num, int consonantVowel,
+                  Explanation *explanation) {
+  ValueCounts counts;
+  int first = firstDimension[consonantVowel];
+  int last = first + numDimensions[consonantVowel];
+  int d;
+  int v;
+
+  countValues(intArray, num, consonantVowel, &counts);
+  memset(explanation, 0, sizeof(*explanation));
+  for (d = first; d < last; d++) {
+    const int *count = counts.count[d];
+    const int *mainCount = counts.mainCount[d];
+    int best = 0;
+    for (v = 1; v < MAX_VALUES; v++) {
+      if (count[v] > 0 &&
+          (best == 0 || count[v] > count[best] ||
+           (count[v] == count[best] && mainCount[v] > mainCount[best]))) {
+        best = v;
+      }
+    }
+    explanation->majority[d] = (unsigned char)best;
+    explanation->support[d] = best != 0 ? count[best] : 0;
+  }
+}
+
+// Whether the segment has the value in the dimension
+int segmentHasValue(int consonantVowel, int number, int dimension, int value) {
+  const Segment *segment;
+
+  if ((unsigned int)number - 1 >= (unsigned int)segmentCount[consonantVowel]) {
+    return 0;
+  }
+  segment = &segmentTable[consonantVowel][number];
+  return value != 0 && (segment->value[dimension] == value ||
+                        segment->subValue[dimension] == value);
+}
+
+// Write the segments that have (or not) the majority value of the dimension,
+// as symbols separated by spaces in text, as numbers otherwise
+void outputSegmentsWith(int format, int consonantVowel, const int intArray[],
+                        int num, int dimension, int value, int has,
+                        const char separator[]) {
+  int written = 0;
+  int i;
+
+  for (i = 0; i < num; i++) {
+    if (segmentHasValue(consonantVowel, intArray[i], dimension, value) != has) {
+      continue;
+    }
+    if (written++ > 0) {
+      outputString(separator);
+    }
+    if (format == FORMAT_TEXT &&
+        (unsigned int)intArray[i] - 1 < (unsigned int)segmentCount[consonantVowel]) {
+      outputString(segmentTable[consonantVowel][intArray[i]].symbol);
+    }
+    else {
+      outputInt(intArray[i]);
+    }
+  }
+}
+
+// Called once before the first explanation
+void outputExplanationHeader(int format) {
+  int d;
+
+  if (format == FORMAT_CSV) {
+    outputString("kind,segments");
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      outputString(",");
+      outputString(dimensionKeys[d]);
+      outputString(",");
+      outputString(dimensionKeys[d]);
+      outputString("_majority,");
+      outputString(dimensionKeys[d]);
+      outputString("_support,");
+      outputString(dimensionKeys[d]);
+      outputString("_outliers");
+    }
+    outputString("\n");
+  }
+}
+
+// Write the common features of one query with their explanation.
+//  - text:  the common value of each dimension, or the majority value with
+//           the segments that share it and the outliers
+//  - jsonl: per dimension, an object with the common and majority values,
+//           the support and the segments that share it or not
+//  - csv:   per dimension, the common and majority values, the support and
+//           the space-separated outliers
+void outputExplanation(int format, int consonantVowel, int intArray[], int num,
+                       const unsigned char common[],
+                       const Explanation *explanation) {
+  int valid = (consonantVowel == 0 || consonantVowel == 1);
+  int first = valid ? firstDimension[consonantVowel] : 0;
+  int last = valid ? first + numDimensions[consonantVowel] : 0;
+  int d;
+  int i;
+
+  if (!valid && format != FORMAT_CSV) {
+    outputRecord(format, consonantVowel, intArray, num, common);
+    return ;
+  }
+
+  if (format == FORMAT_TEXT) {
+    for (d = first; d < last; d++) {
+      int value = explanation->majority[d];
+      if (common[d] != 0) {
+        outputString("The common ");
+        outputString(dimensionDescriptions[d]);
+        outputString(" is: ");
+        outputString(featureValues[d][common[d]]);
+        outputString("\n");
+      }
+      else if (value == 0) {
+        outputString("No segment has a ");
+        outputString(dimensionDescriptions[d]);
+        outputString("\n");
+      }
+      else {
+        outputString("The most common ");
+        outputString(dimensionDescriptions[d]);
+        outputString(" is: ");
+        outputString(featureValues[d][value]);
+        outputString(" (");
+        outputInt(explanation->support[d]);
+        outputString(" of ");
+        outputInt(num);
+        outputString(": ");
+        outputSegmentsWith(format, consonantVowel, intArray, num, d, value, 1, " ");
+        if (explanation->support[d] < num) {
+          outputString("; not ");
+          outputSegmentsWith(format, consonantVowel, intArray, num, d, value, 0, " ");
+        }
+        outputString(")\n");
+      }
+    }
+    outputString("========END========\n");
+  }
+  else if (format == FORMAT_JSONL) {
+    outputString(consonantVowel == 0 ? "{\"kind\":\"consonant\"" :
+                                       "{\"kind\":\"vowel\"");
+    outputString(",\"segments\":[");
+    for (i = 0; i < num; i++) {
+      if (i > 0) {
+        outputString(",");
+      }
+      outputInt(intArray[i]);
+    }
+    outputString("]");
+    for (d = first; d < last; d++) {
+      int value = explanation->majority[d];
+      outputString(",\"");
+      outputString(dimensionKeys[d]);
+      outputString("\":{\"common\":");
+      if (common[d] != 0) {
+        outputString("\"");
+        outputString(featureValues[d][common[d]]);
+        outputString("\"");
+      }
+      else {
+        outputString("null");
+      }
+      outputString(",\"majority\":");
+      if (value != 0) {
+        outputString("\"");
+        outputString(featureValues[d][value]);
+        outputString("\"");
+      }
+      else {
+        outputString("null");
+      }
+      outputString(",\"support\":");
+      outputInt(explanation->support[d]);
+      outputString(",\"shared\":[");
+      outputSegmentsWith(format, consonantVowel, intArray, num, d, value, 1, ",");
+      outputString("],\"outliers\":[");
+      outputSegmentsWith(format, consonantVowel, intArray, num, d, value, 0, ",");
+      outputString("]}");
+    }
+    outputString("}\n");
+  }
+  else if (format == FORMAT_CSV) {
+    outputString(!valid ? "invalid," :
+                 consonantVowel == 0 ? "consonant," : "vowel,");
+    for (i = 0; i < num; i++) {
+      if (i > 0) {
+        outputString(" ");
+      }
+      outputInt(intArray[i]);
+    }
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      int value = explanation->majority[d];
+      if (d < first || d >= last) {
+        outputString(",,,,");
+        continue;
+      }
+      outputString(",");
+      if (common[d] != 0) {
+        outputString(featureValues[d][common[d]]);
+      }
+      outputString(",");
+      if (value != 0) {
+        outputString(featureValues[d][value]);
+      }
+      outputString(",");
+      outputInt(explanation->support[d]);
+      outputString(",");
+      outputSegmentsWith(format, consonantVowel, intArray, num, d, value, 0, " ");
+    }
+    outputString("\n");
+  }
+}
+
+// Features shared by at least a fraction of the segments (--threshold),
+// e.g. Voiced in 90% of a set of word-final consonants. Every value with
+// enough support is reported, from the same counters as an explanation.
+double thresholdFraction = 0;  // 0 if not asked
+
+// Smallest support that reaches the threshold among num segments
+int thresholdSupport(int num) {
+  int support = (int)ceil(thresholdFraction * num - 1e-9);
+  return support > 0 ? support : 1;
+}
+
+// Called once before the first query
+void outputThresholdHeader(int format) {
+  int d;
+
+  if (format == FORMAT_CSV) {
+    outputString("kind,segments,minimum");
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      outputString(",");
+      outputString(dimensionKeys[d]);
+    }
+    outputString("\n");
+  }
+}
+
+// Write the values of one query that reach the threshold.
+//  - text:  one sentence per value, with its support
+//  - jsonl: per dimension, a list of {"value","support"} objects
+//  - csv:   the minimum support, then per dimension "Value:support" cells
+//           separated by spaces
+void outputThreshold(int format, int consonantVowel, int intArray[], int num,
+                     const ValueCounts *counts) {
+  unsigned char none[NUM_DIMENSIONS] = {0};
+  int valid = (consonantVowel == 0 || consonantVowel == 1);
+  int first = valid ? firstDimension[consonantVowel] : 0;
+  int last = valid ? first + numDimensions[consonantVowel] : 0;
+  int minimum = thresholdSupport(num);
+  int d;
+  int v;
+  int i;
+
+  if (!valid && format != FORMAT_CSV) {
+    outputRecord(format, consonantVowel, intArray, num, none);
+    return ;
+  }
+
+  if (format == FORMAT_JSONL) {
+    outputString(consonantVowel == 0 ? "{\"kind\":\"consonant\"" :
+                                       "{\"kind\":\"vowel\"");
+    outputString(",\"segments\":[");
+    for (i = 0; i < num; i++) {
+      if (i > 0) {
+        outputString(",");
+      }
+      outputInt(intArray[i]);
+    }
+    outputString("],\"minimum\":");
+    outputInt(minimum);
+  }
+  else if (format == FORMAT_CSV) {
+    outputString(!valid ? "invalid," :
+                 consonantVowel == 0 ? "consonant," : "vowel,");
+    for (i = 0; i < num; i++) {
+      if (i > 0) {
+        outputString(" ");
+      }
+      outputInt(intArray[i]);
+    }
+    outputString(",");
+    outputInt(minimum);
+  }
+
+  for (d = (format == FORMAT_CSV ? 0 : first);
+       d < (format == FORMAT_CSV ? NUM_DIMENSIONS : last); d++) {
+    int written = 0;
+    if (format == FORMAT_JSONL) {
+      outputString(",\"");
+      outputString(dimensionKeys[d]);
+      outputString("\":[");
+    }
+    else if (format == FORMAT_CSV) {
+      outputString(",");
+    }
+    for (v = 1; d >= first && d < last && v < MAX_VALUES; v++) {
+      int support = counts->count[d][v];
+      if (support < minimum) {
+        continue;
+      }
+      if (format == FORMAT_TEXT) {
+        outputString("The ");
+        outputString(dimensionDescriptions[d]);
+        outputString(" ");
+        outputString(featureValues[d][v]);
+        outputString(" is shared by ");
+        outputInt(support);
+        outputString(" of ");
+        outputInt(num);
+        outputString("\n");
+      }
+      else if (format == FORMAT_JSONL) {
+        outputString(written++ > 0 ? ",{\"value\":\"" : "{\"value\":\"");
+        outputString(featureValues[d][v]);
+        outputString("\",\"support\":");
+        outputInt(support);
+        outputString("}");
+      }
+      else {
+        outputString(written++ > 0 ? " " : "");
+        outputString(featureValues[d][v]);
+        outputString(":");
+        outputInt(support);
+      }
+    }
+    if (format == FORMAT_JSONL) {
+      outputString("]");
+    }
+  }
+
+  outputString(format == FORMAT_TEXT ? "========END========\n" :
+               format == FORMAT_JSONL ? "}\n" : "\n");
+}
+
+//===================================================================//
+//======================== Parallel Functions =======================//
+//===================================================================//
+// Number of worker threads, 0 for one per processor
+int numThreads = 0;
+
+typedef void (*ParallelTask)(int worker, int numWorkers, void *context);
+
+typedef struct {
+  ParallelTask task;
+  void *context;
+  int worker;
+  int numWorkers;
+} ParallelWorker;
+
+int workerCount(void) {
+  if (numThreads > 0) {
+    return numThreads;
+  }
+#ifdef _SC_NPROCESSORS_ONLN
+  {
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors > 0) {
+      return processors > 256 ? 256 : (int)processors;
+    }
+  }
+#endif
+  return 1;
+}
+
+void *runParallelWorker(void *argument) {
+  ParallelWorker *worker = argument;
+  int previous = threadWorker;
+
+  threadWorker = worker->worker;
+  worker->task(worker->worker, worker->numWorkers, worker->context);
+  threadWorker = previous;
+  return NULL;
+}
+
+// Worker on a thread of its own, which releases what the thread opened
+void *runParallelThread(void *argument) {
+  runParallelWorker(argument);
+  PERF_CLOSE();
+  return NULL;
+}
+
+// Run task(worker, numWorkers, context) on every worker and wait for all of
+// them. Worker 0 runs on the calling thread.
+void runParallel(ParallelTask task, void *context, int numWorkers) {
+  pthread_t *threads = malloc(sizeof(pthread_t) * numWorkers);
+  ParallelWorker *workers = malloc(sizeof(ParallelWorker) * numWorkers);
+  int started = 1;
+  int w;
+
+  for (w = 0; w < numWorkers; w++) {
+    workers[w].task = task;
+    workers[w].context = context;
+    workers[w].worker = w;
+    workers[w].numWorkers = numWorkers;
+  }
+  for (w = 1; w < numWorkers; w++) {
+    if (pthread_create(&threads[w], NULL, runParallelThread, &workers[w]) != 0) {
+      break;
+    }
+    started++;
+  }
+  // Workers that could not be started are run here
+  for (w = 0; w < numWorkers; w++) {
+    if (w == 0 || w >= started) {
+      runParallelWorker(&workers[w]);
+    }
+  }
+  for (w = 1; w < started; w++) {
+    pthread_join(threads[w], NULL);
+  }
+
+  free(threads);
+  free(workers);
+}
+
+// Share of the range [0, total) done by the worker
+void workerRange(long long total, int worker, int numWorkers,
+                 long long *begin, long long *end) {
+  *begin = total * worker / numWorkers;
+  *end = total * (worker + 1) / numWorkers;
+}
+
+// xorshift64* generator, one state per worker
+unsigned long long nextRandom(unsigned long long *state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//===================================================================//
+//=========================== Verification ==========================//
+//===================================================================//
+// The verification compares an engine against the helper functions on
+//  - every sequence (with repetition) of up to verifyLength segments
+//    (MAX_VERIFY_LENGTH at most), including the out-of-range numbers 0
+//    and count + 1,
+//  - every subset in ascending and in descending order,
+//  - every subset starting with every ordered pair of its segments (the
+//    helper functions only depend on the order through the first two
+//    segments, so this covers every order), for vowels,
+//  - verifyRandom random multisets of up to 1000 segments.
+#define MAX_REPORTED_DIVERGENCES 10
+#define MAX_RANDOM_LENGTH 1000
+#define MAX_VERIFY_LENGTH 12
+
+int verifyLength = 4;
+long long verifyRandom = 1000000;
+unsigned long long verifySeed = 2020;
+
+enum VerifyPart {
+  VERIFY_SEQUENCES, VERIFY_SUBSETS, VERIFY_FIRST_PAIRS, VERIFY_RANDOM
+};
+
+const char *verifyPartNames[] = {
+  "sequences", "ordered subsets", "subsets by first pair", "random multisets"
+};
+
+typedef struct {
+  int part;
+  int consonantVowel;
+  int candidate;
+  long long total;                 // Number of cases of the part
+  long long queries[256];          // Queries compared by each worker
+  long long divergences[256];      // Divergences found by each worker
+  pthread_mutex_t reportLock;
+  int reported;
+} Verification;
+
+// Compare one query and report it if the engines disagree
+void verifyQuery(Verification *verification, int worker, int intArray[],
+                 int num) {
+  unsigned char expected[NUM_DIMENSIONS];
+  unsigned char actual[NUM_DIMENSIONS];
+  int consonantVowel = verification->consonantVowel;
+  int d;
+  int i;
+
+  verification->queries[worker]++;
+  referenceFindCommonFeatures(intArray, num, consonantVowel, expected);
+  if (verification->candidate == ENGINE_TABLE) {
+    tableFindCommonFeatures(intArray, num, consonantVowel, actual);
+  }
+  else {
+    referenceFindCommonFeatures(intArray, num, consonantVowel, actual);
+  }
+  if (memcmp(expected, actual, NUM_DIMENSIONS) == 0) {
+    return ;
+  }
+
+  verification->divergences[worker]++;
+  pthread_mutex_lock(&verification->reportLock);
+  if (verification->reported < MAX_REPORTED_DIVERGENCES) {
+    verification->reported++;
+    printf("Divergence (%s):", consonantVowel == 0 ? "consonants" : "vowels");
+    for (i = 0; i < num && i < 32; i++) {
+      printf(" %d", intArray[i]);
+    }
+    printf(num > 32 ? " ...\n" : "\n");
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      if (expected[d] != actual[d]) {
+        printf("  %s: reference \"%s\", %s \"%s\"\n", dimensionKeys[d],
+               featureValues[d][expected[d]],
+               engineNames[verification->candidate],
+               featureValues[d][actual[d]]);
+      }
+    }
+  }
+  pthread_mutex_unlock(&verification->reportLock);
+}
+
+void verifyTask(int worker, int numWorkers, void *context) {
+  Verification *verification = context;
+  int count = segmentCount[verification->consonantVowel];
+  int intArray[MAX_RANDOM_LENGTH];
+  unsigned long long state = verifySeed * 0x9E3779B97F4A7C15ULL + worker + 1;
+  long long begin;
+  long long end;
+  long long c;
+  int num;
+  int i;
+
+  workerRange(verification->total, worker, numWorkers, &begin, &end);
+  for (c = begin; c < end; c++) {
+    if (verification->part == VERIFY_SEQUENCES) {
+      // Case c is a sequence of num segments written in base count + 2,
+      // after all the shorter sequences
+      long long digits = c;
+      long long size = 1;
+      for (num = 0; digits >= size; num++) {
+        digits -= size;
+        size *= count + 2;
+      }
+      for (i = 0; i < num; i++) {
+        intArray[i] = (int)(digits % (count + 2));
+        digits /= count + 2;
+      }
+      verifyQuery(verification, worker, intArray, num);
+    }
+    else if (verification->part == VERIFY_SUBSETS) {
+      num = 0;
+      for (i = 1; i <= count; i++) {
+        if (c & (1LL << (i - 1))) {
+          intArray[num++] = i;
+        }
+      }
+      verifyQuery(verification, worker, intArray, num);
+      for (i = 0; i < num / 2; i++) {
+        int swap = intArray[i];
+        intArray[i] = intArray[num - 1 - i];
+        intArray[num - 1 - i] = swap;
+      }
+      verifyQuery(verification, worker, intArray, num);
+    }
+    else if (verification->part == VERIFY_FIRST_PAIRS) {
+      int members[MAX_SEGMENT_NUMBER];
+      int numMembers = 0;
+      int first;
+      int second;
+      for (i = 1; i <= count; i++) {
+        if (c & (1LL << (i - 1))) {
+          members[numMembers++] = i;
+        }
+      }
+      for (first = 0; first < numMembers; first++) {
+        for (second = 0; second < numMembers; second++) {
+          if (first == second) {
+            continue;
+          }
+          intArray[0] = members[first];
+          intArray[1] = members[second];
+          num = 2;
+          for (i = 0; i < numMembers; i++) {
+            if (i != first && i != second) {
+              intArray[num++] = members[i];
+            }
+          }
+          verifyQuery(verification, worker, intArray, num);
+        }
+      }
+    }
+    else {
+      // Draw from a small pool of segments so that the multiset often has
+      // common features, with an occasional out-of-range number
+      int pool[4];
+      int poolSize = 1 + (int)(nextRandom(&state) % 4);
+      num = 1 + (int)(nextRandom(&state) % (nextRandom(&state) % 8 == 0 ?
+                                            MAX_RANDOM_LENGTH : 16));
+      for (i = 0; i < poolSize; i++) {
+        pool[i] = 1 + (int)(nextRandom(&state) % count);
+      }
+      for (i = 0; i < num; i++) {
+        intArray[i] = pool[nextRandom(&state) % poolSize];
+      }
+      if (nextRandom(&state) % 64 == 0) {
+        intArray[nextRandom(&state) % num] = (int)(nextRandom(&state) % 2) * (count + 1);
+      }
+      verifyQuery(verification, worker, intArray, num);
+    }
+  }
+}
+
+// Compare the candidate engine against the helper functions. Return the
+// number of divergences.
+long long runVerification(int candidate) {
+  Verification verification;
+  int numWorkers = workerCount();
+  long long totalDivergences = 0;
+  int part;
+  int consonantVowel;
+  int w;
+
+  if (numWorkers > 256) {
+    numWorkers = 256;
+  }
+  memset(&verification, 0, sizeof(verification));
+  pthread_mutex_init(&verification.reportLock, NULL);
+  verification.candidate = candidate;
+
+  printf("Verifying the %s engine against the helper functions (%d threads)\n",
+         engineNames[candidate], numWorkers);
+  for (part = VERIFY_SEQUENCES; part <= VERIFY_RANDOM; part++) {
+    for (consonantVowel = 0; consonantVowel <= 1; consonantVowel++) {
+      int count = segmentCount[consonantVowel];
+      long long queries = 0;
+      long long divergences = 0;
+
+      if (part == VERIFY_SEQUENCES) {
+        long long size = 1;
+        verification.total = 0;
+        for (w = 0; w <= verifyLength; w++) {
+          verification.total += size;
+          if (w < verifyLength &&
+              size > (LLONG_MAX - verification.total) / (count + 2)) {
+            fprintf(stderr, "Too many sequences of %d segments to verify\n", verifyLength);
+            pthread_mutex_destroy(&verification.reportLock);
+            return -1;
+          }
+          size *= count + 2;
+        }
+      }
+      else if (part == VERIFY_SUBSETS) {
+        verification.total = 1LL << count;
+      }
+      else if (part == VERIFY_FIRST_PAIRS) {
+        // Too many consonant subsets times pairs to enumerate
+        if (count > 16) {
+          continue;
+        }
+        verification.total = 1LL << count;
+      }
+      else {
+        verification.total = verifyRandom;
+      }
+
+      verification.part = part;
+      verification.consonantVowel = consonantVowel;
+      memset(verification.queries, 0, sizeof(verification.queries));
+      memset(verification.divergences, 0, sizeof(verification.divergences));
+      runParallel(verifyTask, &verification, numWorkers);
+
+      for (w = 0; w < numWorkers; w++) {
+        queries += verification.queries[w];
+        divergences += verification.divergences[w];
+      }
+      totalDivergences += divergences;
+      printf("%-22s %-10s %12lld queries, %lld divergences\n",
+             verifyPartNames[part],
+             consonantVowel == 0 ? "consonants" : "vowels",
+             queries, divergences);
+    }
+  }
+
+  pthread_mutex_destroy(&verification.reportLock);
+  printf(totalDivergences == 0 ? "No divergence\n" : "Divergences found\n");
+  return totalDivergences;
+}
+
+//===================================================================//
+//============================== Corpora ============================//
+//===================================================================//
+// A corpus has one transcribed word per line, each segment written as its
+// IPA symbol and separated by spaces (e.g. "s t ɹ i t"). Segments of both
+// kinds are stored as one code: 0-31 consonants, 32-63 vowels.
+#define NUM_SEGMENT_CODES 64
+#define SEGMENT_CODE(consonantVowel, number) ((consonantVowel) << 5 | (number))
+#define CODE_KIND(code) ((code) >> 5)
+#define CODE_NUMBER(code) ((code) & 31)
+
+typedef struct {
+  unsigned char *codes;
+  int length;
+  int capacity;
+  long long offset;     // Byte offset of the line in the corpus (index of
+                        // the word in a lexicon)
+} Word;
+
+// A corpus may also be a binary lexicon (see Lexicons), which is used in
+// place: its words are already segment codes, and are not parsed.
+// Lexicon file, in the byte order of the machine that wrote it:
+//  - "CFLX", the version (4 bytes), the number of words, of segments and
+//    of bytes of headwords (8 bytes each)
+//  - where the segments of each word start, numWords + 1 8-byte offsets
+//  - where the headword of each word starts, numWords + 1 8-byte offsets
+//  - the code of every segment, 1 byte each
+//  - the stress of every segment, 1 byte each: 0 if none, 1 + the stress
+//    digit of a vowel (1 unstressed, 2 primary, 3 secondary)
+//  - the headwords, each ending with '\0'
+#define LEXICON_VERSION 1
+#define LEXICON_HEADER_SIZE 32
+
+typedef struct {
+  unsigned long long numWords;
+  unsigned long long numSegments;
+  unsigned long long headwordBytes;
+  const unsigned long long *segmentStart;
+  const unsigned long long *headwordStart;
+  const unsigned char *codes;    // NULL if the corpus is not a lexicon
+  const unsigned char *stress;
+  const char *headwords;
+} Lexicon;
+
+// View the bytes as a lexicon whose offsets were already checked (by
+// lexiconView): only the header and the sizes are. Return 1 if they are
+// one, 0 if they are not, -1 (after reporting) if they are a damaged
+// lexicon.
+int lexiconMap(const char *data, size_t length, Lexicon *lexicon) {
+  unsigned int version;
+  unsigned long long counts[3];
+  unsigned long long size;
+
+  memset(lexicon, 0, sizeof(*lexicon));
+  if (length < LEXICON_HEADER_SIZE || memcmp(data, "CFLX", 4) != 0) {
+    return 0;
+  }
+  memcpy(&version, data + 4, sizeof(version));
+  memcpy(counts, data + 8, sizeof(counts));
+  // No array is larger than the file, so that the sum cannot overflow
+  if (version != LEXICON_VERSION || counts[0] >= length / 16 ||
+      counts[1] > length / 2 || counts[2] > length) {
+    fprintf(stderr, "Damaged or incompatible lexicon\n");
+    return -1;
+  }
+  size = LEXICON_HEADER_SIZE + 16 * (counts[0] + 1) + 2 * counts[1] + counts[2];
+  if (size != length) {
+    fprintf(stderr, "Damaged or incompatible lexicon\n");
+    return -1;
+  }
+
+  lexicon->numWords = counts[0];
+  lexicon->numSegments = counts[1];
+  lexicon->headwordBytes = counts[2];
+  lexicon->segmentStart = (const unsigned long long *)(data + LEXICON_HEADER_SIZE);
+  lexicon->headwordStart = lexicon->segmentStart + counts[0] + 1;
+  lexicon->codes = (const unsigned char *)(lexicon->headwordStart + counts[0] + 1);
+  lexicon->stress = lexicon->codes + counts[1];
+  lexicon->headwords = (const char *)(lexicon->stress + counts[1]);
+  if (lexicon->segmentStart[counts[0]] != counts[1] ||
+      lexicon->headwordStart[counts[0]] != counts[2]) {
+    fprintf(stderr, "Damaged or incompatible lexicon\n");
+    memset(lexicon, 0, sizeof(*lexicon));
+    return -1;
+  }
+  return 1;
+}
+
+// View the bytes as a lexicon, checking every offset: the segments and the
+// headword of each word start in order, within their arrays, and each
+// headword ends with '\0'. Return as lexiconMap.
+int lexiconView(const char *data, size_t length, Lexicon *lexicon) {
+  unsigned long long w;
+  int status = lexiconMap(data, length, lexicon);
+
+  if (status <= 0) {
+    return status;
+  }
+  for (w = 0; w < lexicon->numWords; w++) {
+    unsigned long long segments = lexicon->segmentStart[w];
+    unsigned long long headword = lexicon->headwordStart[w];
+    if (segments > lexicon->segmentStart[w + 1] ||
+        lexicon->segmentStart[w + 1] - segments > INT_MAX ||
+        headword >= lexicon->headwordStart[w + 1] ||
+        lexicon->headwordStart[w + 1] > lexicon->headwordBytes ||
+        lexicon->headwords[lexicon->headwordStart[w + 1] - 1] != '\0') {
+      fprintf(stderr, "Damaged lexicon: the offsets of word %llu are out of order\n", w);
+      memset(lexicon, 0, sizeof(*lexicon));
+      return -1;
+    }
+  }
+  return 1;
+}
+
+// Whether every segment code of a lexicon (or index) is in the table, which
+// is not the case if it was written with a profile that added segments
+int segmentCodesValid(const unsigned char codes[], unsigned long long count) {
+  unsigned long long i;
+
+  for (i = 0; i < count; i++) {
+    int code = codes[i];
+    if (CODE_KIND(code) > 1 || CODE_NUMBER(code) < 1 ||
+        CODE_NUMBER(code) > segmentCount[CODE_KIND(code)]) {
+      fprintf(stderr, "The file has segments that are not in the table "
+              "(written with another --profile?)\n");
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Reads the words of a byte range of a corpus held in memory, or of a range
+// of words of a lexicon
+typedef struct {
+  const unsigned char *data;
+  size_t position;
+  size_t end;
+  long long base;       // Byte offset of data[0] in the corpus
+  Lexicon lexicon;
+} CorpusReader;
+
+// Reader of the worker's share of the corpus, cut at line boundaries so
+// that every line is read by exactly one worker
+void corpusReader(CorpusReader *reader, const InputScanner *corpus,
+                  int worker, int numWorkers) {
+  long long begin;
+  long long end;
+
+  // Checked by openCorpus
+  if (lexiconMap(corpus->data, corpus->length, &reader->lexicon) > 0) {
+    workerRange((long long)reader->lexicon.numWords, worker, numWorkers,
+                &begin, &end);
+    reader->position = (size_t)begin;
+    reader->end = (size_t)end;
+    return ;
+  }
+  workerRange((long long)corpus->length, worker, numWorkers, &begin, &end);
+  reader->data = (const unsigned char *)corpus->data;
+  reader->position = (size_t)begin;
+  reader->end = (size_t)end;
+  reader->base = 0;
+  while (reader->position > 0 && reader->position < corpus->length &&
+         reader->data[reader->position - 1] != '\n') {
+    reader->position++;
+  }
+  while (reader->end > 0 && reader->end < corpus->length &&
+         reader->data[reader->end - 1] != '\n') {
+    reader->end++;
+  }
+}
+
+void wordAppend(Word *word, int code) {
+  if (word->length == word->capacity) {
+    word->capacity = word->capacity > 0 ? 2 * word->capacity : 32;
+    word->codes = realloc(word->codes, word->capacity);
+  }
+  word->codes[word->length++] = (unsigned char)code;
+}
+
+// Copy the next word of a lexicon. Return 0 at the end.
+int scanLexiconWord(CorpusReader *reader, Word *word) {
+  const Lexicon *lexicon = &reader->lexicon;
+  unsigned long long start;
+  int length;
+
+  if (reader->position >= reader->end) {
+    return 0;
+  }
+  start = lexicon->segmentStart[reader->position];
+  length = (int)(lexicon->segmentStart[reader->position + 1] - start);
+  if (length > word->capacity) {
+    word->capacity = length;
+    word->codes = realloc(word->codes, word->capacity);
+  }
+  memcpy(word->codes, lexicon->codes + start, length);
+  word->length = length;
+  word->offset = (long long)reader->position++;
+  return 1;
+}
+
+// Read the next non-empty line. Return 1 if a word was read, 0 at the end
+// of the range and -1 (after reporting the byte offset) if a token is not
+// a known symbol.
+int scanWord(CorpusReader *reader, Word *word) {
+  const unsigned char *data = reader->data;
+  size_t position = reader->position;
+  size_t start;
+  int entry;
+
+  if (reader->lexicon.codes != NULL) {
+    return scanLexiconWord(reader, word);
+  }
+  word->length = 0;
+  while (position < reader->end) {
+    // Skip separators, stopping at the end of a non-empty line
+    while (position < reader->end && charClass[data[position]] == CHAR_SPACE) {
+      if (data[position] == '\n' && word->length > 0) {
+        reader->position = position + 1;
+        return 1;
+      }
+      position++;
+    }
+    if (position >= reader->end) {
+      break;
+    }
+
+    start = position;
+    while (position < reader->end && charClass[data[position]] != CHAR_SPACE) {
+      position++;
+    }
+    if (word->length == 0) {
+      word->offset = reader->base + (long long)start;
+    }
+    entry = findSymbol((const char *)data + start, position - start);
+    if (entry < 0) {
+      fprintf(stderr, "Malformed token at byte %lld: '%.*s' (expected an IPA "
+              "symbol)\n", reader->base + (long long)start,
+              (int)(position - start > 32 ? 32 : position - start),
+              data + start);
+      reader->position = reader->end;
+      return -1;
+    }
+    wordAppend(word, SEGMENT_CODE(segmentSymbols[entry].consonantVowel,
+                                  segmentSymbols[entry].number));
+  }
+
+  reader->position = position;
+  return word->length > 0;
+}
+
+// Read the next word from the input in blocks, so that a corpus of any size
+// is read in constant memory. A line must fit in one block.
+int scanStreamWord(InputScanner *scanner, Word *word) {
+  CorpusReader reader;
+  const char *newline;
+  int status;
+
+  // A lexicon is held whole (mapped if it is a file), and the position of
+  // the scanner is then the index of the next word
+  if (scanner->offset == 0 && scanner->length < LEXICON_HEADER_SIZE) {
+    scannerRefill(scanner, 0);
+  }
+  if (scanner->offset == 0 && scanner->length >= 4 &&
+      memcmp(scanner->data, "CFLX", 4) == 0) {
+    if (!scanner->eof && !scannerReadAll(scanner)) {
+      return -1;
+    }
+    // Checked whole at the first word only
+    status = scanner->position == 0
+                 ? lexiconView(scanner->data, scanner->length, &reader.lexicon)
+                 : lexiconMap(scanner->data, scanner->length, &reader.lexicon);
+    if (status <= 0 ||
+        (scanner->position == 0 &&
+         !segmentCodesValid(reader.lexicon.codes, reader.lexicon.numSegments))) {
+      return -1;
+    }
+    reader.position = scanner->position;
+    reader.end = (size_t)reader.lexicon.numWords;
+    status = scanLexiconWord(&reader, word);
+    scanner->position = reader.position;
+    return status;
+  }
+
+  while (1) {
+    newline = memchr(scanner->data + scanner->position, '\n',
+                     scanner->length - scanner->position);
+    if (newline == NULL && !scanner->eof &&
+        scannerRefill(scanner, scanner->position)) {
+      continue;
+    }
+    if (scanner->position >= scanner->length) {
+      return 0;
+    }
+
+    reader.data = (const unsigned char *)scanner->data;
+    reader.position = scanner->position;
+    reader.end = newline != NULL ? (size_t)(newline - scanner->data) + 1
+                                 : scanner->length;
+    reader.base = scanner->offset;
+    reader.lexicon.codes = NULL;
+    status = scanWord(&reader, word);
+    scanner->position = reader.end;
+    if (status != 0) {
+      return status;
+    }
+  }
+}
+
+// Open the corpus ("-" for the standard input) and read it into memory
+int openCorpus(InputScanner *corpus, const char *path) {
+  Lexicon lexicon;
+  int status;
+
+  if (!scannerOpen(corpus, strcmp(path, "-") == 0 ? NULL : path)) {
+    return 0;
+  }
+  if (!scannerReadAll(corpus)) {
+    scannerClose(corpus);
+    return 0;
+  }
+  status = lexiconView(corpus->data, corpus->length, &lexicon);
+  if (status < 0 ||
+      (status > 0 && !segmentCodesValid(lexicon.codes, lexicon.numSegments))) {
+    scannerClose(corpus);
+    return 0;
+  }
+  return 1;
+}
+
+// Main value of the dimension for the segment code, 0 if it has none
+int codeValue(int code, int dimension) {
+  return segmentTable[CODE_KIND(code)][CODE_NUMBER(code)].value[dimension];
+}
+
+//===================================================================//
+//============================= Lexicons ============================//
+//===================================================================//
+// A CMU Pronouncing Dictionary ("WORD  W ER1 D", ";;;" for comments) is
+// imported into a binary lexicon (see Corpora), which every corpus mode
+// then maps and reads in place. Each ARPAbet phone is written as the IPA
+// symbols of its segments, looked up like any other symbol so that a
+// profile applies (e.g. EY is "ej", its own segment with --profile split).
+// The stress digit of a vowel is kept with its segment.
+typedef struct {
+  const char *phone;
+  const char *unstressed;   // Segments with stress 0 (or no stress)
+  const char *stressed;     // Segments with stress 1 or 2
+} ArpabetPhone;
+
+const ArpabetPhone arpabetPhones[] = {
+  {"P", "p", "p"}, {"B", "b", "b"}, {"M", "m", "m"}, {"F", "f", "f"},
+  {"V", "v", "v"}, {"TH", "θ", "θ"}, {"DH", "ð", "ð"}, {"T", "t", "t"},
+  {"D", "d", "d"}, {"N", "n", "n"}, {"S", "s", "s"}, {"Z", "z", "z"},
+  {"L", "l", "l"}, {"R", "ɹ", "ɹ"}, {"SH", "ʃ", "ʃ"}, {"ZH", "ʒ", "ʒ"},
+  {"CH", "ʧ", "ʧ"}, {"JH", "ʤ", "ʤ"}, {"Y", "j", "j"}, {"K", "k", "k"},
+  {"G", "g", "g"}, {"NG", "ŋ", "ŋ"}, {"W", "w", "w"}, {"HH", "h", "h"},
+  {"IY", "i", "i"}, {"IH", "ɪ", "ɪ"}, {"UW", "u", "u"}, {"UH", "ʊ", "ʊ"},
+  {"EY", "ej", "ej"}, {"EH", "ɛ", "ɛ"}, {"AH", "ə", "ʌ"}, {"ER", "ə ɹ", "ʌ ɹ"},
+  {"OW", "ow", "ow"}, {"OY", "ɔj", "ɔj"}, {"AO", "ɔ", "ɔ"}, {"AE", "æ", "æ"},
+  {"AY", "aj", "aj"}, {"AW", "aw", "aw"}, {"AA", "ɑ", "ɑ"},
+  {NULL, NULL, NULL}
+};
+
+// Growable byte array
+typedef struct {
+  char *bytes;
+  size_t length;
+  size_t capacity;
+} ByteArray;
+
+void byteArrayAppend(ByteArray *array, const void *data, size_t length) {
+  if (array->length + length > array->capacity) {
+    array->capacity = array->capacity > 0 ? 2 * array->capacity : 1 << 16;
+    while (array->length + length > array->capacity) {
+      array->capacity *= 2;
+    }
+    array->bytes = realloc(array->bytes, array->capacity);
+  }
+  memcpy(array->bytes + array->length, data, length);
+  array->length += length;
+}
+
+// Append the segments of one phone of length bytes, e.g. "AH0" or "K".
+// Return 0 if unknown.
+int appendPhone(const char phone[], size_t length, ByteArray *codes, ByteArray *stress) {
+  char name[8];
+  const char *symbols;
+  int digit = -1;
+  int i;
+
+  if (length == 0 || length >= sizeof(name)) {
+    return 0;
+  }
+  if (phone[length - 1] >= '0' && phone[length - 1] <= '2') {
+    digit = phone[--length] - '0';
+  }
+  for (i = 0; i < (int)length; i++) {
+    name[i] = phone[i] >= 'a' && phone[i] <= 'z' ? phone[i] - 'a' + 'A' : phone[i];
+  }
+  name[length] = '\0';
+
+  for (i = 0; arpabetPhones[i].phone != NULL &&
+              strcmp(arpabetPhones[i].phone, name) != 0; i++) {
+  }
+  if (arpabetPhones[i].phone == NULL) {
+    return 0;
+  }
+
+  symbols = digit > 0 ? arpabetPhones[i].stressed : arpabetPhones[i].unstressed;
+  while (*symbols != '\0') {
+    const char *separator = strchr(symbols, ' ');
+    size_t symbolLength = separator != NULL ? (size_t)(separator - symbols)
+                                            : strlen(symbols);
+    int entry = findSymbol(symbols, symbolLength);
+    unsigned char code;
+    unsigned char mark;
+    symbols += symbolLength + (separator != NULL);
+    if (entry < 0) {
+      return 0;
+    }
+    code = (unsigned char)SEGMENT_CODE(segmentSymbols[entry].consonantVowel,
+                                       segmentSymbols[entry].number);
+    // The stress belongs to the vowel of the phone
+    mark = segmentSymbols[entry].consonantVowel == 1 && digit >= 0 ? 1 + digit : 0;
+    byteArrayAppend(codes, &code, 1);
+    byteArrayAppend(stress, &mark, 1);
+  }
+  return 1;
+}
+
+// Import the dictionary into a lexicon file. Return 0 on failure.
+int importCmudict(const char *path, const char *lexiconPath) {
+  InputScanner dictionary;
+  ByteArray codes = {NULL, 0, 0};
+  ByteArray stress = {NULL, 0, 0};
+  ByteArray headwords = {NULL, 0, 0};
+  ByteArray segmentStart = {NULL, 0, 0};
+  ByteArray headwordStart = {NULL, 0, 0};
+  unsigned long long start;
+  unsigned long long header[3];
+  unsigned int version = LEXICON_VERSION;
+  const char *data;
+  size_t position = 0;
+  size_t tokenStart;
+  int lineNumber = 0;
+  int first;
+  int status = 1;
+  FILE *file;
+
+  if (!openCorpus(&dictionary, path)) {
+    return 0;
+  }
+  data = dictionary.data;
+  // Every line is parsed in place: the headword, then the phones, each
+  // token ending at a space, tab, '\r' or the end of the line
+  while (position < dictionary.length && status) {
+    size_t end = position;
+
+    while (end < dictionary.length && data[end] != '\n') {
+      end++;
+    }
+    lineNumber++;
+    for (first = 1; status; first = 0) {
+      while (position < end &&
+             (data[position] == ' ' || data[position] == '\t' || data[position] == '\r')) {
+        position++;
+      }
+      if (position >= end) {
+        break;
+      }
+      tokenStart = position;
+      while (position < end && data[position] != ' ' && data[position] != '\t' &&
+             data[position] != '\r') {
+        position++;
+      }
+      if (first) {
+        if (position - tokenStart >= 3 && strncmp(data + tokenStart, ";;;", 3) == 0) {
+          break;
+        }
+        start = codes.length;
+        byteArrayAppend(&segmentStart, &start, sizeof(start));
+        start = headwords.length;
+        byteArrayAppend(&headwordStart, &start, sizeof(start));
+        byteArrayAppend(&headwords, data + tokenStart, position - tokenStart);
+        byteArrayAppend(&headwords, "", 1);
+      }
+      else if (!appendPhone(data + tokenStart, position - tokenStart, &codes, &stress)) {
+        fprintf(stderr, "%s:%d: unknown ARPAbet phone %.*s\n", path, lineNumber,
+                (int)(position - tokenStart > 32 ? 32 : position - tokenStart),
+                data + tokenStart);
+        status = 0;
+      }
+    }
+    position = end + 1;
+  }
+  scannerClose(&dictionary);
+
+  if (status) {
+    header[0] = segmentStart.length / sizeof(start);
+    header[1] = codes.length;
+    header[2] = headwords.length;
+    start = codes.length;
+    byteArrayAppend(&segmentStart, &start, sizeof(start));
+    start = headwords.length;
+    byteArrayAppend(&headwordStart, &start, sizeof(start));
+
+    file = fopen(lexiconPath, "wb");
+    if (file == NULL) {
+      fprintf(stderr, "Cannot write %s\n", lexiconPath);
+      status = 0;
+    }
+    else {
+      fwrite("CFLX", 1, 4, file);
+      fwrite(&version, sizeof(version), 1, file);
+      fwrite(header, sizeof(header), 1, file);
+      fwrite(segmentStart.bytes, 1, segmentStart.length, file);
+      fwrite(headwordStart.bytes, 1, headwordStart.length, file);
+      fwrite(codes.bytes, 1, codes.length, file);
+      fwrite(stress.bytes, 1, stress.length, file);
+      fwrite(headwords.bytes, 1, headwords.length, file);
+      if (fclose(file) != 0) {
+        fprintf(stderr, "Cannot write %s\n", lexiconPath);
+        status = 0;
+      }
+      else {
+        outputInt((long long)header[0]);
+        outputString(" words, ");
+        outputInt((long long)header[1]);
+        outputString(" segments written to ");
+        outputString(lexiconPath);
+        outputString("\n");
+        outputFlush();
+      }
+    }
+  }
+
+  free(codes.bytes);
+  free(stress.bytes);
+  free(headwords.bytes);
+  free(segmentStart.bytes);
+  free(headwordStart.bytes);
+  return status;
+}
+
+//===================================================================//
+//============================ Co-occurrence ========================//
+//===================================================================//
+// Every worker counts the pairs of adjacent segments of its share of the
+// corpus in a 64 x 64 table. The tables are merged, and the feature
+// matrices are computed from the merged table, which is independent of the
+// size of the corpus:
+//  - for every two dimensions, how often a value of the first segment is
+//    followed by a value of the second (e.g. manner Nasal, place Velar)
+//  - for every dimension, the same matrix between segments of the same kind
+//    that share the value of another dimension (e.g. manner Nasal followed
+//    by manner Stop, given the same place)
+typedef struct {
+  const InputScanner *corpus;
+  unsigned long long (*pairCounts)[NUM_SEGMENT_CODES][NUM_SEGMENT_CODES];
+  long long *words;
+  int failed;
+} Cooccurrence;
+
+void cooccurrenceTask(int worker, int numWorkers, void *context) {
+  Cooccurrence *cooccurrence = context;
+  unsigned long long (*counts)[NUM_SEGMENT_CODES] =
+      cooccurrence->pairCounts[worker];
+  CorpusReader reader;
+  Word word = {NULL, 0, 0, 0};
+  int status;
+  int i;
+
+  corpusReader(&reader, cooccurrence->corpus, worker, numWorkers);
+  while ((status = scanWord(&reader, &word)) > 0) {
+    cooccurrence->words[worker]++;
+    for (i = 1; i < word.length; i++) {
+      counts[word.codes[i - 1]][word.codes[i]]++;
+    }
+  }
+  if (status < 0) {
+    __atomic_store_n(&cooccurrence->failed, 1, __ATOMIC_RELAXED);
+  }
+  free(word.codes);
+}
+
+// Counts of the value pairs of dimensions first and second. If given is a
+// dimension, only the pairs of segments of the same kind sharing its value
+// are counted.
+void cooccurrenceMatrix(unsigned long long pairCounts[][NUM_SEGMENT_CODES],
+                        int first, int second, int given,
+                        unsigned long long matrix[MAX_VALUES][MAX_VALUES]) {
+  int a;
+  int b;
+
+  memset(matrix, 0, sizeof(unsigned long long) * MAX_VALUES * MAX_VALUES);
+  for (a = 0; a < NUM_SEGMENT_CODES; a++) {
+    for (b = 0; b < NUM_SEGMENT_CODES; b++) {
+      if (pairCounts[a][b] == 0) {
+        continue;
+      }
+      if (given >= 0 && (codeValue(a, given) == 0 ||
+                         codeValue(a, given) != codeValue(b, given))) {
+        continue;
+      }
+      matrix[codeValue(a, first)][codeValue(b, second)] += pairCounts[a][b];
+    }
+  }
+}
+
+void outputMatrix(int format, int first, int second, int given,
+                  unsigned long long matrix[MAX_VALUES][MAX_VALUES]) {
+  int cells = 0;
+  int a;
+  int b;
+
+  if (format == FORMAT_BINARY) {
+    // MAX_VALUES x MAX_VALUES little-endian 8-byte counts, row 0 and
+    // column 0 included
+    unsigned char bytes[8];
+    for (a = 0; a < MAX_VALUES; a++) {
+      for (b = 0; b < MAX_VALUES; b++) {
+        int i;
+        for (i = 0; i < 8; i++) {
+          bytes[i] = (unsigned char)(matrix[a][b] >> (8 * i));
+        }
+        outputBytes((const char *)bytes, 8);
+      }
+    }
+    return ;
+  }
+
+  if (format == FORMAT_JSONL) {
+    outputString("{\"first\":\"");
+    outputString(dimensionKeys[first]);
+    outputString("\",\"second\":\"");
+    outputString(dimensionKeys[second]);
+    outputString("\",\"given\":");
+    if (given >= 0) {
+      outputString("\"same ");
+      outputString(dimensionKeys[given]);
+      outputString("\"");
+    }
+    else {
+      outputString("null");
+    }
+    outputString(",\"counts\":{");
+  }
+  else if (format == FORMAT_TEXT) {
+    outputString(dimensionKeys[first]);
+    outputString(" -> ");
+    outputString(dimensionKeys[second]);
+    if (given >= 0) {
+      outputString(" (same ");
+      outputString(dimensionKeys[given]);
+      outputString(")");
+    }
+    outputString("\n");
+  }
+
+  for (a = 1; a < MAX_VALUES; a++) {
+    for (b = 1; b < MAX_VALUES; b++) {
+      if (matrix[a][b] == 0) {
+        continue;
+      }
+      if (format == FORMAT_CSV) {
+        outputString(dimensionKeys[first]);
+        outputString(",");
+        outputString(featureValues[first][a]);
+        outputString(",");
+        outputString(dimensionKeys[second]);
+        outputString(",");
+        outputString(featureValues[second][b]);
+        outputString(",");
+        outputString(given >= 0 ? dimensionKeys[given] : "");
+        outputString(",");
+      }
+      else if (format == FORMAT_JSONL) {
+        if (cells++ > 0) {
+          outputString(",");
+        }
+        outputString("\"");
+        outputString(featureValues[first][a]);
+        outputString(" > ");
+        outputString(featureValues[second][b]);
+        outputString("\":");
+      }
+      else {
+        outputString("  ");
+        outputString(featureValues[first][a]);
+        outputString(" > ");
+        outputString(featureValues[second][b]);
+        outputString(": ");
+      }
+      outputInt((long long)matrix[a][b]);
+      if (format != FORMAT_JSONL) {
+        outputString("\n");
+      }
+    }
+  }
+  if (format == FORMAT_JSONL) {
+    outputString("}}\n");
+  }
+}
+
+int runCooccurrence(const char *path, int format) {
+  InputScanner corpus;
+  Cooccurrence cooccurrence;
+  unsigned long long total[NUM_SEGMENT_CODES][NUM_SEGMENT_CODES];
+  unsigned long long matrix[MAX_VALUES][MAX_VALUES];
+  int numWorkers = workerCount();
+  long long words = 0;
+  int first;
+  int second;
+  int given;
+  int kind;
+  int w;
+
+  if (!openCorpus(&corpus, path)) {
+    return 1;
+  }
+  cooccurrence.corpus = &corpus;
+  cooccurrence.pairCounts = calloc(numWorkers, sizeof(*cooccurrence.pairCounts));
+  cooccurrence.words = calloc(numWorkers, sizeof(long long));
+  cooccurrence.failed = 0;
+  runParallel(cooccurrenceTask, &cooccurrence, numWorkers);
+  if (cooccurrence.failed) {
+    free(cooccurrence.pairCounts);
+    free(cooccurrence.words);
+    scannerClose(&corpus);
+    return 1;
+  }
+
+  // Merge the tables of the workers
+  memset(total, 0, sizeof(total));
+  for (w = 0; w < numWorkers; w++) {
+    int a;
+    int b;
+    words += cooccurrence.words[w];
+    for (a = 0; a < NUM_SEGMENT_CODES; a++) {
+      for (b = 0; b < NUM_SEGMENT_CODES; b++) {
+        total[a][b] += cooccurrence.pairCounts[w][a][b];
+      }
+    }
+  }
+
+  if (format == FORMAT_TEXT) {
+    outputInt(words);
+    outputString(" words\n");
+  }
+  else if (format == FORMAT_CSV) {
+    outputString("first,first_value,second,second_value,given_same,count\n");
+  }
+  for (first = 0; first < NUM_DIMENSIONS; first++) {
+    for (second = 0; second < NUM_DIMENSIONS; second++) {
+      cooccurrenceMatrix(total, first, second, -1, matrix);
+      outputMatrix(format, first, second, -1, matrix);
+    }
+  }
+  for (kind = 0; kind <= 1; kind++) {
+    for (first = firstDimension[kind];
+         first < firstDimension[kind] + numDimensions[kind]; first++) {
+      for (given = firstDimension[kind];
+           given < firstDimension[kind] + numDimensions[kind]; given++) {
+        if (given != first) {
+          cooccurrenceMatrix(total, first, first, given, matrix);
+          outputMatrix(format, first, first, given, matrix);
+        }
+      }
+    }
+  }
+  outputFlush();
+
+  free(cooccurrence.pairCounts);
+  free(cooccurrence.words);
+  scannerClose(&corpus);
+  return 0;
+}
+
+//===================================================================//
+//=========================== Syllabification =======================//
+//===================================================================//
+// Every vowel is a nucleus. The consonants between two nuclei are split by
+// the maximal onset principle: the next syllable takes the longest end of
+// the cluster whose sonority rises towards its nucleus, and the rest is the
+// coda of the previous syllable. The sonority comes from the manner of
+// articulation: Stop < Affricate < Fricative < Nasal < Liquid < Glide < vowel.
+// The corpus is read in blocks and written word by word, with the common
+// features of every onset and coda.
+#define VOWEL_SONORITY 7
+
+// Sonority of each manner value, in the order of featureValues[DIM_MANNER]
+const int mannerSonority[MAX_VALUES] = {0, 1, 4, 3, 2, 5, 6};
+
+typedef struct {
+  int onset;            // Position of the first segment of the syllable
+  int nucleus;          // Position of the vowel, -1 if there is none
+  int coda;             // Position after the vowel
+  int end;              // Position after the last segment
+} Syllable;
+
+int sonority(int code) {
+  if (CODE_KIND(code) == 1) {
+    return VOWEL_SONORITY;
+  }
+  return mannerSonority[codeValue(code, DIM_MANNER)];
+}
+
+// Split the word into syllables. Return the number of syllables.
+int syllabify(const Word *word, Syllable syllables[]) {
+  int numSyllables = 0;
+  int previousNucleus = -1;
+  int i;
+
+  for (i = 0; i < word->length; i++) {
+    int onset;
+    if (CODE_KIND(word->codes[i]) != 1) {
+      continue;
+    }
+    // Longest rising-sonority end of the cluster before the vowel
+    onset = i;
+    if (previousNucleus < 0) {
+      onset = 0;
+    }
+    else {
+      while (onset - 1 > previousNucleus &&
+             sonority(word->codes[onset - 1]) <
+             (onset == i ? VOWEL_SONORITY : sonority(word->codes[onset]))) {
+        onset--;
+      }
+      syllables[numSyllables - 1].coda = previousNucleus + 1;
+      syllables[numSyllables - 1].end = onset;
+    }
+    syllables[numSyllables].onset = onset;
+    syllables[numSyllables].nucleus = i;
+    syllables[numSyllables].coda = i + 1;
+    syllables[numSyllables].end = word->length;
+    numSyllables++;
+    previousNucleus = i;
+  }
+
+  // A word without vowels is one syllable without nucleus
+  if (numSyllables == 0 && word->length > 0) {
+    syllables[0].onset = 0;
+    syllables[0].nucleus = -1;
+    syllables[0].coda = word->length;
+    syllables[0].end = word->length;
+    numSyllables = 1;
+  }
+  return numSyllables;
+}
+
+void outputSymbols(const Word *word, int begin, int end, const char separator[]) {
+  int i;
+
+  for (i = begin; i < end; i++) {
+    if (i > begin) {
+      outputString(separator);
+    }
+    outputString(segmentTable[CODE_KIND(word->codes[i])]
+                             [CODE_NUMBER(word->codes[i])].symbol);
+  }
+}
+
+// Common features of the consonants word[begin, end), in the format
+void outputClusterFeatures(const Word *word, int begin, int end, int format,
+                           int intArray[]) {
+  unsigned char common[NUM_DIMENSIONS];
+  int written = 0;
+  int d;
+  int i;
+
+  for (i = begin; i < end; i++) {
+    intArray[i - begin] = CODE_NUMBER(word->codes[i]);
+  }
+  memset(common, 0, sizeof(common));
+  if (end > begin) {
+    findCommonFeatures(intArray, end - begin, 0, common);
+  }
+
+  for (d = firstDimension[0]; d < firstDimension[0] + numDimensions[0]; d++) {
+    if (format == FORMAT_CSV) {
+      outputString(",");
+      if (common[d] != 0) {
+        outputString(featureValues[d][common[d]]);
+      }
+    }
+    else if (common[d] == 0) {
+      continue;
+    }
+    else if (format == FORMAT_JSONL) {
+      outputString(written++ > 0 ? ",\"" : "\"");
+      outputString(dimensionKeys[d]);
+      outputString("\":\"");
+      outputString(featureValues[d][common[d]]);
+      outputString("\"");
+    }
+    else {
+      outputString(written++ > 0 ? " " : " (");
+      outputString(featureValues[d][common[d]]);
+    }
+  }
+  if (format == FORMAT_TEXT && written > 0) {
+    outputString(")");
+  }
+}
+
+int runSyllabify(const char *path, int format) {
+  InputScanner corpus;
+  Word word = {NULL, 0, 0, 0};
+  Syllable *syllables = NULL;
+  int *intArray = NULL;
+  int capacity = 0;
+  long long words = 0;
+  int status;
+  int s;
+
+  if (!scannerOpen(&corpus, strcmp(path, "-") == 0 ? NULL : path)) {
+    return 1;
+  }
+  if (format == FORMAT_CSV) {
+    outputString("word,syllable,onset,nucleus,coda,onset_place,onset_manner,"
+                 "onset_voicing,coda_place,coda_manner,coda_voicing\n");
+  }
+
+  while ((status = scanStreamWord(&corpus, &word)) > 0) {
+    int numSyllables;
+    words++;
+    if (word.length > capacity) {
+      capacity = word.length;
+      syllables = realloc(syllables, sizeof(Syllable) * capacity);
+      intArray = realloc(intArray, sizeof(int) * capacity);
+    }
+    numSyllables = syllabify(&word, syllables);
+
+    if (format == FORMAT_JSONL) {
+      outputString("{\"word\":\"");
+      outputSymbols(&word, 0, word.length, " ");
+      outputString("\",\"syllables\":[");
+    }
+    else if (format == FORMAT_TEXT) {
+      for (s = 0; s < numSyllables; s++) {
+        outputString(s > 0 ? " . " : "");
+        outputSymbols(&word, syllables[s].onset, syllables[s].end, " ");
+      }
+      outputString("\n");
+    }
+
+    for (s = 0; s < numSyllables; s++) {
+      const Syllable *syllable = &syllables[s];
+      int onsetEnd = syllable->nucleus >= 0 ? syllable->nucleus : syllable->end;
+      if (format == FORMAT_JSONL) {
+        outputString(s > 0 ? ",{\"onset\":\"" : "{\"onset\":\"");
+        outputSymbols(&word, syllable->onset, onsetEnd, " ");
+        outputString("\",\"nucleus\":\"");
+        outputSymbols(&word, onsetEnd, syllable->coda, " ");
+        outputString("\",\"coda\":\"");
+        outputSymbols(&word, syllable->coda, syllable->end, " ");
+        outputString("\",\"onsetFeatures\":{");
+        outputClusterFeatures(&word, syllable->onset, onsetEnd, format, intArray);
+        outputString("},\"codaFeatures\":{");
+        outputClusterFeatures(&word, syllable->coda, syllable->end, format, intArray);
+        outputString("}}");
+      }
+      else if (format == FORMAT_CSV) {
+        outputInt(words);
+        outputString(",");
+        outputInt(s + 1);
+        outputString(",");
+        outputSymbols(&word, syllable->onset, onsetEnd, " ");
+        outputString(",");
+        outputSymbols(&word, onsetEnd, syllable->coda, " ");
+        outputString(",");
+        outputSymbols(&word, syllable->coda, syllable->end, " ");
+        outputClusterFeatures(&word, syllable->onset, onsetEnd, format, intArray);
+        outputClusterFeatures(&word, syllable->coda, syllable->end, format, intArray);
+        outputString("\n");
+      }
+      else {
+        outputString("  onset: ");
+        outputSymbols(&word, syllable->onset, onsetEnd, " ");
+        outputClusterFeatures(&word, syllable->onset, onsetEnd, format, intArray);
+        outputString(" | nucleus: ");
+        outputSymbols(&word, onsetEnd, syllable->coda, " ");
+        outputString(" | coda: ");
+        outputSymbols(&word, syllable->coda, syllable->end, " ");
+        outputClusterFeatures(&word, syllable->coda, syllable->end, format, intArray);
+        outputString("\n");
+      }
+    }
+    if (format == FORMAT_JSONL) {
+      outputString("]}\n");
+    }
+  }
+  outputFlush();
+
+  free(word.codes);
+  free(syllables);
+  free(intArray);
+  scannerClose(&corpus);
+  return status < 0 ? 1 : 0;
+}
+
+//===================================================================//
+//========================= Phonotactic Model =======================//
+//===================================================================//
+// n-gram model over feature classes: a consonant is its voicing and manner
+// (e.g. Voiced Stop), a vowel its height (e.g. High), either of them none
+// for a segment without the value (e.g. set by a profile), and 0 marks the
+// word boundary. A sequence of classes is packed into one integer key, 5
+// bits a class after a leading 1, and counted in an open-addressing hash
+// table. Each worker counts its share of the corpus in its own table, and
+// the tables are merged. A word is scored by its log2 probability with
+// add-one smoothing: P(c | context) = (count(context c) + 1) /
+// (count(context) + NGRAM_CLASSES).
+#define NGRAM_MANNERS 7           // None and the 6 manners
+#define NGRAM_VOICINGS 3          // None, Voiced and Voiceless
+#define NGRAM_HEIGHTS 4           // None, High, Mid and Low
+#define NGRAM_CLASSES (1 + NGRAM_MANNERS * NGRAM_VOICINGS + NGRAM_HEIGHTS)
+#define NGRAM_BITS 5
+#define MAX_NGRAM_ORDER 8
+#define NGRAM_MODEL_VERSION 2
+
+typedef struct {
+  unsigned long long *keys;     // 0 for an empty slot
+  unsigned long long *counts;
+  size_t capacity;              // Power of two
+  size_t size;
+} NgramTable;
+
+// Class of a segment code: 1-21 for consonants, 22-25 for vowels, every
+// value 0 (none) a class of its own
+int featureClass(int code) {
+  if (CODE_KIND(code) == 1) {
+    return 1 + NGRAM_MANNERS * NGRAM_VOICINGS + codeValue(code, DIM_HEIGHT);
+  }
+  return 1 + codeValue(code, DIM_MANNER) * NGRAM_VOICINGS +
+         codeValue(code, DIM_VOICING);
+}
+
+size_t ngramSlot(unsigned long long key, size_t capacity) {
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 20) & (capacity - 1);
+}
+
+void ngramInit(NgramTable *table, size_t capacity) {
+  table->capacity = capacity;
+  table->size = 0;
+  table->keys = calloc(capacity, sizeof(unsigned long long));
+  table->counts = calloc(capacity, sizeof(unsigned long long));
+}
+
+void ngramFree(NgramTable *table) {
+  free(table->keys);
+  free(table->counts);
+  memset(table, 0, sizeof(*table));
+}
+
+void ngramAdd(NgramTable *table, unsigned long long key, unsigned long long count);
+
+// Double the capacity when the table is half full
+void ngramGrow(NgramTable *table) {
+  NgramTable grown;
+  size_t i;
+
+  ngramInit(&grown, table->capacity * 2);
+  for (i = 0; i < table->capacity; i++) {
+    if (table->keys[i] != 0) {
+      ngramAdd(&grown, table->keys[i], table->counts[i]);
+    }
+  }
+  ngramFree(table);
+  *table = grown;
+}
+
+void ngramAdd(NgramTable *table, unsigned long long key, unsigned long long count) {
+  size_t slot = ngramSlot(key, table->capacity);
+
+  while (table->keys[slot] != 0 && table->keys[slot] != key) {
+    slot = (slot + 1) & (table->capacity - 1);
+  }
+  if (table->keys[slot] == 0) {
+    if (2 * (table->size + 1) > table->capacity) {
+      ngramGrow(table);
+      ngramAdd(table, key, count);
+      return ;
+    }
+    table->keys[slot] = key;
+    table->size++;
+  }
+  table->counts[slot] += count;
+}
+
+unsigned long long ngramCount(const NgramTable *table, unsigned long long key) {
+  size_t slot = ngramSlot(key, table->capacity);
+
+  while (table->keys[slot] != 0) {
+    if (table->keys[slot] == key) {
+      return table->counts[slot];
+    }
+    slot = (slot + 1) & (table->capacity - 1);
+  }
+  return 0;
+}
+
+// Visit every n-gram of the word padded with boundaries: call visit with
+// the key of the context (n - 1 classes) and of the n-gram
+typedef void (*NgramVisit)(unsigned long long context, unsigned long long gram,
+                           void *data);
+
+void visitNgrams(const Word *word, int order, NgramVisit visit, void *data) {
+  unsigned long long mask = (1ULL << (NGRAM_BITS * (order - 1))) - 1;
+  unsigned long long history = 0;   // Last order - 1 classes, boundaries first
+  int i;
+
+  for (i = 0; i <= word->length; i++) {
+    int class = i < word->length ? featureClass(word->codes[i]) : 0;
+    unsigned long long context = (1ULL << (NGRAM_BITS * (order - 1))) | history;
+    unsigned long long gram = (context << NGRAM_BITS) | class;
+    visit(context, gram, data);
+    history = ((history << NGRAM_BITS) | class) & mask;
+  }
+}
+
+void countNgram(unsigned long long context, unsigned long long gram, void *data) {
+  NgramTable *table = data;
+  ngramAdd(table, context, 1);
+  ngramAdd(table, gram, 1);
+}
+
+typedef struct {
+  const InputScanner *corpus;
+  int order;
+  NgramTable *tables;
+  long long *words;
+  int failed;
+} NgramTraining;
+
+void ngramTask(int worker, int numWorkers, void *context) {
+  NgramTraining *training = context;
+  CorpusReader reader;
+  Word word = {NULL, 0, 0, 0};
+  int status;
+
+  ngramInit(&training->tables[worker], 1024);
+  corpusReader(&reader, training->corpus, worker, numWorkers);
+  while ((status = scanWord(&reader, &word)) > 0) {
+    training->words[worker]++;
+    visitNgrams(&word, training->order, countNgram, &training->tables[worker]);
+  }
+  if (status < 0) {
+    __atomic_store_n(&training->failed, 1, __ATOMIC_RELAXED);
+  }
+  free(word.codes);
+}
+
+// Train the model of the order on the corpus. Return 0 on failure.
+int trainNgrams(const char *path, int order, NgramTable *model) {
+  InputScanner corpus;
+  NgramTraining training;
+  int numWorkers = workerCount();
+  long long words = 0;
+  size_t i;
+  int w;
+
+  if (!openCorpus(&corpus, path)) {
+    return 0;
+  }
+  training.corpus = &corpus;
+  training.order = order;
+  training.tables = calloc(numWorkers, sizeof(NgramTable));
+  training.words = calloc(numWorkers, sizeof(long long));
+  training.failed = 0;
+  runParallel(ngramTask, &training, numWorkers);
+
+  // Merge the tables into the first one
+  *model = training.tables[0];
+  words = training.words[0];
+  for (w = 1; w < numWorkers; w++) {
+    for (i = 0; i < training.tables[w].capacity; i++) {
+      if (training.tables[w].keys[i] != 0) {
+        ngramAdd(model, training.tables[w].keys[i], training.tables[w].counts[i]);
+      }
+    }
+    words += training.words[w];
+    ngramFree(&training.tables[w]);
+  }
+  fprintf(stderr, "Trained on %lld words: %zu n-grams and contexts\n",
+          words, model->size);
+
+  free(training.tables);
+  free(training.words);
+  scannerClose(&corpus);
+  if (training.failed) {
+    ngramFree(model);
+    return 0;
+  }
+  return 1;
+}
+
+// Model file: "CFNG", the version, the order and the number of entries (4
+// bytes each), then the key and count of every entry (8 bytes each), all
+// little-endian
+int saveNgrams(const char *path, const NgramTable *model, int order) {
+  FILE *file = fopen(path, "wb");
+  unsigned char header[16];
+  unsigned char entry[16];
+  int written = 1;
+  size_t i;
+
+  if (file == NULL) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    return 0;
+  }
+  memcpy(header, "CFNG", 4);
+  putLittleEndian(header + 4, NGRAM_MODEL_VERSION, 4);
+  putLittleEndian(header + 8, (unsigned int)order, 4);
+  putLittleEndian(header + 12, model->size, 4);
+  written = fwrite(header, sizeof(header), 1, file) == 1;
+  for (i = 0; i < model->capacity && written; i++) {
+    if (model->keys[i] != 0) {
+      putLittleEndian(entry, model->keys[i], 8);
+      putLittleEndian(entry + 8, model->counts[i], 8);
+      written = fwrite(entry, sizeof(entry), 1, file) == 1;
+    }
+  }
+  if (fclose(file) != 0 || !written) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+// Read a model written by saveNgrams. Return 0 (after reporting) if the
+// file is not a model of this version, its order is out of range or it is
+// cut short.
+int loadNgrams(const char *path, NgramTable *model, int *order) {
+  FILE *file = fopen(path, "rb");
+  unsigned char header[16];
+  unsigned char entry[16];
+  unsigned long long numEntries;
+  unsigned long long i;
+
+  if (file == NULL || fread(header, sizeof(header), 1, file) != 1 ||
+      memcmp(header, "CFNG", 4) != 0 ||
+      getLittleEndian(header + 4, 4) != NGRAM_MODEL_VERSION) {
+    fprintf(stderr, "Cannot read the model %s\n", path);
+    if (file != NULL) {
+      fclose(file);
+    }
+    return 0;
+  }
+  *order = (int)getLittleEndian(header + 8, 4);
+  if (*order < 1 || *order > MAX_NGRAM_ORDER) {
+    fprintf(stderr, "The order of the model %s is %d, not between 1 and %d\n",
+            path, *order, MAX_NGRAM_ORDER);
+    fclose(file);
+    return 0;
+  }
+  numEntries = getLittleEndian(header + 12, 4);
+  ngramInit(model, 1024);
+  for (i = 0; i < numEntries; i++) {
+    if (fread(entry, sizeof(entry), 1, file) != 1) {
+      fprintf(stderr, "The model %s is cut short\n", path);
+      ngramFree(model);
+      fclose(file);
+      return 0;
+    }
+    ngramAdd(model, getLittleEndian(entry, 8), getLittleEndian(entry + 8, 8));
+  }
+  fclose(file);
+  return 1;
+}
+
+typedef struct {
+  const NgramTable *model;
+  double logProbability;
+} NgramScore;
+
+void scoreNgram(unsigned long long context, unsigned long long gram, void *data) {
+  NgramScore *score = data;
+  score->logProbability +=
+      log2((ngramCount(score->model, gram) + 1.0) /
+           (ngramCount(score->model, context) + NGRAM_CLASSES));
+}
+
+void outputDouble(double value) {
+  char number[32];
+  snprintf(number, sizeof(number), "%.4f", value);
+  outputString(number);
+}
+
+// Score every word of the file, streamed in blocks
+int scoreWords(const char *path, const NgramTable *model, int order, int format) {
+  InputScanner words;
+  Word word = {NULL, 0, 0, 0};
+  NgramScore score;
+  int status;
+
+  if (!scannerOpen(&words, strcmp(path, "-") == 0 ? NULL : path)) {
+    return 1;
+  }
+  if (format == FORMAT_CSV) {
+    outputString("word,log2_probability,per_segment\n");
+  }
+  score.model = model;
+  while ((status = scanStreamWord(&words, &word)) > 0) {
+    score.logProbability = 0;
+    visitNgrams(&word, order, scoreNgram, &score);
+
+    if (format == FORMAT_BINARY) {
+      float value = (float)score.logProbability;
+      outputBytes((const char *)&value, sizeof(value));
+      continue;
+    }
+    outputString(format == FORMAT_JSONL ? "{\"word\":\"" : "");
+    outputSymbols(&word, 0, word.length, " ");
+    outputString(format == FORMAT_JSONL ? "\",\"log2Probability\":" :
+                 format == FORMAT_CSV ? "," : ": ");
+    outputDouble(score.logProbability);
+    outputString(format == FORMAT_JSONL ? ",\"perSegment\":" :
+                 format == FORMAT_CSV ? "," : " (");
+    outputDouble(score.logProbability / (word.length + 1));
+    outputString(format == FORMAT_JSONL ? "}\n" :
+                 format == FORMAT_CSV ? "\n" : " per segment)\n");
+  }
+  outputFlush();
+
+  free(word.codes);
+  scannerClose(&words);
+  return status < 0 ? 1 : 0;
+}
+
+// Train on the corpus (and save the model) and/or score the words with the
+// trained or loaded model. The order is 0 if not given: 3 for training, or
+// that of the loaded model, which must otherwise be the order given.
+int runNgrams(const char *corpusPath, int order, const char *modelPath,
+              const char *scorePath, int format) {
+  NgramTable model;
+  int modelOrder;
+  int status = 0;
+
+  if (corpusPath != NULL) {
+    order = order > 0 ? order : 3;
+    if (!trainNgrams(corpusPath, order, &model)) {
+      return 1;
+    }
+    if (modelPath != NULL && !saveNgrams(modelPath, &model, order)) {
+      status = 1;
+    }
+  }
+  else if (modelPath == NULL) {
+    fprintf(stderr, "--score needs --ngram <corpus> or --model <file>\n");
+    return 1;
+  }
+  else {
+    if (!loadNgrams(modelPath, &model, &modelOrder)) {
+      return 1;
+    }
+    if (order > 0 && order != modelOrder) {
+      fprintf(stderr, "The model %s has order %d, not %d (--ngram-order)\n",
+              modelPath, modelOrder, order);
+      ngramFree(&model);
+      return 1;
+    }
+    order = modelOrder;
+  }
+
+  if (scorePath != NULL && status == 0) {
+    status = scoreWords(scorePath, &model, order, format);
+  }
+  ngramFree(&model);
+  return status;
+}
+
+//===================================================================//
+//============================ Inventories ==========================//
+//===================================================================//
+// An inventory is a list of segments with the dimensions of the feature
+// table. It is either built in ("consonants", "vowels" or "all") or read
+// from a file with one segment per line:
+//  - "<symbol>" for a segment of the table (e.g. "p")
+//  - "<symbol> <place> <manner> <voicing>" for a consonant
+//  - "<symbol> <height> <backness> <tenseness> <roundedness> <diphthong>"
+//    for a vowel
+// A value is written as in the table, with '_' for a space, a sub value
+// after '/' (e.g. "Labial/Bilabial", "Diphthong/Major_Diphthong"), and
+// "-" for none. Lines starting with '#' are ignored.
+typedef struct {
+  Segment *segments;
+  unsigned char *kinds;   // 0 for consonants, 1 for vowels
+  int count;
+  int capacity;
+  int owned;              // Symbols were allocated by the inventory
+} Inventory;
+
+void inventoryAdd(Inventory *inventory, const Segment *segment, int kind) {
+  if (inventory->count == inventory->capacity) {
+    inventory->capacity = inventory->capacity > 0 ? 2 * inventory->capacity : 64;
+    inventory->segments = realloc(inventory->segments,
+                                  sizeof(Segment) * inventory->capacity);
+    inventory->kinds = realloc(inventory->kinds, inventory->capacity);
+  }
+  inventory->segments[inventory->count] = *segment;
+  inventory->kinds[inventory->count] = (unsigned char)kind;
+  inventory->count++;
+}
+
+void freeInventory(Inventory *inventory) {
+  int i;
+
+  if (inventory->owned) {
+    for (i = 0; i < inventory->count; i++) {
+      free((char *)inventory->segments[i].symbol);
+    }
+  }
+  free(inventory->segments);
+  free(inventory->kinds);
+  memset(inventory, 0, sizeof(*inventory));
+}
+
+// Parse "Value", "Value/Sub_Value" or "-". Return 0 if a value is unknown.
+int parseFeature(int dimension, const char token[], Segment *segment) {
+  char feature[64];
+  int i;
+
+  if (strcmp(token, "-") == 0) {
+    segment->value[dimension] = 0;
+    segment->subValue[dimension] = 0;
+    return 1;
+  }
+  snprintf(feature, sizeof(feature), "%s", token);
+  for (i = 0; feature[i] != '\0'; i++) {
+    if (feature[i] == '_') {
+      feature[i] = ' ';
+    }
+  }
+  setSegmentFeature(segment, dimension, feature);
+  return segment->value[dimension] != 0 &&
+         (strchr(feature, '/') == NULL || segment->subValue[dimension] != 0);
+}
+
+int loadInventoryFile(Inventory *inventory, const char *path) {
+  InputScanner file;
+  char line[512];
+  char *fields[NUM_DIMENSIONS + 1];
+  size_t position = 0;
+  int lineNumber = 0;
+
+  if (!openCorpus(&file, path)) {
+    return 0;
+  }
+  inventory->owned = 1;
+  while (position < file.length) {
+    size_t end = position;
+    int numFields = 0;
+    char *token;
+    Segment segment;
+    int kind;
+    int d;
+
+    while (end < file.length && file.data[end] != '\n') {
+      end++;
+    }
+    lineNumber++;
+    snprintf(line, sizeof(line), "%.*s", (int)(end - position),
+             file.data + position);
+    position = end + 1;
+
+    for (token = strtok(line, " \t\r,"); token != NULL && numFields <= NUM_DIMENSIONS;
+         token = strtok(NULL, " \t\r,")) {
+      fields[numFields++] = token;
+    }
+    if (numFields == 0 || fields[0][0] == '#') {
+      continue;
+    }
+
+    memset(&segment, 0, sizeof(segment));
+    if (numFields == 1) {
+      int entry = findSymbol(fields[0], strlen(fields[0]));
+      if (entry < 0) {
+        fprintf(stderr, "%s:%d: unknown segment %s\n", path, lineNumber, fields[0]);
+        scannerClose(&file);
+        return 0;
+      }
+      kind = segmentSymbols[entry].consonantVowel;
+      segment = segmentTable[kind][segmentSymbols[entry].number];
+    }
+    else if (numFields == 1 + numDimensions[0] ||
+             numFields == 1 + numDimensions[1]) {
+      kind = numFields == 1 + numDimensions[0] ? 0 : 1;
+      for (d = 0; d < numDimensions[kind]; d++) {
+        if (!parseFeature(firstDimension[kind] + d, fields[d + 1], &segment)) {
+          fprintf(stderr, "%s:%d: unknown %s %s\n", path, lineNumber,
+                  dimensionKeys[firstDimension[kind] + d], fields[d + 1]);
+          scannerClose(&file);
+          return 0;
+        }
+      }
+    }
+    else {
+      fprintf(stderr, "%s:%d: expected 1, %d or %d fields\n", path, lineNumber,
+              1 + numDimensions[0], 1 + numDimensions[1]);
+      scannerClose(&file);
+      return 0;
+    }
+    segment.symbol = strdup(fields[0]);
+    inventoryAdd(inventory, &segment, kind);
+  }
+
+  scannerClose(&file);
+  return 1;
+}
+
+// Load a built-in inventory or an inventory file. Return 0 on failure.
+int loadInventory(Inventory *inventory, const char *name) {
+  int kind;
+  int number;
+
+  memset(inventory, 0, sizeof(*inventory));
+  if (strcmp(name, "consonants") != 0 && strcmp(name, "vowels") != 0 &&
+      strcmp(name, "all") != 0) {
+    if (!loadInventoryFile(inventory, name)) {
+      freeInventory(inventory);
+      return 0;
+    }
+    return 1;
+  }
+
+  for (kind = 0; kind <= 1; kind++) {
+    if (strcmp(name, kind == 0 ? "vowels" : "consonants") == 0) {
+      continue;
+    }
+    for (number = 1; number <= segmentCount[kind]; number++) {
+      inventoryAdd(inventory, &segmentTable[kind][number], kind);
+    }
+  }
+  return 1;
+}
+
+// A binary feature "dimension = value" of the inventory. A segment has it
+// if it is its value or its sub value.
+typedef struct {
+  int dimension;
+  int value;
+} BinaryFeature;
+
+// Features that at least one segment of the inventory has, in the order of
+// the dimensions and values. Return the number of features.
+int inventoryFeatures(const Inventory *inventory, BinaryFeature features[],
+                      int maxFeatures) {
+  int numFeatures = 0;
+  int d;
+  int v;
+  int i;
+
+  for (d = 0; d < NUM_DIMENSIONS; d++) {
+    for (v = 1; v < MAX_VALUES && featureValues[d][v] != NULL; v++) {
+      for (i = 0; i < inventory->count; i++) {
+        if (inventory->segments[i].value[d] == v ||
+            inventory->segments[i].subValue[d] == v) {
+          break;
+        }
+      }
+      if (i < inventory->count && numFeatures < maxFeatures) {
+        features[numFeatures].dimension = d;
+        features[numFeatures].value = v;
+        numFeatures++;
+      }
+    }
+  }
+  return numFeatures;
+}
+
+int hasFeature(const Segment *segment, const BinaryFeature *feature) {
+  return segment->value[feature->dimension] == feature->value ||
+         segment->subValue[feature->dimension] == feature->value;
+}
+
+//===================================================================//
+//============================= Profiles ============================//
+//===================================================================//
+// A profile adapts the feature table to a dialect before any query is
+// answered. It has one rule per line ('#' for comments):
+//  - "split <symbol> <new symbol>" gives the new symbol its own segment,
+//    with the same features, numbered after the last one (e.g. "split e ej")
+//  - "merge <symbol> <other>" makes the symbol a name of the other segment
+//    and gives its number the same features (e.g. "merge ɔ ɑ")
+//  - "set <symbol> <dimension> <value>" changes one feature, written as in
+//    an inventory file (e.g. "set w place Labial/Bilabial")
+// The rules only rewrite the segment and symbol tables, so the queries
+// run the same code whatever the profile.
+typedef struct {
+  const char *name;
+  const char *rules;
+} Profile;
+
+const Profile builtinProfiles[] = {
+  {"standard", ""},
+  {"split", "split e ej\nset e diphthong Simple_Vowel\n"
+            "split o ow\nset o diphthong Simple_Vowel\n"
+            "split ɹ r\n"},
+  {"w-bilabial", "set w place Labial/Bilabial\n"},
+  {"cot-caught", "merge ɔ ɑ\n"},
+  {NULL, NULL}
+};
+
+// Entry of a symbol in a rule, reported if unknown
+int profileSymbol(const char symbol[], const char *source, int lineNumber) {
+  int entry = findSymbol(symbol, strlen(symbol));
+
+  if (entry < 0) {
+    fprintf(stderr, "%s:%d: unknown segment %s\n", source, lineNumber, symbol);
+  }
+  return entry;
+}
+
+int addSymbolEntry(const char symbol[], int consonantVowel, int number) {
+  if (numSymbols == MAX_SYMBOLS) {
+    return 0;
+  }
+  segmentSymbols[numSymbols].symbol = strdup(symbol);
+  segmentSymbols[numSymbols].consonantVowel = consonantVowel;
+  segmentSymbols[numSymbols].number = number;
+  numSymbols++;
+  buildSymbolIndex();
+  return 1;
+}
+
+// Whether a new symbol can be looked up (packed into MAX_SYMBOL_LENGTH
+// bytes) and written as is inside a JSON string
+int validSymbol(const char symbol[]) {
+  size_t i;
+
+  for (i = 0; symbol[i] != '\0'; i++) {
+    unsigned char c = (unsigned char)symbol[i];
+    if (c < 0x20 || c == 0x7F || c == '"' || c == '\\') {
+      return 0;
+    }
+  }
+  return i > 0 && i <= MAX_SYMBOL_LENGTH;
+}
+
+int splitSegment(char *fields[], const char *source, int lineNumber) {
+  int entry = profileSymbol(fields[1], source, lineNumber);
+  int other = findSymbol(fields[2], strlen(fields[2]));
+  int kind;
+  int number;
+  int newNumber;
+
+  if (entry < 0) {
+    return 0;
+  }
+  if (!validSymbol(fields[2])) {
+    fprintf(stderr, "%s:%d: a symbol has at most %d bytes, without quotes, "
+            "backslashes or control characters\n", source, lineNumber, MAX_SYMBOL_LENGTH);
+    return 0;
+  }
+  kind = segmentSymbols[entry].consonantVowel;
+  number = segmentSymbols[entry].number;
+  if (other >= 0 && (segmentSymbols[other].consonantVowel != kind ||
+                     segmentSymbols[other].number != number)) {
+    fprintf(stderr, "%s:%d: %s is already another segment\n", source,
+            lineNumber, fields[2]);
+    return 0;
+  }
+  if (segmentCount[kind] == MAX_SEGMENT_NUMBER) {
+    fprintf(stderr, "%s:%d: too many segments\n", source, lineNumber);
+    return 0;
+  }
+
+  newNumber = ++segmentCount[kind];
+  segmentTable[kind][newNumber] = segmentTable[kind][number];
+  segmentTable[kind][newNumber].symbol = strdup(fields[2]);
+  segmentTable[kind][number].symbol = strdup(fields[1]);
+  if (other >= 0) {
+    segmentSymbols[other].number = newNumber;
+    return 1;
+  }
+  if (!addSymbolEntry(fields[2], kind, newNumber)) {
+    fprintf(stderr, "%s:%d: too many symbols\n", source, lineNumber);
+    return 0;
+  }
+  return 1;
+}
+
+int mergeSegment(char *fields[], const char *source, int lineNumber) {
+  int entry = profileSymbol(fields[1], source, lineNumber);
+  int other = profileSymbol(fields[2], source, lineNumber);
+  const char *symbol;
+  int kind;
+  int number;
+  int i;
+
+  if (entry < 0 || other < 0) {
+    return 0;
+  }
+  kind = segmentSymbols[other].consonantVowel;
+  if (segmentSymbols[entry].consonantVowel != kind) {
+    fprintf(stderr, "%s:%d: cannot merge a consonant and a vowel\n", source,
+            lineNumber);
+    return 0;
+  }
+
+  number = segmentSymbols[entry].number;
+  symbol = segmentTable[kind][number].symbol;
+  segmentTable[kind][number] = segmentTable[kind][segmentSymbols[other].number];
+  segmentTable[kind][number].symbol = symbol;
+  for (i = 0; i < numSymbols; i++) {
+    if (segmentSymbols[i].consonantVowel == kind &&
+        segmentSymbols[i].number == number) {
+      segmentSymbols[i].number = segmentSymbols[other].number;
+    }
+  }
+  return 1;
+}
+
+int setFeature(char *fields[], const char *source, int lineNumber) {
+  int entry = profileSymbol(fields[1], source, lineNumber);
+  Segment *segment;
+  int kind;
+  int d;
+
+  if (entry < 0) {
+    return 0;
+  }
+  kind = segmentSymbols[entry].consonantVowel;
+  segment = &segmentTable[kind][segmentSymbols[entry].number];
+  for (d = 0; d < NUM_DIMENSIONS && strcmp(fields[2], dimensionKeys[d]) != 0; d++) {
+  }
+  if (d < firstDimension[kind] || d >= firstDimension[kind] + numDimensions[kind]) {
+    fprintf(stderr, "%s:%d: %s is not a dimension of %s\n", source, lineNumber,
+            fields[2], fields[1]);
+    return 0;
+  }
+  if (!parseFeature(d, fields[3], segment)) {
+    fprintf(stderr, "%s:%d: unknown %s %s\n", source, lineNumber,
+            dimensionKeys[d], fields[3]);
+    return 0;
+  }
+  return 1;
+}
+
+// Apply the rules of a text. Return 0 at the first invalid rule.
+int applyProfileRules(const char *text, size_t length, const char *source) {
+  char line[512];
+  char *fields[5];
+  size_t position = 0;
+  int lineNumber = 0;
+  int status = 1;
+
+  while (position < length && status) {
+    size_t end = position;
+    int numFields = 0;
+    char *token;
+
+    while (end < length && text[end] != '\n') {
+      end++;
+    }
+    lineNumber++;
+    snprintf(line, sizeof(line), "%.*s", (int)(end - position), text + position);
+    position = end + 1;
+
+    for (token = strtok(line, " \t\r"); token != NULL && numFields < 5;
+         token = strtok(NULL, " \t\r")) {
+      fields[numFields++] = token;
+    }
+    if (numFields == 0 || fields[0][0] == '#') {
+      continue;
+    }
+
+    if (strcmp(fields[0], "split") == 0 && numFields == 3) {
+      status = splitSegment(fields, source, lineNumber);
+    }
+    else if (strcmp(fields[0], "merge") == 0 && numFields == 3) {
+      status = mergeSegment(fields, source, lineNumber);
+    }
+    else if (strcmp(fields[0], "set") == 0 && numFields == 4) {
+      status = setFeature(fields, source, lineNumber);
+    }
+    else {
+      fprintf(stderr, "%s:%d: expected \"split <symbol> <symbol>\", "
+              "\"merge <symbol> <symbol>\" or \"set <symbol> <dimension> <value>\"\n",
+              source, lineNumber);
+      status = 0;
+    }
+  }
+  return status;
+}
+
+// Apply a built-in profile or a profile file. Return 0 on failure.
+int applyProfile(const char *name) {
+  InputScanner file;
+  int status;
+  int i;
+
+  for (i = 0; builtinProfiles[i].name != NULL; i++) {
+    if (strcmp(name, builtinProfiles[i].name) == 0) {
+      return applyProfileRules(builtinProfiles[i].rules,
+                               strlen(builtinProfiles[i].rules), name);
+    }
+  }
+
+  if (!openCorpus(&file, name)) {
+    return 0;
+  }
+  status = applyProfileRules(file.data, file.length, name);
+  scannerClose(&file);
+  return status;
+}
+
+//===================================================================//
+//========================== Feature Economy ========================//
+//===================================================================//
+// Smallest set of binary features ("dimension = value") that gives every
+// segment of the inventory a different feature vector.
+// A partition of the inventory is kept as the bitsets of its classes with
+// more than one segment; a feature splits each class in two, and the search
+// succeeds when no class is left. Iterative deepening on the number of
+// features finds the smallest set first. A class of n segments needs at
+// least log2(n) more features, and classes that no feature splits together
+// need them separately, which bounds the branches. The branches of the first
+// feature are shared between the workers.
+#define MAX_FEATURES 64
+#define MAX_SEGMENTS_PER_SEARCH 4096
+
+typedef unsigned long long Bitset;
+
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
+
+typedef struct {
+  int numSegments;
+  int words;
+  int numFeatures;
+  BinaryFeature features[MAX_FEATURES];
+  Bitset *featureSets;   // Segments having each feature, numFeatures x words
+  int target;            // Number of features searched for
+  int nextFirst;         // Next first feature to give to a worker
+  int found;
+  int solution[MAX_FEATURES];
+  long long nodes;
+  pthread_mutex_t lock;
+} Economy;
+
+typedef struct {
+  Bitset *classes;       // numClasses x words
+  int numClasses;
+} Partition;
+
+int bitsetCount(const Bitset *bitset, int words) {
+  int count = 0;
+  int w;
+
+  for (w = 0; w < words; w++) {
+    count += __builtin_popcountll(bitset[w]);
+  }
+  return count;
+}
+
+// Refine the partition with the feature. Classes of one segment are
+// dropped. Return the size of the largest class left, or -1 if the feature
+// does not split any class.
+int refinePartition(const Economy *economy, const Partition *partition,
+                    const Bitset *featureSet, Partition *refined) {
+  int words = economy->words;
+  int largest = 0;
+  int splits = 0;
+  int c;
+  int w;
+  int half;
+
+  refined->numClasses = 0;
+  for (c = 0; c < partition->numClasses; c++) {
+    const Bitset *class = partition->classes + (size_t)c * words;
+    int empty = 0;
+    for (half = 0; half <= 1; half++) {
+      Bitset *part = refined->classes + (size_t)refined->numClasses * words;
+      int size;
+      for (w = 0; w < words; w++) {
+        part[w] = class[w] & (half ? featureSet[w] : ~featureSet[w]);
+      }
+      size = bitsetCount(part, words);
+      empty |= (size == 0);
+      if (size > 1) {
+        refined->numClasses++;
+        if (size > largest) {
+          largest = size;
+        }
+      }
+    }
+    splits += !empty;
+  }
+  return splits == 0 ? -1 : largest;
+}
+
+// Smallest number of features that can split a class of the size
+int featuresNeeded(int size) {
+  int needed = 0;
+
+  while ((1 << needed) < size) {
+    needed++;
+  }
+  return needed;
+}
+
+// Features (bit f for feature f) that split the class, leaving out the
+// excluded ones
+Bitset classSplitters(const Economy *economy, const Bitset *class,
+                      Bitset excluded) {
+  Bitset splitters = 0;
+  int f;
+  int w;
+
+  for (f = 0; f < economy->numFeatures; f++) {
+    const Bitset *featureSet = economy->featureSets + (size_t)f * economy->words;
+    int inside = 0;
+    int outside = 0;
+    if ((excluded >> f) & 1) {
+      continue;
+    }
+    for (w = 0; w < economy->words; w++) {
+      inside |= (class[w] & featureSet[w]) != 0;
+      outside |= (class[w] & ~featureSet[w]) != 0;
+    }
+    if (inside && outside) {
+      splitters |= 1ULL << f;
+    }
+  }
+  return splitters;
+}
+
+// Splitters and needs of every class of a partition, allocated once per
+// worker for economyBound at every depth of its search
+typedef struct {
+  Bitset *splitters;
+  int *needs;
+} BoundScratch;
+
+// Lower bound on the number of features still needed: classes that no
+// feature splits together need their features separately. Also choose the
+// class to branch on, the one with the fewest features splitting it.
+// Return -1 if a class cannot be split anymore.
+int economyBound(const Economy *economy, const Partition *partition,
+                 Bitset excluded, Bitset *branchSplitters, BoundScratch *scratch) {
+  Bitset *splitters = scratch->splitters;
+  int *needs = scratch->needs;
+  Bitset used = 0;
+  int bound = 0;
+  int fewest = MAX_FEATURES + 1;
+  int c;
+
+  for (c = 0; c < partition->numClasses; c++) {
+    const Bitset *class = partition->classes + (size_t)c * economy->words;
+    int count;
+    splitters[c] = classSplitters(economy, class, excluded);
+    count = __builtin_popcountll(splitters[c]);
+    if (count == 0) {
+      return -1;
+    }
+    needs[c] = featuresNeeded(bitsetCount(class, economy->words));
+    if (count < fewest) {
+      fewest = count;
+      *branchSplitters = splitters[c];
+    }
+  }
+
+  // Greedily take the classes with the largest needs whose features do
+  // not overlap
+  while (1) {
+    int best = -1;
+    for (c = 0; c < partition->numClasses; c++) {
+      if (needs[c] > 0 && (splitters[c] & used) == 0 &&
+          (best < 0 || needs[c] > needs[best])) {
+        best = c;
+      }
+    }
+    if (best < 0) {
+      break;
+    }
+    bound += needs[best];
+    used |= splitters[best];
+    needs[best] = 0;
+  }
+  return bound;
+}
+
+// Complete the chosen features. Some feature must split the class with the
+// fewest choices; each of them is tried, and the ones already tried are
+// excluded from the later branches so that no set is searched twice.
+int economySearch(Economy *economy, Partition partitions[], int depth,
+                  Bitset excluded, int chosen[], BoundScratch *scratch) {
+  Bitset splitters = 0;
+  int bound;
+  int f;
+
+  if (partitions[depth].numClasses == 0) {
+    return 1;
+  }
+  bound = economyBound(economy, &partitions[depth], excluded, &splitters, scratch);
+  if (bound < 0 || depth + bound > economy->target) {
+    return 0;
+  }
+  for (f = 0; f < economy->numFeatures; f++) {
+    if (!((splitters >> f) & 1)) {
+      continue;
+    }
+    if (__atomic_load_n(&economy->found, __ATOMIC_RELAXED)) {
+      return 0;
+    }
+    __atomic_fetch_add(&economy->nodes, 1, __ATOMIC_RELAXED);
+    refinePartition(economy, &partitions[depth],
+                    economy->featureSets + (size_t)f * economy->words,
+                    &partitions[depth + 1]);
+    chosen[depth] = f;
+    if (economySearch(economy, partitions, depth + 1, excluded, chosen, scratch)) {
+      return 1;
+    }
+    excluded |= 1ULL << f;
+  }
+  return 0;
+}
+
+// The branches of the first feature are handed out one at a time
+void economyTask(int worker, int numWorkers, void *context) {
+  Economy *economy = context;
+  Partition partitions[MAX_FEATURES + 1];
+  int chosen[MAX_FEATURES];
+  int words = economy->words;
+  int maxClasses = economy->numSegments / 2 + 1;
+  BoundScratch scratch;
+  int depth;
+  int first;
+  int w;
+
+  (void)worker;
+  (void)numWorkers;
+  scratch.splitters = malloc(sizeof(Bitset) * maxClasses);
+  scratch.needs = malloc(sizeof(int) * maxClasses);
+  for (depth = 0; depth <= economy->target; depth++) {
+    partitions[depth].classes = malloc(sizeof(Bitset) * words *
+                                       (economy->numSegments / 2 + 1));
+  }
+  // The whole inventory is the first class
+  partitions[0].numClasses = 1;
+  for (w = 0; w < words; w++) {
+    partitions[0].classes[w] = ~0ULL;
+  }
+  if (economy->numSegments % 64 != 0) {
+    partitions[0].classes[words - 1] = (1ULL << (economy->numSegments % 64)) - 1;
+  }
+
+  while (!__atomic_load_n(&economy->found, __ATOMIC_RELAXED) &&
+         (first = __atomic_fetch_add(&economy->nextFirst, 1, __ATOMIC_RELAXED)) <
+         economy->numFeatures) {
+    if (refinePartition(economy, &partitions[0],
+                        economy->featureSets + (size_t)first * words,
+                        &partitions[1]) < 0) {
+      continue;
+    }
+    chosen[0] = first;
+    // Features before the first one belong to the other branches
+    if (economySearch(economy, partitions, 1, (1ULL << first) - 1, chosen, &scratch)) {
+      pthread_mutex_lock(&economy->lock);
+      if (!economy->found) {
+        __atomic_store_n(&economy->found, 1, __ATOMIC_RELAXED);
+        memcpy(economy->solution, chosen, sizeof(int) * economy->target);
+      }
+      pthread_mutex_unlock(&economy->lock);
+    }
+  }
+
+  for (depth = 0; depth <= economy->target; depth++) {
+    free(partitions[depth].classes);
+  }
+  free(scratch.splitters);
+  free(scratch.needs);
+}
+
+// Smallest set of whole dimensions (value and sub value) that tells every
+// segment apart, as a bit mask of dimensions, or -1 if there is none
+int smallestDimensions(const Inventory *inventory) {
+  int best = -1;
+  int mask;
+  int i;
+  int j;
+
+  for (mask = 0; mask < (1 << NUM_DIMENSIONS); mask++) {
+    int distinct = 1;
+    if (best >= 0 && __builtin_popcount(mask) >= __builtin_popcount(best)) {
+      continue;
+    }
+    for (i = 0; i < inventory->count && distinct; i++) {
+      for (j = i + 1; j < inventory->count && distinct; j++) {
+        int d;
+        int same = 1;
+        for (d = 0; d < NUM_DIMENSIONS && same; d++) {
+          if ((mask >> d) & 1) {
+            same = inventory->segments[i].value[d] == inventory->segments[j].value[d] &&
+                   inventory->segments[i].subValue[d] == inventory->segments[j].subValue[d];
+          }
+        }
+        distinct = !same;
+      }
+    }
+    if (distinct) {
+      best = mask;
+    }
+  }
+  return best;
+}
+
+// Segments with the same features cannot be told apart by any set of
+// features, so they are kept only once (and reported in text output)
+void mergeIdenticalSegments(Inventory *inventory, const BinaryFeature features[],
+                            int numFeatures, int format) {
+  Bitset *vectors = malloc(sizeof(Bitset) * (inventory->count + 1));
+  int kept = 0;
+  int i;
+  int j;
+  int f;
+
+  for (i = 0; i < inventory->count; i++) {
+    vectors[i] = 0;
+    for (f = 0; f < numFeatures; f++) {
+      if (hasFeature(&inventory->segments[i], &features[f])) {
+        vectors[i] |= 1ULL << f;
+      }
+    }
+    for (j = 0; j < kept && vectors[j] != vectors[i]; j++) {
+    }
+    if (j < kept) {
+      if (format == FORMAT_TEXT) {
+        outputString("Same features: ");
+        outputString(inventory->segments[j].symbol);
+        outputString(" ");
+        outputString(inventory->segments[i].symbol);
+        outputString("\n");
+      }
+      if (inventory->owned) {
+        free((char *)inventory->segments[i].symbol);
+      }
+      continue;
+    }
+    vectors[kept] = vectors[i];
+    inventory->segments[kept] = inventory->segments[i];
+    inventory->kinds[kept] = inventory->kinds[i];
+    kept++;
+  }
+  inventory->count = kept;
+  free(vectors);
+}
+
+int runEconomy(const char *inventoryName, int format) {
+  Inventory inventory;
+  Economy economy;
+  int dimensions;
+  int numWorkers = workerCount();
+  int f;
+  int i;
+  int d;
+
+  if (!loadInventory(&inventory, inventoryName)) {
+    return 1;
+  }
+
+  memset(&economy, 0, sizeof(economy));
+  pthread_mutex_init(&economy.lock, NULL);
+  economy.numFeatures = inventoryFeatures(&inventory, economy.features,
+                                          MAX_FEATURES);
+  mergeIdenticalSegments(&inventory, economy.features, economy.numFeatures,
+                         format);
+  if (inventory.count > 2 * MAX_SEGMENTS_PER_SEARCH) {
+    fprintf(stderr, "At most %d different segments are supported\n",
+            2 * MAX_SEGMENTS_PER_SEARCH);
+    freeInventory(&inventory);
+    return 1;
+  }
+  dimensions = smallestDimensions(&inventory);
+  economy.numSegments = inventory.count;
+  economy.words = BITSET_WORDS(inventory.count);
+  economy.featureSets = calloc((size_t)economy.numFeatures * economy.words,
+                               sizeof(Bitset));
+  for (f = 0; f < economy.numFeatures; f++) {
+    for (i = 0; i < inventory.count; i++) {
+      if (hasFeature(&inventory.segments[i], &economy.features[f])) {
+        economy.featureSets[(size_t)f * economy.words + i / 64] |= 1ULL << (i % 64);
+      }
+    }
+  }
+
+  for (economy.target = featuresNeeded(inventory.count);
+       economy.target <= economy.numFeatures && !economy.found;
+       economy.target++) {
+    economy.nextFirst = 0;
+    if (inventory.count <= 1) {
+      economy.found = 1;
+      break;
+    }
+    runParallel(economyTask, &economy, numWorkers);
+  }
+  if (economy.found && inventory.count > 1) {
+    economy.target--;
+  }
+  // In the order of the dimensions and values
+  for (i = 1; i < economy.target; i++) {
+    for (f = i; f > 0 && economy.solution[f - 1] > economy.solution[f]; f--) {
+      int swap = economy.solution[f];
+      economy.solution[f] = economy.solution[f - 1];
+      economy.solution[f - 1] = swap;
+    }
+  }
+
+  if (format == FORMAT_JSONL) {
+    outputString("{\"segments\":");
+    outputInt(inventory.count);
+    outputString(",\"dimensions\":[");
+  }
+  else if (format == FORMAT_CSV) {
+    outputString("kind,dimension,value\n");
+  }
+  else {
+    outputInt(inventory.count);
+    outputString(" segments\nSmallest set of dimensions:");
+  }
+  for (d = 0, i = 0; d < NUM_DIMENSIONS; d++) {
+    if ((dimensions >> d) & 1) {
+      if (format == FORMAT_JSONL) {
+        outputString(i++ > 0 ? ",\"" : "\"");
+        outputString(dimensionKeys[d]);
+        outputString("\"");
+      }
+      else if (format == FORMAT_CSV) {
+        outputString("dimension,");
+        outputString(dimensionKeys[d]);
+        outputString(",\n");
+      }
+      else {
+        outputString(" ");
+        outputString(dimensionKeys[d]);
+      }
+    }
+  }
+
+  if (format == FORMAT_JSONL) {
+    outputString("],\"features\":[");
+  }
+  else if (format == FORMAT_TEXT) {
+    outputString("\nSmallest set of features (");
+    outputInt(economy.found ? economy.target : -1);
+    outputString("):");
+  }
+  for (i = 0; economy.found && i < economy.target; i++) {
+    const BinaryFeature *feature = &economy.features[economy.solution[i]];
+    if (format == FORMAT_JSONL) {
+      outputString(i > 0 ? ",{\"" : "{\"");
+      outputString(dimensionKeys[feature->dimension]);
+      outputString("\":\"");
+      outputString(featureValues[feature->dimension][feature->value]);
+      outputString("\"}");
+    }
+    else if (format == FORMAT_CSV) {
+      outputString("feature,");
+      outputString(dimensionKeys[feature->dimension]);
+      outputString(",");
+      outputString(featureValues[feature->dimension][feature->value]);
+      outputString("\n");
+    }
+    else {
+      outputString(i > 0 ? ", " : " ");
+      outputString(dimensionKeys[feature->dimension]);
+      outputString("=");
+      outputString(featureValues[feature->dimension][feature->value]);
+    }
+  }
+  if (format == FORMAT_JSONL) {
+    outputString("]}\n");
+  }
+  else if (format == FORMAT_TEXT) {
+    outputString("\n");
+  }
+  outputFlush();
+
+  pthread_mutex_destroy(&economy.lock);
+  free(economy.featureSets);
+  freeInventory(&inventory);
+  return 0;
+}
+
+//===================================================================//
+//======================= Contrastive Hierarchy =====================//
+//===================================================================//
+// Successive Division Algorithm: the inventory starts as one class, and
+// each dimension of the ordering in turn divides every class whose segments
+// have different values in it; those segments are contrastively specified
+// for the dimension. A value and its sub value count as one value here
+// (e.g. Labial/Bilabial and Labial/Velar are different places).
+// The partition after a set of dimensions does not depend on their order,
+// so the partition of every subset and the segments each dimension
+// specifies in it are computed once, and every ordering is then evaluated
+// from them in parallel.
+typedef struct {
+  const Inventory *inventory;
+  int numDimensions;            // Dimensions of the orderings
+  int dimensions[NUM_DIMENSIONS];
+  int words;
+  int *classes[1 << NUM_DIMENSIONS];   // Class of every segment after a subset
+  int numClasses[1 << NUM_DIMENSIONS];
+  // Segments the i-th dimension specifies after a subset, as bitsets
+  Bitset *specified[1 << NUM_DIMENSIONS][NUM_DIMENSIONS];
+} Hierarchy;
+
+// Ranking of one ordering
+typedef struct {
+  int ordering;                 // Index of the permutation
+  int depth;                    // Most features specified for a segment
+  int specifications;           // Features specified for all segments
+  int redundant;                // Dimensions of the ordering dividing nothing
+} OrderingScore;
+
+typedef struct {
+  Hierarchy *hierarchy;
+  OrderingScore *scores;
+  long long numOrderings;
+} HierarchyRanking;
+
+int contrastKey(const Segment *segment, int dimension) {
+  return segment->value[dimension] * MAX_VALUES + segment->subValue[dimension];
+}
+
+// Partitions and specified segments of every subset of the dimensions, each
+// subset refined from the one without its highest dimension
+void buildHierarchy(Hierarchy *hierarchy) {
+  const Inventory *inventory = hierarchy->inventory;
+  int n = inventory->count;
+  int numSubsets = 1 << hierarchy->numDimensions;
+  int *map = malloc(sizeof(int) * (size_t)(n + 1) * MAX_VALUES * MAX_VALUES);
+  int *firstKey = malloc(sizeof(int) * (n + 1));
+  char *divided = malloc(n + 1);
+  int subset;
+  int i;
+
+  hierarchy->words = BITSET_WORDS(n);
+  for (subset = 0; subset < numSubsets; subset++) {
+    int *classes = malloc(sizeof(int) * (n + 1));
+    int numClasses = 0;
+    int d;
+
+    if (subset == 0) {
+      for (i = 0; i < n; i++) {
+        classes[i] = 0;
+      }
+      numClasses = n > 0 ? 1 : 0;
+    }
+    else {
+      int high = 31 - __builtin_clz(subset);
+      int parent = subset & ~(1 << high);
+      int dimension = hierarchy->dimensions[high];
+      int keys = MAX_VALUES * MAX_VALUES;
+      for (i = 0; i < hierarchy->numClasses[parent] * keys; i++) {
+        map[i] = -1;
+      }
+      for (i = 0; i < n; i++) {
+        int slot = hierarchy->classes[parent][i] * keys +
+                   contrastKey(&inventory->segments[i], dimension);
+        if (map[slot] < 0) {
+          map[slot] = numClasses++;
+        }
+        classes[i] = map[slot];
+      }
+    }
+    hierarchy->classes[subset] = classes;
+    hierarchy->numClasses[subset] = numClasses;
+
+    // Segments of the classes that each other dimension divides
+    for (d = 0; d < hierarchy->numDimensions; d++) {
+      int dimension = hierarchy->dimensions[d];
+      Bitset *specified;
+      if ((subset >> d) & 1) {
+        hierarchy->specified[subset][d] = NULL;
+        continue;
+      }
+      specified = calloc(hierarchy->words, sizeof(Bitset));
+      for (i = 0; i < numClasses; i++) {
+        firstKey[i] = -1;
+        divided[i] = 0;
+      }
+      for (i = 0; i < n; i++) {
+        int key = contrastKey(&inventory->segments[i], dimension);
+        if (firstKey[classes[i]] < 0) {
+          firstKey[classes[i]] = key;
+        }
+        else if (firstKey[classes[i]] != key) {
+          divided[classes[i]] = 1;
+        }
+      }
+      for (i = 0; i < n; i++) {
+        if (divided[classes[i]]) {
+          specified[i / 64] |= 1ULL << (i % 64);
+        }
+      }
+      hierarchy->specified[subset][d] = specified;
+    }
+  }
+
+  free(map);
+  free(firstKey);
+  free(divided);
+}
+
+void freeHierarchy(Hierarchy *hierarchy) {
+  int subset;
+  int d;
+
+  for (subset = 0; subset < (1 << hierarchy->numDimensions); subset++) {
+    free(hierarchy->classes[subset]);
+    for (d = 0; d < hierarchy->numDimensions; d++) {
+      free(hierarchy->specified[subset][d]);
+    }
+  }
+}
+
+// The permutation of the dimensions with the index (factorial number system)
+void orderingPermutation(long long index, int numDimensions, int order[]) {
+  int remaining[NUM_DIMENSIONS];
+  int i;
+  int j;
+
+  for (i = 0; i < numDimensions; i++) {
+    remaining[i] = i;
+  }
+  for (i = 0; i < numDimensions; i++) {
+    long long factorial = 1;
+    int pick;
+    for (j = 2; j < numDimensions - i; j++) {
+      factorial *= j;
+    }
+    pick = (int)(index / factorial);
+    index %= factorial;
+    order[i] = remaining[pick];
+    for (j = pick; j < numDimensions - i - 1; j++) {
+      remaining[j] = remaining[j + 1];
+    }
+  }
+}
+
+void scoreOrdering(const Hierarchy *hierarchy, const int order[],
+                   int counts[], OrderingScore *score) {
+  int n = hierarchy->inventory->count;
+  int subset = 0;
+  int step;
+  int i;
+
+  memset(counts, 0, sizeof(int) * n);
+  score->depth = 0;
+  score->specifications = 0;
+  score->redundant = 0;
+  for (step = 0; step < hierarchy->numDimensions; step++) {
+    const Bitset *specified = hierarchy->specified[subset][order[step]];
+    int count = bitsetCount(specified, hierarchy->words);
+    score->specifications += count;
+    score->redundant += (count == 0);
+    for (i = 0; count > 0 && i < n; i++) {
+      if ((specified[i / 64] >> (i % 64)) & 1) {
+        counts[i]++;
+      }
+    }
+    subset |= 1 << order[step];
+  }
+  for (i = 0; i < n; i++) {
+    if (counts[i] > score->depth) {
+      score->depth = counts[i];
+    }
+  }
+}
+
+void hierarchyTask(int worker, int numWorkers, void *context) {
+  HierarchyRanking *ranking = context;
+  int *counts = malloc(sizeof(int) * (ranking->hierarchy->inventory->count + 1));
+  int order[NUM_DIMENSIONS];
+  long long begin;
+  long long end;
+  long long o;
+
+  workerRange(ranking->numOrderings, worker, numWorkers, &begin, &end);
+  for (o = begin; o < end; o++) {
+    orderingPermutation(o, ranking->hierarchy->numDimensions, order);
+    scoreOrdering(ranking->hierarchy, order, counts, &ranking->scores[o]);
+    ranking->scores[o].ordering = (int)o;
+  }
+  free(counts);
+}
+
+int compareScores(const void *a, const void *b) {
+  const OrderingScore *first = a;
+  const OrderingScore *second = b;
+
+  if (first->depth != second->depth) {
+    return first->depth - second->depth;
+  }
+  if (first->specifications != second->specifications) {
+    return first->specifications - second->specifications;
+  }
+  if (first->redundant != second->redundant) {
+    return first->redundant - second->redundant;
+  }
+  return first->ordering - second->ordering;
+}
+
+void outputContrastValue(const Segment *segment, int dimension) {
+  if (segment->value[dimension] == 0) {
+    outputString("-");
+    return ;
+  }
+  outputString(featureValues[dimension][segment->value[dimension]]);
+  if (segment->subValue[dimension] != 0) {
+    outputString("/");
+    outputString(featureValues[dimension][segment->subValue[dimension]]);
+  }
+}
+
+void outputOrdering(const Hierarchy *hierarchy, const int order[],
+                    const char separator[]) {
+  int i;
+
+  for (i = 0; i < hierarchy->numDimensions; i++) {
+    if (i > 0) {
+      outputString(separator);
+    }
+    outputString(dimensionKeys[hierarchy->dimensions[order[i]]]);
+  }
+}
+
+// Contrastive specification of every segment for one ordering
+void outputSpecification(const Hierarchy *hierarchy, const int order[],
+                         int format) {
+  const Inventory *inventory = hierarchy->inventory;
+  int i;
+  int step;
+
+  if (format == FORMAT_CSV) {
+    outputString("segment,dimension,value\n");
+  }
+  for (i = 0; i < inventory->count; i++) {
+    int subset = 0;
+    int specified = 0;
+    if (format == FORMAT_JSONL) {
+      outputString("{\"segment\":\"");
+      outputString(inventory->segments[i].symbol);
+      outputString("\",\"features\":{");
+    }
+    else if (format == FORMAT_TEXT) {
+      outputString(inventory->segments[i].symbol);
+      outputString(":");
+    }
+    for (step = 0; step < hierarchy->numDimensions; step++) {
+      int dimension = hierarchy->dimensions[order[step]];
+      const Bitset *bits = hierarchy->specified[subset][order[step]];
+      subset |= 1 << order[step];
+      if (!((bits[i / 64] >> (i % 64)) & 1)) {
+        continue;
+      }
+      if (format == FORMAT_JSONL) {
+        outputString(specified > 0 ? ",\"" : "\"");
+        outputString(dimensionKeys[dimension]);
+        outputString("\":\"");
+        outputContrastValue(&inventory->segments[i], dimension);
+        outputString("\"");
+      }
+      else if (format == FORMAT_CSV) {
+        outputString(inventory->segments[i].symbol);
+        outputString(",");
+        outputString(dimensionKeys[dimension]);
+        outputString(",");
+        outputContrastValue(&inventory->segments[i], dimension);
+        outputString("\n");
+      }
+      else {
+        outputString(specified > 0 ? ", " : " ");
+        outputString(dimensionKeys[dimension]);
+        outputString("=");
+        outputContrastValue(&inventory->segments[i], dimension);
+      }
+      specified++;
+    }
+    if (format == FORMAT_JSONL) {
+      outputString("}}\n");
+    }
+    else if (format == FORMAT_TEXT) {
+      outputString("\n");
+    }
+  }
+}
+
+// With an ordering ("place,manner,voicing"), print the contrastive
+// specification of every segment. Without ("all"), rank every ordering of
+// the dimensions the inventory uses.
+int runHierarchy(const char *inventoryName, const char *ordering, int format) {
+  Inventory inventory;
+  Hierarchy hierarchy;
+  int order[NUM_DIMENSIONS];
+  int d;
+  int i;
+
+  if (!loadInventory(&inventory, inventoryName)) {
+    return 1;
+  }
+  memset(&hierarchy, 0, sizeof(hierarchy));
+  hierarchy.inventory = &inventory;
+
+  if (strcmp(ordering, "all") == 0) {
+    for (d = 0; d < NUM_DIMENSIONS; d++) {
+      for (i = 0; i < inventory.count && inventory.segments[i].value[d] == 0; i++) {
+      }
+      if (i < inventory.count) {
+        hierarchy.dimensions[hierarchy.numDimensions++] = d;
+      }
+    }
+  }
+  else {
+    char names[128];
+    char *name;
+    snprintf(names, sizeof(names), "%s", ordering);
+    for (name = strtok(names, ","); name != NULL; name = strtok(NULL, ",")) {
+      for (d = 0; d < NUM_DIMENSIONS && strcmp(name, dimensionKeys[d]) != 0; d++) {
+      }
+      for (i = 0; i < hierarchy.numDimensions && hierarchy.dimensions[i] != d; i++) {
+      }
+      if (d == NUM_DIMENSIONS || i < hierarchy.numDimensions) {
+        fprintf(stderr, "Unknown or repeated dimension: %s\n", name);
+        freeInventory(&inventory);
+        return 1;
+      }
+      order[hierarchy.numDimensions] = hierarchy.numDimensions;
+      hierarchy.dimensions[hierarchy.numDimensions++] = d;
+    }
+  }
+  buildHierarchy(&hierarchy);
+
+  if (strcmp(ordering, "all") != 0) {
+    outputSpecification(&hierarchy, order, format);
+  }
+  else {
+    HierarchyRanking ranking;
+    long long o;
+
+    ranking.hierarchy = &hierarchy;
+    ranking.numOrderings = 1;
+    for (d = 2; d <= hierarchy.numDimensions; d++) {
+      ranking.numOrderings *= d;
+    }
+    ranking.scores = malloc(sizeof(OrderingScore) * ranking.numOrderings);
+    runParallel(hierarchyTask, &ranking, workerCount());
+    qsort(ranking.scores, ranking.numOrderings, sizeof(OrderingScore),
+          compareScores);
+
+    if (format == FORMAT_CSV) {
+      outputString("rank,ordering,depth,specifications,redundant\n");
+    }
+    for (o = 0; o < ranking.numOrderings; o++) {
+      const OrderingScore *score = &ranking.scores[o];
+      // Text output only shows the best ten
+      if (format == FORMAT_TEXT && o == 10) {
+        outputString("... ");
+        outputInt(ranking.numOrderings);
+        outputString(" orderings\n");
+        break;
+      }
+      orderingPermutation(score->ordering, hierarchy.numDimensions, order);
+      if (format == FORMAT_JSONL) {
+        outputString("{\"rank\":");
+        outputInt(o + 1);
+        outputString(",\"ordering\":[\"");
+        outputOrdering(&hierarchy, order, "\",\"");
+        outputString("\"],\"depth\":");
+      }
+      else if (format == FORMAT_CSV) {
+        outputInt(o + 1);
+        outputString(",");
+        outputOrdering(&hierarchy, order, " ");
+        outputString(",");
+      }
+      else {
+        outputInt(o + 1);
+        outputString(". ");
+        outputOrdering(&hierarchy, order, " > ");
+        outputString(": depth ");
+      }
+      outputInt(score->depth);
+      outputString(format == FORMAT_JSONL ? ",\"specifications\":" :
+                   format == FORMAT_CSV ? "," : ", specifications ");
+      outputInt(score->specifications);
+      outputString(format == FORMAT_JSONL ? ",\"redundant\":" :
+                   format == FORMAT_CSV ? "," : ", redundant ");
+      outputInt(score->redundant);
+      outputString(format == FORMAT_JSONL ? "}\n" : "\n");
+    }
+    free(ranking.scores);
+  }
+  outputFlush();
+
+  freeHierarchy(&hierarchy);
+  freeInventory(&inventory);
+  return 0;
+}
+
+//===================================================================//
+//======================== Segment Clustering =======================//
+//===================================================================//
+// Agglomerative clustering of the segments of an inventory into a
+// dendrogram. Every segment is the mask of the binary features of the
+// inventory it has, and the distance between two segments is the number
+// of features that tell them apart, the popcount of their masks' XOR,
+// computed for all pairs in parallel. Clusters are merged with the
+// nearest-neighbour chain: follow nearest neighbours from any cluster
+// until two clusters are each other's nearest, and merge them. For the
+// linkages whose distances never shrink by merging (single, complete and
+// average), this gives the same tree as always merging the closest pair,
+// in O(n^2) time and with the matrix as the only O(n^2) memory.
+enum Linkage { LINKAGE_AVERAGE, LINKAGE_COMPLETE, LINKAGE_SINGLE };
+
+const char *linkageNames[] = {"average", "complete", "single"};
+
+typedef struct {
+  int left;             // Segment below n, or cluster n + merge number
+  int right;
+  double distance;
+  int size;
+} Merge;
+
+typedef struct {
+  const unsigned long long *masks;
+  int count;
+  float *distances;     // Upper triangle, row by row
+  int nextRow;
+} DistanceMatrix;
+
+// Position of the distance between i and j (i != j) in the upper triangle
+size_t trianglePosition(int count, int i, int j) {
+  if (i > j) {
+    int swap = i;
+    i = j;
+    j = swap;
+  }
+  return (size_t)i * count - (size_t)i * (i + 1) / 2 + (size_t)(j - i - 1);
+}
+
+void distanceTask(int worker, int numWorkers, void *context) {
+  DistanceMatrix *matrix = context;
+  int i;
+
+  (void)worker;
+  (void)numWorkers;
+  // Rows get shorter, so workers take them one at a time
+  while ((i = __atomic_fetch_add(&matrix->nextRow, 1, __ATOMIC_RELAXED)) <
+         matrix->count) {
+    float *row = matrix->distances + trianglePosition(matrix->count, i, i + 1);
+    unsigned long long mask = matrix->masks[i];
+    int j;
+    for (j = i + 1; j < matrix->count; j++) {
+      row[j - i - 1] = (float)__builtin_popcountll(mask ^ matrix->masks[j]);
+    }
+  }
+}
+
+// Merge the segments of the matrix into count - 1 merges, closest first.
+// Merges are numbered in this order, cluster count + m being merge m.
+void nearestNeighbourChain(DistanceMatrix *matrix, int linkage, Merge merges[]) {
+  int count = matrix->count;
+  float *distances = matrix->distances;
+  int *chain = malloc(sizeof(int) * (count + 1));
+  int *size = malloc(sizeof(int) * count);
+  int *active = malloc(sizeof(int) * count);
+  int *parent = malloc(sizeof(int) * (2 * count));
+  Merge *found = malloc(sizeof(Merge) * count);
+  int numFound = 0;
+  int length = 0;
+  int m;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    size[i] = 1;
+    active[i] = 1;
+  }
+  while (numFound < count - 1) {
+    int a;
+    int b = -1;
+    float nearest = 0;
+
+    if (length == 0) {
+      for (i = 0; !active[i]; i++) {
+      }
+      chain[length++] = i;
+    }
+    // Nearest neighbour of the top of the chain, the cluster below it on a tie
+    a = chain[length - 1];
+    if (length > 1) {
+      b = chain[length - 2];
+      nearest = distances[trianglePosition(count, a, b)];
+    }
+    for (i = 0; i < count; i++) {
+      if (active[i] && i != a &&
+          (b < 0 || distances[trianglePosition(count, a, i)] < nearest)) {
+        b = i;
+        nearest = distances[trianglePosition(count, a, i)];
+      }
+    }
+    if (length < 2 || b != chain[length - 2]) {
+      chain[length++] = b;
+      continue;
+    }
+
+    // Reciprocal nearest neighbours: merge b into a's slot
+    length -= 2;
+    found[numFound].left = a;
+    found[numFound].right = b;
+    found[numFound].distance = nearest;
+    found[numFound].size = size[a] + size[b];
+    numFound++;
+    for (i = 0; i < count; i++) {
+      float da;
+      float db;
+      if (!active[i] || i == a || i == b) {
+        continue;
+      }
+      da = distances[trianglePosition(count, a, i)];
+      db = distances[trianglePosition(count, b, i)];
+      distances[trianglePosition(count, a, i)] =
+          linkage == LINKAGE_SINGLE ? (da < db ? da : db) :
+          linkage == LINKAGE_COMPLETE ? (da > db ? da : db) :
+          (size[a] * da + size[b] * db) / (size[a] + size[b]);
+    }
+    size[a] += size[b];
+    active[b] = 0;
+  }
+
+  // The chain finds the merges out of order: sort them by distance, keeping
+  // the order of equal ones, and name the two clusters of each merge by
+  // union-find from a segment of each (the clusters of slots a and b
+  // contain segments a and b)
+  for (m = 1; m < numFound; m++) {
+    Merge merge = found[m];
+    for (i = m; i > 0 && found[i - 1].distance > merge.distance; i--) {
+      found[i] = found[i - 1];
+    }
+    found[i] = merge;
+  }
+  for (i = 0; i < 2 * count; i++) {
+    parent[i] = i;
+  }
+  for (m = 0; m < numFound; m++) {
+    int left = found[m].left;
+    int right = found[m].right;
+    while (parent[left] != left) {
+      left = parent[left] = parent[parent[left]];
+    }
+    while (parent[right] != right) {
+      right = parent[right] = parent[parent[right]];
+    }
+    merges[m].left = left < right ? left : right;
+    merges[m].right = left < right ? right : left;
+    merges[m].distance = found[m].distance;
+    merges[m].size = found[m].size;
+    parent[left] = count + m;
+    parent[right] = count + m;
+  }
+
+  free(chain);
+  free(size);
+  free(active);
+  free(parent);
+  free(found);
+}
+
+// Write the cluster in Newick format, with the length of each branch, the
+// height of its parent above its own (half the distance of a merge)
+void outputNewick(const Inventory *inventory, const Merge merges[], int node,
+                  double parentHeight) {
+  int count = inventory->count;
+  double height = node < count ? 0 : merges[node - count].distance / 2;
+
+  if (node >= count) {
+    outputString("(");
+    outputNewick(inventory, merges, merges[node - count].left, height);
+    outputString(",");
+    outputNewick(inventory, merges, merges[node - count].right, height);
+    outputString(")");
+  }
+  else {
+    outputString(inventory->segments[node].symbol);
+  }
+  if (parentHeight >= 0) {
+    outputString(":");
+    outputDouble(parentHeight - height);
+  }
+}
+
+// Cluster the segments of the inventory and write the dendrogram. Return 0
+// on success.
+int runClustering(const char *inventoryName, int linkage, int format) {
+  Inventory inventory;
+  DistanceMatrix matrix;
+  BinaryFeature features[MAX_FEATURES];
+  unsigned long long *masks;
+  Merge *merges;
+  int numFeatures;
+  int count;
+  int f;
+  int i;
+
+  if (!loadInventory(&inventory, inventoryName)) {
+    return 1;
+  }
+  count = inventory.count;
+  if (count < 2) {
+    fprintf(stderr, "The inventory needs at least 2 segments\n");
+    freeInventory(&inventory);
+    return 1;
+  }
+  numFeatures = inventoryFeatures(&inventory, features, MAX_FEATURES);
+  masks = calloc(count, sizeof(unsigned long long));
+  for (i = 0; i < count; i++) {
+    for (f = 0; f < numFeatures; f++) {
+      if (hasFeature(&inventory.segments[i], &features[f])) {
+        masks[i] |= 1ULL << f;
+      }
+    }
+  }
+
+  matrix.masks = masks;
+  matrix.count = count;
+  matrix.nextRow = 0;
+  matrix.distances = malloc(sizeof(float) * ((size_t)count * (count - 1) / 2));
+  if (matrix.distances == NULL) {
+    fprintf(stderr, "The distance matrix does not fit in memory\n");
+    free(masks);
+    freeInventory(&inventory);
+    return 1;
+  }
+  runParallel(distanceTask, &matrix, workerCount());
+  merges = malloc(sizeof(Merge) * (count - 1));
+  nearestNeighbourChain(&matrix, linkage, merges);
+
+  if (format == FORMAT_TEXT) {
+    outputNewick(&inventory, merges, 2 * count - 2, -1);
+    outputString(";\n");
+  }
+  else if (format == FORMAT_CSV) {
+    outputString("id,symbol,left,right,distance,size\n");
+  }
+  for (i = 0; i < count && (format == FORMAT_JSONL || format == FORMAT_CSV); i++) {
+    outputString(format == FORMAT_JSONL ? "{\"id\":" : "");
+    outputInt(i);
+    outputString(format == FORMAT_JSONL ? ",\"symbol\":\"" : ",");
+    outputString(inventory.segments[i].symbol);
+    outputString(format == FORMAT_JSONL ? "\"}\n" : ",,,,1\n");
+  }
+  for (i = 0; i < count - 1 && format != FORMAT_TEXT; i++) {
+    const Merge *merge = &merges[i];
+    if (format == FORMAT_BINARY) {
+      // A row of the linkage matrix of SciPy: 4 doubles, the two clusters,
+      // the distance and the size
+      double row[4];
+      row[0] = merge->left;
+      row[1] = merge->right;
+      row[2] = merge->distance;
+      row[3] = merge->size;
+      outputBytes((const char *)row, sizeof(row));
+      continue;
+    }
+    outputString(format == FORMAT_JSONL ? "{\"id\":" : "");
+    outputInt(count + i);
+    outputString(format == FORMAT_JSONL ? ",\"left\":" : ",,");
+    outputInt(merge->left);
+    outputString(format == FORMAT_JSONL ? ",\"right\":" : ",");
+    outputInt(merge->right);
+    outputString(format == FORMAT_JSONL ? ",\"distance\":" : ",");
+    outputDouble(merge->distance);
+    outputString(format == FORMAT_JSONL ? ",\"size\":" : ",");
+    outputInt(merge->size);
+    outputString(format == FORMAT_JSONL ? "}\n" : "\n");
+  }
+  outputFlush();
+
+  free(merges);
+  free(matrix.distances);
+  free(masks);
+  freeInventory(&inventory);
+  return 0;
+}
+
+//===================================================================//
+//======================= Inventory Comparison ======================//
+//===================================================================//
+// Similarity of every pair of languages, each given by the segments of its
+// inventory, a subset of one global inventory (the table, or an inventory
+// file). A language is the bitset of its segments and the mask of the
+// feature values they have, and two languages are compared by the Jaccard
+// similarity of their segments (shared over all, from the popcounts of the
+// AND of their bitsets) and of their feature values. Languages are taken
+// in tiles of COMPARE_TILE, so that the bitsets of two tiles stay in cache
+// while all their pairs are compared, and workers take the pairs of tiles
+// in turn.
+#define COMPARE_TILE 64
+
+typedef struct {
+  int numLanguages;
+  char **names;
+  Bitset *segments;             // numLanguages x words
+  int words;
+  int *numSegments;
+  unsigned long long *features;
+  float *segmentSimilarity;     // Upper triangle (see trianglePosition)
+  float *featureSimilarity;
+  int numTiles;
+  long long nextTilePair;
+} Comparison;
+
+// Segment of the global inventory by its symbol
+typedef struct {
+  const char *symbol;
+  int segment;
+} SegmentName;
+
+// By symbol, then the first segment with it first
+int compareSegmentNames(const void *a, const void *b) {
+  const SegmentName *first = a;
+  const SegmentName *second = b;
+  int order = strcmp(first->symbol, second->symbol);
+
+  return order != 0 ? order : first->segment - second->segment;
+}
+
+// Segment of the inventory with the symbol, or else with the table symbol
+// of its segment (e.g. "ɹ/r" for "ɹ"), -1 if none
+int findSegmentName(const SegmentName names[], int count, const char symbol[]) {
+  const char *tableSymbol;
+  int low = 0;
+  int high = count;
+  int entry;
+
+  // First name not before the symbol
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (strcmp(names[middle].symbol, symbol) < 0) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+  if (low < count && strcmp(names[low].symbol, symbol) == 0) {
+    return names[low].segment;
+  }
+
+  entry = findSymbol(symbol, strlen(symbol));
+  if (entry < 0) {
+    return -1;
+  }
+  tableSymbol = segmentTable[segmentSymbols[entry].consonantVowel]
+                            [segmentSymbols[entry].number].symbol;
+  return strcmp(tableSymbol, symbol) != 0 ? findSegmentName(names, count, tableSymbol)
+                                          : -1;
+}
+
+// Read the languages of the file, one per line: a name, then the symbols of
+// its segments in the global inventory. Return 0 (after reporting) on
+// failure.
+int loadLanguages(Comparison *comparison, const char *path,
+                  const Inventory *inventory, const unsigned long long masks[]) {
+  InputScanner file;
+  SegmentName *names = malloc(sizeof(SegmentName) * inventory->count);
+  ByteArray line = {NULL, 0, 0};
+  size_t position = 0;
+  int lineNumber = 0;
+  int capacity = 0;
+  int status = 1;
+  int i;
+
+  for (i = 0; i < inventory->count; i++) {
+    names[i].symbol = inventory->segments[i].symbol;
+    names[i].segment = i;
+  }
+  qsort(names, inventory->count, sizeof(SegmentName), compareSegmentNames);
+  comparison->words = (int)BITSET_WORDS(inventory->count);
+
+  if (!openCorpus(&file, path)) {
+    free(names);
+    return 0;
+  }
+  while (position < file.length && status) {
+    size_t end = position;
+    Bitset *bits;
+    char *token;
+
+    while (end < file.length && file.data[end] != '\n') {
+      end++;
+    }
+    lineNumber++;
+    line.length = 0;
+    byteArrayAppend(&line, file.data + position, end - position);
+    byteArrayAppend(&line, "", 1);
+    position = end + 1;
+    token = strtok(line.bytes, " \t\r,");
+    if (token == NULL || token[0] == '#') {
+      continue;
+    }
+
+    if (comparison->numLanguages == capacity) {
+      capacity = capacity > 0 ? 2 * capacity : 256;
+      comparison->names = realloc(comparison->names, sizeof(char *) * capacity);
+      comparison->segments = realloc(comparison->segments,
+                                     sizeof(Bitset) * capacity * comparison->words);
+      comparison->numSegments = realloc(comparison->numSegments, sizeof(int) * capacity);
+      comparison->features = realloc(comparison->features,
+                                     sizeof(unsigned long long) * capacity);
+    }
+    i = comparison->numLanguages;
+    comparison->names[i] = strdup(token);
+    comparison->features[i] = 0;
+    bits = comparison->segments + (size_t)i * comparison->words;
+    memset(bits, 0, sizeof(Bitset) * comparison->words);
+    comparison->numLanguages++;
+
+    for (token = strtok(NULL, " \t\r,"); token != NULL; token = strtok(NULL, " \t\r,")) {
+      int segment = findSegmentName(names, inventory->count, token);
+      if (segment < 0) {
+        fprintf(stderr, "%s:%d: unknown segment %s\n", path, lineNumber, token);
+        status = 0;
+        break;
+      }
+      bits[segment / 64] |= 1ULL << (segment % 64);
+      comparison->features[i] |= masks[segment];
+    }
+    comparison->numSegments[i] = (int)bitsetCount(bits, comparison->words);
+  }
+  scannerClose(&file);
+  free(line.bytes);
+  free(names);
+  return status;
+}
+
+void compareTask(int worker, int numWorkers, void *context) {
+  Comparison *comparison = context;
+  long long numPairs = (long long)comparison->numTiles * (comparison->numTiles + 1) / 2;
+  long long pair;
+
+  (void)worker;
+  (void)numWorkers;
+  while ((pair = __atomic_fetch_add(&comparison->nextTilePair, 1, __ATOMIC_RELAXED)) <
+         numPairs) {
+    int first = 0;
+    int second;
+    int i;
+    int j;
+
+    // The pair of tiles (first <= second), in the order of the triangle
+    while (pair >= comparison->numTiles - first) {
+      pair -= comparison->numTiles - first;
+      first++;
+    }
+    second = first + (int)pair;
+
+    for (i = first * COMPARE_TILE;
+         i < (first + 1) * COMPARE_TILE && i < comparison->numLanguages; i++) {
+      const Bitset *a = comparison->segments + (size_t)i * comparison->words;
+      for (j = second * COMPARE_TILE > i + 1 ? second * COMPARE_TILE : i + 1;
+           j < (second + 1) * COMPARE_TILE && j < comparison->numLanguages; j++) {
+        const Bitset *b = comparison->segments + (size_t)j * comparison->words;
+        unsigned long long featuresA = comparison->features[i];
+        unsigned long long featuresB = comparison->features[j];
+        size_t position = trianglePosition(comparison->numLanguages, i, j);
+        long long shared = 0;
+        long long all;
+        int w;
+
+        for (w = 0; w < comparison->words; w++) {
+          shared += __builtin_popcountll(a[w] & b[w]);
+        }
+        all = comparison->numSegments[i] + comparison->numSegments[j] - shared;
+        comparison->segmentSimilarity[position] = all > 0 ? (float)shared / all : 1;
+        all = __builtin_popcountll(featuresA | featuresB);
+        comparison->featureSimilarity[position] =
+            all > 0 ? (float)__builtin_popcountll(featuresA & featuresB) / all : 1;
+      }
+    }
+  }
+}
+
+// Mask of the features of every segment of the inventory (to free)
+unsigned long long *segmentFeatureMasks(const Inventory *inventory,
+                                        const BinaryFeature features[],
+                                        int numFeatures) {
+  unsigned long long *masks = calloc(inventory->count + 1, sizeof(unsigned long long));
+  int f;
+  int i;
+
+  for (i = 0; i < inventory->count; i++) {
+    for (f = 0; f < numFeatures; f++) {
+      if (hasFeature(&inventory->segments[i], &features[f])) {
+        masks[i] |= 1ULL << f;
+      }
+    }
+  }
+  return masks;
+}
+
+void freeComparison(Comparison *comparison) {
+  int i;
+
+  for (i = 0; i < comparison->numLanguages; i++) {
+    free(comparison->names[i]);
+  }
+  free(comparison->names);
+  free(comparison->segments);
+  free(comparison->numSegments);
+  free(comparison->features);
+  free(comparison->segmentSimilarity);
+  free(comparison->featureSimilarity);
+  memset(comparison, 0, sizeof(*comparison));
+}
+
+// Compare every pair of languages of the file, whose segments are those of
+// the inventory. Return 0 on success.
+int runComparison(const char *path, const char *inventoryName, int format) {
+  Inventory inventory;
+  Comparison comparison;
+  BinaryFeature features[MAX_FEATURES];
+  unsigned long long *masks;
+  size_t numPairs;
+  int numFeatures;
+  int status;
+  int i;
+  int j;
+
+  if (!loadInventory(&inventory, inventoryName)) {
+    return 1;
+  }
+  numFeatures = inventoryFeatures(&inventory, features, MAX_FEATURES);
+  masks = segmentFeatureMasks(&inventory, features, numFeatures);
+  memset(&comparison, 0, sizeof(comparison));
+  if (!loadLanguages(&comparison, path, &inventory, masks)) {
+    // Reported, nothing is compared
+  }
+  else if (comparison.numLanguages < 2) {
+    fprintf(stderr, "The file needs at least 2 languages\n");
+  }
+  else {
+    numPairs = (size_t)comparison.numLanguages * (comparison.numLanguages - 1) / 2;
+    comparison.segmentSimilarity = malloc(sizeof(float) * numPairs);
+    comparison.featureSimilarity = malloc(sizeof(float) * numPairs);
+    comparison.numTiles = (comparison.numLanguages + COMPARE_TILE - 1) / COMPARE_TILE;
+    runParallel(compareTask, &comparison, workerCount());
+  }
+
+  if (comparison.segmentSimilarity != NULL && format == FORMAT_CSV) {
+    outputString("first,second,first_segments,second_segments,segment_jaccard,"
+                 "feature_jaccard\n");
+  }
+  for (i = 0; comparison.segmentSimilarity != NULL && i < comparison.numLanguages; i++) {
+    int nearest = -1;
+    for (j = format == FORMAT_TEXT ? 0 : i + 1; j < comparison.numLanguages; j++) {
+      size_t position;
+      if (j == i) {
+        continue;
+      }
+      position = trianglePosition(comparison.numLanguages, i, j);
+      if (format == FORMAT_TEXT) {
+        // Only the most similar language
+        if (nearest < 0 || comparison.segmentSimilarity[position] >
+                           comparison.segmentSimilarity[
+                               trianglePosition(comparison.numLanguages, i, nearest)]) {
+          nearest = j;
+        }
+        continue;
+      }
+      if (format == FORMAT_BINARY) {
+        // Little-endian 4-byte numbers of the two languages, then the two
+        // similarities as 4-byte floats
+        float similarities[2];
+        unsigned char bytes[8];
+        int k;
+        for (k = 0; k < 4; k++) {
+          bytes[k] = (unsigned char)((unsigned int)i >> (8 * k));
+          bytes[4 + k] = (unsigned char)((unsigned int)j >> (8 * k));
+        }
+        similarities[0] = comparison.segmentSimilarity[position];
+        similarities[1] = comparison.featureSimilarity[position];
+        outputBytes((const char *)bytes, sizeof(bytes));
+        outputBytes((const char *)similarities, sizeof(similarities));
+        continue;
+      }
+      // The names come from the file, and are escaped in JSON
+      if (format == FORMAT_JSONL) {
+        outputString("{\"first\":\"");
+        outputJsonText(comparison.names[i]);
+        outputString("\",\"second\":\"");
+        outputJsonText(comparison.names[j]);
+        outputString("\",\"firstSegments\":");
+      }
+      else {
+        outputString(comparison.names[i]);
+        outputString(",");
+        outputString(comparison.names[j]);
+        outputString(",");
+      }
+      outputInt(comparison.numSegments[i]);
+      outputString(format == FORMAT_JSONL ? ",\"secondSegments\":" : ",");
+      outputInt(comparison.numSegments[j]);
+      outputString(format == FORMAT_JSONL ? ",\"segmentJaccard\":" : ",");
+      outputDouble(comparison.segmentSimilarity[position]);
+      outputString(format == FORMAT_JSONL ? ",\"featureJaccard\":" : ",");
+      outputDouble(comparison.featureSimilarity[position]);
+      outputString(format == FORMAT_JSONL ? "}\n" : "\n");
+    }
+    if (format == FORMAT_TEXT) {
+      size_t position = trianglePosition(comparison.numLanguages, i, nearest);
+      outputString(comparison.names[i]);
+      outputString(" (");
+      outputInt(comparison.numSegments[i]);
+      outputString(" segments): closest to ");
+      outputString(comparison.names[nearest]);
+      outputString(", segments ");
+      outputDouble(comparison.segmentSimilarity[position]);
+      outputString(", features ");
+      outputDouble(comparison.featureSimilarity[position]);
+      outputString("\n");
+    }
+  }
+  outputFlush();
+
+  status = comparison.segmentSimilarity != NULL ? 0 : 1;
+  freeComparison(&comparison);
+  free(masks);
+  freeInventory(&inventory);
+  return status;
+}
+
+//===================================================================//
+//========================= Feature Itemsets ========================//
+//===================================================================//
+// Frequent combinations of feature values across sets of segments (e.g.
+// every onset cluster of a lexicon), mined with Eclat. Each line of the
+// file is one set (a transaction) and its items are the values and sub
+// values of its segments, at most 64, so a transaction is one 64-bit mask.
+// Every item keeps the bitset of the transactions that have it, and the
+// support of an itemset is the popcount of the intersection of its bitsets.
+// The search is depth-first, each worker taking the next first item.
+// The transactions are sorted by their masks, so that the same items are
+// close together and the bitsets of itemsets are sparse.
+typedef struct {
+  unsigned long long items;
+  long long support;
+} Itemset;
+
+typedef struct {
+  Itemset *itemsets;
+  long long count;
+  long long capacity;
+} ItemsetList;
+
+typedef struct {
+  const InputScanner *corpus;
+  int numItems;
+  BinaryFeature items[MAX_FEATURES];
+  unsigned long long segmentItems[NUM_SEGMENT_CODES];
+  unsigned long long **transactions;  // Per worker while reading
+  long long *numTransactions;         // Per worker while reading
+  unsigned long long *masks;          // Item mask of every transaction
+  long long total;
+  int words;
+  Bitset *tidsets;                    // Transactions of each item, numItems x words
+  int order[MAX_FEATURES];            // Frequent items by ascending support
+  int numFrequent;
+  long long minSupport;
+  int nextFirst;                      // Next first item to give to a worker
+  ItemsetList *results;               // Per worker
+  int failed;
+} ItemsetMiner;
+
+// Number the values of every dimension as items, in the order of the
+// dimensions and values, and give every segment the mask of its items.
+// Return the number of items.
+int featureItems(BinaryFeature items[], unsigned long long segmentItems[]) {
+  int itemOf[NUM_DIMENSIONS][MAX_VALUES];
+  int numItems = 0;
+  int code;
+  int d;
+  int v;
+
+  memset(itemOf, 0, sizeof(itemOf));
+  for (d = 0; d < NUM_DIMENSIONS; d++) {
+    for (v = 1; v < MAX_VALUES && featureValues[d][v] != NULL; v++) {
+      itemOf[d][v] = numItems;
+      items[numItems].dimension = d;
+      items[numItems].value = v;
+      numItems++;
+    }
+  }
+
+  for (code = 0; code < NUM_SEGMENT_CODES; code++) {
+    int kind = CODE_KIND(code);
+    int number = CODE_NUMBER(code);
+    const Segment *segment = &segmentTable[kind][number];
+    segmentItems[code] = 0;
+    if (kind > 1 || number < 1 || number > segmentCount[kind]) {
+      continue;
+    }
+    for (d = firstDimension[kind]; d < firstDimension[kind] + numDimensions[kind]; d++) {
+      if (segment->value[d] != 0) {
+        segmentItems[code] |= 1ULL << itemOf[d][segment->value[d]];
+      }
+      if (segment->subValue[d] != 0) {
+        segmentItems[code] |= 1ULL << itemOf[d][segment->subValue[d]];
+      }
+    }
+  }
+  return numItems;
+}
+
+void readTransactionsTask(int worker, int numWorkers, void *context) {
+  ItemsetMiner *miner = context;
+  CorpusReader reader;
+  Word word = {NULL, 0, 0, 0};
+  unsigned long long *masks = NULL;
+  long long count = 0;
+  long long capacity = 0;
+  int status;
+  int i;
+
+  corpusReader(&reader, miner->corpus, worker, numWorkers);
+  while ((status = scanWord(&reader, &word)) > 0) {
+    unsigned long long mask = 0;
+    for (i = 0; i < word.length; i++) {
+      mask |= miner->segmentItems[word.codes[i]];
+    }
+    if (count == capacity) {
+      capacity = capacity > 0 ? 2 * capacity : 1024;
+      masks = realloc(masks, sizeof(unsigned long long) * capacity);
+    }
+    masks[count++] = mask;
+  }
+  if (status < 0) {
+    __atomic_store_n(&miner->failed, 1, __ATOMIC_RELAXED);
+  }
+  miner->transactions[worker] = masks;
+  miner->numTransactions[worker] = count;
+  free(word.codes);
+}
+
+int compareMasks(const void *a, const void *b) {
+  unsigned long long first = *(const unsigned long long *)a;
+  unsigned long long second = *(const unsigned long long *)b;
+
+  return first < second ? -1 : first > second;
+}
+
+// Set the bits of the worker's share of the words of every item's bitset
+void buildTidsetsTask(int worker, int numWorkers, void *context) {
+  ItemsetMiner *miner = context;
+  long long begin;
+  long long end;
+  long long w;
+  int item;
+
+  workerRange(miner->words, worker, numWorkers, &begin, &end);
+  for (w = begin; w < end; w++) {
+    long long last = (w + 1) * 64 < miner->total ? (w + 1) * 64 : miner->total;
+    long long t;
+    for (item = 0; item < miner->numItems; item++) {
+      miner->tidsets[(size_t)item * miner->words + w] = 0;
+    }
+    for (t = w * 64; t < last; t++) {
+      unsigned long long mask = miner->masks[t];
+      while (mask != 0) {
+        item = __builtin_ctzll(mask);
+        miner->tidsets[(size_t)item * miner->words + w] |= 1ULL << (t % 64);
+        mask &= mask - 1;
+      }
+    }
+  }
+}
+
+void addItemset(ItemsetList *list, unsigned long long items, long long support) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity > 0 ? 2 * list->capacity : 256;
+    list->itemsets = realloc(list->itemsets, sizeof(Itemset) * list->capacity);
+  }
+  list->itemsets[list->count].items = items;
+  list->itemsets[list->count].support = support;
+  list->count++;
+}
+
+// Transactions of an itemset during the search: only the words of its
+// bitset that are not zero, with their positions. Since the transactions
+// are sorted by their masks, the transactions of an itemset are mostly in
+// runs, and deeper itemsets keep few words.
+typedef struct {
+  Bitset *bits;
+  int *positions;
+  int count;
+} SparseTidset;
+
+// Intersect the sparse transactions with an item's bitset, keeping the
+// result if result is not NULL. Return the number of transactions.
+long long intersectTidset(const SparseTidset *tidset, const Bitset *itemTidset,
+                          SparseTidset *result) {
+  long long count = 0;
+  int k;
+
+  if (result == NULL) {
+    for (k = 0; k < tidset->count; k++) {
+      count += __builtin_popcountll(tidset->bits[k] & itemTidset[tidset->positions[k]]);
+    }
+    return count;
+  }
+  result->count = 0;
+  for (k = 0; k < tidset->count; k++) {
+    Bitset bits = tidset->bits[k] & itemTidset[tidset->positions[k]];
+    if (bits != 0) {
+      result->bits[result->count] = bits;
+      result->positions[result->count++] = tidset->positions[k];
+      count += __builtin_popcountll(bits);
+    }
+  }
+  return count;
+}
+
+// Extend the itemset, whose transactions are stack[depth], with the
+// candidates (positions in order) in turn, recording and extending each
+// frequent extension with the candidates after it
+void itemsetSearch(ItemsetMiner *miner, SparseTidset stack[], int depth,
+                   unsigned long long items, const int candidates[],
+                   int numCandidates, ItemsetList *list) {
+  int frequent[MAX_FEATURES];
+  long long support[MAX_FEATURES];
+  int numFrequent = 0;
+  int c;
+
+  for (c = 0; c < numCandidates; c++) {
+    const Bitset *itemTidset = miner->tidsets +
+                               (size_t)miner->order[candidates[c]] * miner->words;
+    long long count = intersectTidset(&stack[depth], itemTidset, NULL);
+    if (count >= miner->minSupport) {
+      support[numFrequent] = count;
+      frequent[numFrequent++] = candidates[c];
+    }
+  }
+
+  for (c = 0; c < numFrequent; c++) {
+    int item = miner->order[frequent[c]];
+    addItemset(list, items | 1ULL << item, support[c]);
+    if (c + 1 < numFrequent) {
+      intersectTidset(&stack[depth], miner->tidsets + (size_t)item * miner->words,
+                      &stack[depth + 1]);
+      itemsetSearch(miner, stack, depth + 1, items | 1ULL << item,
+                    frequent + c + 1, numFrequent - c - 1, list);
+    }
+  }
+}
+
+void itemsetTask(int worker, int numWorkers, void *context) {
+  ItemsetMiner *miner = context;
+  ItemsetList *list = &miner->results[worker];
+  SparseTidset stack[MAX_FEATURES + 1];
+  int candidates[MAX_FEATURES];
+  int first;
+  int depth;
+  int c;
+
+  (void)numWorkers;
+  for (depth = 0; depth <= miner->numFrequent; depth++) {
+    stack[depth].bits = malloc(sizeof(Bitset) * miner->words);
+    stack[depth].positions = malloc(sizeof(int) * miner->words);
+  }
+  while ((first = __atomic_fetch_add(&miner->nextFirst, 1, __ATOMIC_RELAXED)) <
+         miner->numFrequent) {
+    int item = miner->order[first];
+    const Bitset *tidset = miner->tidsets + (size_t)item * miner->words;
+    long long support = 0;
+    int w;
+
+    stack[0].count = 0;
+    for (w = 0; w < miner->words; w++) {
+      if (tidset[w] != 0) {
+        stack[0].bits[stack[0].count] = tidset[w];
+        stack[0].positions[stack[0].count++] = w;
+        support += __builtin_popcountll(tidset[w]);
+      }
+    }
+    addItemset(list, 1ULL << item, support);
+    for (c = first + 1; c < miner->numFrequent; c++) {
+      candidates[c - first - 1] = c;
+    }
+    itemsetSearch(miner, stack, 0, 1ULL << item, candidates,
+                  miner->numFrequent - first - 1, list);
+  }
+  for (depth = 0; depth <= miner->numFrequent; depth++) {
+    free(stack[depth].bits);
+    free(stack[depth].positions);
+  }
+}
+
+// Most frequent first, then smaller itemsets, then by items
+int compareItemsets(const void *a, const void *b) {
+  const Itemset *first = a;
+  const Itemset *second = b;
+  int firstSize = __builtin_popcountll(first->items);
+  int secondSize = __builtin_popcountll(second->items);
+
+  if (first->support != second->support) {
+    return first->support > second->support ? -1 : 1;
+  }
+  if (firstSize != secondSize) {
+    return firstSize - secondSize;
+  }
+  return first->items < second->items ? -1 : first->items > second->items;
+}
+
+// Write the items of an itemset, in the order of the dimensions and values
+void outputItems(const BinaryFeature features[], int numItems,
+                 unsigned long long items, int format) {
+  int written = 0;
+  int item;
+  int i;
+
+  for (item = 0; item < numItems; item++) {
+    const BinaryFeature *feature = &features[item];
+    const char *value = featureValues[feature->dimension][feature->value];
+    if ((items >> item & 1) == 0) {
+      continue;
+    }
+    if (format == FORMAT_JSONL) {
+      outputString(written++ > 0 ? ",{\"" : "{\"");
+      outputString(dimensionKeys[feature->dimension]);
+      outputString("\":\"");
+      outputString(value);
+      outputString("\"}");
+    }
+    else {
+      outputString(written++ > 0 ? " " : "");
+      outputString(dimensionKeys[feature->dimension]);
+      outputString("=");
+      // A space is written '_' in csv, as in inventory files
+      for (i = 0; value[i] != '\0'; i++) {
+        outputBytes(format == FORMAT_CSV && value[i] == ' ' ? "_" : value + i, 1);
+      }
+    }
+  }
+}
+
+// Mine the itemsets of the transactions of the file with a support of at
+// least minSupport transactions (a fraction of them if below 1)
+int runItemsets(const char *path, double minSupport, int format) {
+  InputScanner corpus;
+  ItemsetMiner miner;
+  ItemsetList all = {NULL, 0, 0};
+  long long itemSupport[MAX_FEATURES];
+  int numWorkers = workerCount();
+  long long t;
+  int item;
+  int i;
+  int w;
+
+  if (!openCorpus(&corpus, path)) {
+    return 1;
+  }
+  memset(&miner, 0, sizeof(miner));
+  miner.corpus = &corpus;
+  miner.numItems = featureItems(miner.items, miner.segmentItems);
+
+  // Read the transactions, then join the workers' shares in order
+  miner.transactions = calloc(numWorkers, sizeof(unsigned long long *));
+  miner.numTransactions = calloc(numWorkers, sizeof(long long));
+  runParallel(readTransactionsTask, &miner, numWorkers);
+  for (w = 0; w < numWorkers; w++) {
+    miner.total += miner.numTransactions[w];
+  }
+  miner.masks = malloc(sizeof(unsigned long long) * (miner.total + 1));
+  for (w = 0, t = 0; w < numWorkers; w++) {
+    if (miner.numTransactions[w] > 0) {
+      memcpy(miner.masks + t, miner.transactions[w],
+             sizeof(unsigned long long) * miner.numTransactions[w]);
+    }
+    t += miner.numTransactions[w];
+    free(miner.transactions[w]);
+  }
+  free(miner.transactions);
+  free(miner.numTransactions);
+  scannerClose(&corpus);
+  if (miner.failed) {
+    free(miner.masks);
+    return 1;
+  }
+
+  qsort(miner.masks, miner.total, sizeof(unsigned long long), compareMasks);
+  miner.words = BITSET_WORDS(miner.total);
+  miner.tidsets = malloc(sizeof(Bitset) * miner.numItems * (miner.words + 1));
+  runParallel(buildTidsetsTask, &miner, numWorkers);
+
+  miner.minSupport = minSupport < 1 ? (long long)ceil(minSupport * miner.total - 1e-9)
+                                    : (long long)minSupport;
+  if (miner.minSupport < 1) {
+    miner.minSupport = 1;
+  }
+  // Frequent items by ascending support, so that the rarest items, with
+  // the fewest extensions, are intersected first
+  for (item = 0; item < miner.numItems; item++) {
+    itemSupport[item] = bitsetCount(miner.tidsets + (size_t)item * miner.words,
+                                    miner.words);
+    if (itemSupport[item] >= miner.minSupport) {
+      for (i = miner.numFrequent;
+           i > 0 && itemSupport[miner.order[i - 1]] > itemSupport[item]; i--) {
+        miner.order[i] = miner.order[i - 1];
+      }
+      miner.order[i] = item;
+      miner.numFrequent++;
+    }
+  }
+
+  miner.results = calloc(numWorkers, sizeof(ItemsetList));
+  runParallel(itemsetTask, &miner, numWorkers);
+  for (w = 0; w < numWorkers; w++) {
+    for (t = 0; t < miner.results[w].count; t++) {
+      addItemset(&all, miner.results[w].itemsets[t].items,
+                 miner.results[w].itemsets[t].support);
+    }
+    free(miner.results[w].itemsets);
+  }
+  free(miner.results);
+  qsort(all.itemsets, all.count, sizeof(Itemset), compareItemsets);
+
+  if (format == FORMAT_TEXT) {
+    outputInt(miner.total);
+    outputString(" transactions, ");
+    outputInt(all.count);
+    outputString(" itemsets with a support of at least ");
+    outputInt(miner.minSupport);
+    outputString("\n");
+  }
+  else if (format == FORMAT_CSV) {
+    outputString("size,support,items\n");
+  }
+  for (t = 0; t < all.count; t++) {
+    const Itemset *itemset = &all.itemsets[t];
+    if (format == FORMAT_BINARY) {
+      // Little-endian 8-byte item mask (bit i for the i-th value in the
+      // order of the dimensions) and 8-byte support
+      unsigned char bytes[16];
+      for (i = 0; i < 8; i++) {
+        bytes[i] = (unsigned char)(itemset->items >> (8 * i));
+        bytes[8 + i] = (unsigned char)((unsigned long long)itemset->support >> (8 * i));
+      }
+      outputBytes((const char *)bytes, sizeof(bytes));
+    }
+    else if (format == FORMAT_JSONL) {
+      outputString("{\"items\":[");
+      outputItems(miner.items, miner.numItems, itemset->items, format);
+      outputString("],\"support\":");
+      outputInt(itemset->support);
+      outputString("}\n");
+    }
+    else if (format == FORMAT_CSV) {
+      outputInt(__builtin_popcountll(itemset->items));
+      outputString(",");
+      outputInt(itemset->support);
+      outputString(",");
+      outputItems(miner.items, miner.numItems, itemset->items, format);
+      outputString("\n");
+    }
+    else {
+      outputInt(itemset->support);
+      outputString(" (");
+      outputInt(itemset->support * 100 / (miner.total > 0 ? miner.total : 1));
+      outputString("%): ");
+      outputItems(miner.items, miner.numItems, itemset->items, format);
+      outputString("\n");
+    }
+  }
+  outputFlush();
+
+  free(all.itemsets);
+  free(miner.tidsets);
+  free(miner.masks);
+  return 0;
+}
+
+//===================================================================//
+//===================== Implicational Universals ====================//
+//===================================================================//
+// Implications "every language with X also has Y", and "with X and Y, also
+// Z", across the languages of a file read as for the comparison. The items
+// are the feature values of the global inventory, then its segments, and a
+// language has a value if one of its segments has it. Every item keeps the
+// bitset of the languages that have it, so the support of a set of items is
+// the popcount of the AND of their bitsets. The supports of all the pairs
+// are counted first, then the triples, workers taking the first item of
+// the antecedents in turn. An implication is kept if it reaches the support
+// (languages with its antecedent and consequent) and the confidence (its
+// support over that of its antecedent), if its consequent is not in every
+// language nor implied by definition (a value of every segment with an
+// item of its antecedent, e.g. Labial for Bilabial), and, for two
+// antecedents, if neither one alone reaches the confidence.
+typedef struct {
+  int antecedent[2];        // Items, the second -1 if there is only one
+  int consequent;
+  int support;
+  int antecedentSupport;
+} Implication;
+
+typedef struct {
+  Implication *implications;
+  long long count;
+  long long capacity;
+} ImplicationList;
+
+typedef struct {
+  int numItems;
+  int numFeatures;                // Items that are values, before the segments
+  int numLanguages;
+  int words;
+  Bitset *languages;              // Languages of each item, numItems x words
+  unsigned long long *implied;    // Values of every segment with each item
+  int *pairSupport;               // numItems x numItems, supports on the diagonal
+  int minSupport;
+  double minConfidence;
+  int nextFirst;                  // Next first item to give to a worker
+  ImplicationList *results;       // Per worker
+} UniversalMiner;
+
+void addImplication(ImplicationList *list, int first, int second, int consequent,
+                    int support, int antecedentSupport) {
+  Implication *implication;
+
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity > 0 ? 2 * list->capacity : 256;
+    list->implications = realloc(list->implications,
+                                 sizeof(Implication) * list->capacity);
+  }
+  implication = &list->implications[list->count++];
+  implication->antecedent[0] = first;
+  implication->antecedent[1] = second;
+  implication->consequent = consequent;
+  implication->support = support;
+  implication->antecedentSupport = antecedentSupport;
+}
+
+// Whether the item can be an antecedent or a consequent: found in enough
+// languages, but not in all of them
+int universalItem(const UniversalMiner *miner, int item) {
+  int support = miner->pairSupport[(size_t)item * miner->numItems + item];
+
+  return support >= miner->minSupport && support < miner->numLanguages;
+}
+
+void pairSupportTask(int worker, int numWorkers, void *context) {
+  UniversalMiner *miner = context;
+  int first;
+  int second;
+
+  (void)worker;
+  (void)numWorkers;
+  while ((first = __atomic_fetch_add(&miner->nextFirst, 1, __ATOMIC_RELAXED)) <
+         miner->numItems) {
+    const Bitset *a = miner->languages + (size_t)first * miner->words;
+    for (second = first; second < miner->numItems; second++) {
+      const Bitset *b = miner->languages + (size_t)second * miner->words;
+      int support = 0;
+      int w;
+      for (w = 0; w < miner->words; w++) {
+        support += __builtin_popcountll(a[w] & b[w]);
+      }
+      miner->pairSupport[(size_t)first * miner->numItems + second] = support;
+      miner->pairSupport[(size_t)second * miner->numItems + first] = support;
+    }
+  }
+}
+
+void tripleTask(int worker, int numWorkers, void *context) {
+  UniversalMiner *miner = context;
+  ImplicationList *list = &miner->results[worker];
+  Bitset *antecedent = malloc(sizeof(Bitset) * (miner->words + 1));
+  int items = miner->numItems;
+  const int *pairs = miner->pairSupport;
+  int first;
+  int second;
+  int item;
+  int w;
+
+  (void)numWorkers;
+  while ((first = __atomic_fetch_add(&miner->nextFirst, 1, __ATOMIC_RELAXED)) < items) {
+    const Bitset *a = miner->languages + (size_t)first * miner->words;
+    if (!universalItem(miner, first)) {
+      continue;
+    }
+    for (second = first + 1; second < items; second++) {
+      const Bitset *b = miner->languages + (size_t)second * miner->words;
+      int support = pairs[(size_t)first * items + second];
+      unsigned long long implied = miner->implied[first] | miner->implied[second];
+
+      // Without fewer languages than either item, the pair says no more
+      // than one of them
+      if (!universalItem(miner, second) || support < miner->minSupport ||
+          support == pairs[(size_t)first * items + first] ||
+          support == pairs[(size_t)second * items + second]) {
+        continue;
+      }
+      for (w = 0; w < miner->words; w++) {
+        antecedent[w] = a[w] & b[w];
+      }
+      for (item = 0; item < items; item++) {
+        const Bitset *c = miner->languages + (size_t)item * miner->words;
+        int firstPair = pairs[(size_t)first * items + item];
+        int secondPair = pairs[(size_t)second * items + item];
+        int count = 0;
+        if (item == first || item == second || !universalItem(miner, item) ||
+            (item < miner->numFeatures && (implied >> item & 1)) ||
+            firstPair < miner->minSupport || secondPair < miner->minSupport) {
+          continue;
+        }
+        for (w = 0; w < miner->words; w++) {
+          count += __builtin_popcountll(antecedent[w] & c[w]);
+        }
+        if (count >= miner->minSupport &&
+            count >= miner->minConfidence * support - 1e-9 &&
+            firstPair < miner->minConfidence * pairs[(size_t)first * items + first] - 1e-9 &&
+            secondPair < miner->minConfidence * pairs[(size_t)second * items + second] - 1e-9) {
+          addImplication(list, first, second, item, count, support);
+        }
+      }
+    }
+  }
+  free(antecedent);
+}
+
+// Most confident first, then most supported, then fewer antecedents, then
+// by items
+int compareImplications(const void *a, const void *b) {
+  const Implication *first = a;
+  const Implication *second = b;
+  long long left = (long long)first->support * second->antecedentSupport;
+  long long right = (long long)second->support * first->antecedentSupport;
+
+  if (left != right) {
+    return left > right ? -1 : 1;
+  }
+  if (first->support != second->support) {
+    return first->support > second->support ? -1 : 1;
+  }
+  if (first->antecedent[1] != second->antecedent[1]) {
+    return first->antecedent[1] - second->antecedent[1];
+  }
+  if (first->antecedent[0] != second->antecedent[0]) {
+    return first->antecedent[0] - second->antecedent[0];
+  }
+  return first->consequent - second->consequent;
+}
+
+// Write an item: a value as a class ("[Voiced]" in text, "voicing=Voiced"
+// in csv), a segment as its symbol, with its values in text and jsonl
+// ("ŋ [Velar & Nasal/Stop & Voiced]")
+void outputUniversalItem(const Inventory *inventory, const BinaryFeature features[],
+                         int numFeatures, int item, int format) {
+  const Segment *segment;
+  int written = 0;
+  int d;
+
+  if (item < numFeatures) {
+    if (format == FORMAT_TEXT) {
+      outputString("[");
+      outputString(featureValues[features[item].dimension][features[item].value]);
+      outputString("]");
+    }
+    else {
+      outputItems(features + item, 1, 1, format);
+    }
+    return ;
+  }
+
+  segment = &inventory->segments[item - numFeatures];
+  outputString(format == FORMAT_JSONL ? "{\"segment\":\"" : "");
+  outputString(segment->symbol);
+  outputString(format == FORMAT_JSONL ? "\"" : "");
+  for (d = 0; d < NUM_DIMENSIONS && format != FORMAT_CSV; d++) {
+    if (segment->value[d] == 0) {
+      continue;
+    }
+    if (format == FORMAT_JSONL) {
+      outputString(",\"");
+      outputString(dimensionKeys[d]);
+      outputString("\":\"");
+      outputContrastValue(segment, d);
+      outputString("\"");
+    }
+    else {
+      outputString(written++ > 0 ? " & " : " [");
+      outputContrastValue(segment, d);
+    }
+  }
+  outputString(format == FORMAT_JSONL ? "}" : written > 0 ? "]" : "");
+}
+
+// Mine the implications across the languages of the file, whose segments
+// are those of the inventory, with at least the support (a fraction of the
+// languages if below 1) and the confidence. Return 0 on success.
+int runUniversals(const char *path, const char *inventoryName, double minSupport,
+                  double minConfidence, int format) {
+  Inventory inventory;
+  Comparison comparison;
+  UniversalMiner miner;
+  BinaryFeature features[MAX_FEATURES];
+  ImplicationList all = {NULL, 0, 0};
+  unsigned long long *masks;
+  int numWorkers = workerCount();
+  int numFeatures;
+  long long t;
+  int first;
+  int item;
+  int i;
+  int w;
+
+  if (!loadInventory(&inventory, inventoryName)) {
+    return 1;
+  }
+  numFeatures = inventoryFeatures(&inventory, features, MAX_FEATURES);
+  masks = segmentFeatureMasks(&inventory, features, numFeatures);
+  memset(&comparison, 0, sizeof(comparison));
+  if (!loadLanguages(&comparison, path, &inventory, masks)) {
+    freeComparison(&comparison);
+    free(masks);
+    freeInventory(&inventory);
+    return 1;
+  }
+
+  // The languages of every item, from the items of every language
+  memset(&miner, 0, sizeof(miner));
+  miner.numItems = numFeatures + inventory.count;
+  miner.numFeatures = numFeatures;
+  miner.numLanguages = comparison.numLanguages;
+  miner.words = (int)BITSET_WORDS(comparison.numLanguages);
+  miner.languages = calloc((size_t)miner.numItems * miner.words + 1, sizeof(Bitset));
+  miner.implied = calloc(miner.numItems, sizeof(unsigned long long));
+  for (item = 0; item < miner.numItems; item++) {
+    miner.implied[item] = item < numFeatures ? ~0ULL : masks[item - numFeatures];
+    for (i = 0; item < numFeatures && i < inventory.count; i++) {
+      if (masks[i] >> item & 1) {
+        miner.implied[item] &= masks[i];
+      }
+    }
+  }
+  for (i = 0; i < comparison.numLanguages; i++) {
+    const Bitset *segments = comparison.segments + (size_t)i * comparison.words;
+    for (item = 0; item < miner.numItems; item++) {
+      int has = item < numFeatures
+                    ? (int)(comparison.features[i] >> item & 1)
+                    : (int)(segments[(item - numFeatures) / 64] >>
+                            ((item - numFeatures) % 64) & 1);
+      if (has) {
+        miner.languages[(size_t)item * miner.words + i / 64] |= 1ULL << (i % 64);
+      }
+    }
+  }
+
+  miner.minSupport = minSupport < 1
+                         ? (int)ceil(minSupport * miner.numLanguages - 1e-9)
+                         : (int)minSupport;
+  if (miner.minSupport < 1) {
+    miner.minSupport = 1;
+  }
+  miner.minConfidence = minConfidence;
+  miner.pairSupport = malloc(sizeof(int) * ((size_t)miner.numItems * miner.numItems + 1));
+  runParallel(pairSupportTask, &miner, numWorkers);
+
+  // Implications from one item, straight from the supports of the pairs
+  for (first = 0; first < miner.numItems; first++) {
+    int support = miner.pairSupport[(size_t)first * miner.numItems + first];
+    if (!universalItem(&miner, first)) {
+      continue;
+    }
+    for (item = 0; item < miner.numItems; item++) {
+      int count = miner.pairSupport[(size_t)first * miner.numItems + item];
+      if (item != first && universalItem(&miner, item) &&
+          !(item < numFeatures && (miner.implied[first] >> item & 1)) &&
+          count >= miner.minSupport && count >= minConfidence * support - 1e-9) {
+        addImplication(&all, first, -1, item, count, support);
+      }
+    }
+  }
+  miner.nextFirst = 0;
+  miner.results = calloc(numWorkers, sizeof(ImplicationList));
+  runParallel(tripleTask, &miner, numWorkers);
+  for (w = 0; w < numWorkers; w++) {
+    for (t = 0; t < miner.results[w].count; t++) {
+      const Implication *implication = &miner.results[w].implications[t];
+      addImplication(&all, implication->antecedent[0], implication->antecedent[1],
+                     implication->consequent, implication->support,
+                     implication->antecedentSupport);
+    }
+    free(miner.results[w].implications);
+  }
+  free(miner.results);
+  qsort(all.implications, all.count, sizeof(Implication), compareImplications);
+
+  if (format == FORMAT_TEXT) {
+    outputInt(miner.numLanguages);
+    outputString(" languages, ");
+    outputInt(all.count);
+    outputString(" implications with a support of at least ");
+    outputInt(miner.minSupport);
+    outputString(" and a confidence of at least ");
+    outputDouble(minConfidence);
+    outputString("\n");
+  }
+  else if (format == FORMAT_CSV) {
+    outputString("antecedent,consequent,support,antecedent_support,confidence\n");
+  }
+  for (t = 0; t < all.count; t++) {
+    const Implication *implication = &all.implications[t];
+    double confidence = (double)implication->support / implication->antecedentSupport;
+    if (format == FORMAT_BINARY) {
+      // Little-endian 4-byte numbers of the antecedents (0xFFFFFFFF for
+      // none), of the consequent (values first, then segments), then the
+      // support and the support of the antecedent
+      unsigned int numbers[5];
+      unsigned char bytes[20];
+      int k;
+      numbers[0] = (unsigned int)implication->antecedent[0];
+      numbers[1] = (unsigned int)implication->antecedent[1];
+      numbers[2] = (unsigned int)implication->consequent;
+      numbers[3] = (unsigned int)implication->support;
+      numbers[4] = (unsigned int)implication->antecedentSupport;
+      for (k = 0; k < 20; k++) {
+        bytes[k] = (unsigned char)(numbers[k / 4] >> (8 * (k % 4)));
+      }
+      outputBytes((const char *)bytes, sizeof(bytes));
+      continue;
+    }
+    outputString(format == FORMAT_JSONL ? "{\"if\":[" : "");
+    for (i = 0; i < 2 && implication->antecedent[i] >= 0; i++) {
+      if (i > 0) {
+        outputString(format == FORMAT_JSONL ? "," : format == FORMAT_CSV ? " " : " and ");
+      }
+      outputUniversalItem(&inventory, features, numFeatures, implication->antecedent[i],
+                          format);
+    }
+    outputString(format == FORMAT_JSONL ? "],\"then\":"
+                 : format == FORMAT_CSV ? "," : " => ");
+    outputUniversalItem(&inventory, features, numFeatures, implication->consequent,
+                        format);
+    if (format == FORMAT_TEXT) {
+      outputString(": ");
+      outputInt(implication->support);
+      outputString(" of ");
+      outputInt(implication->antecedentSupport);
+      outputString(" languages (");
+      outputDouble(confidence);
+      outputString(")\n");
+      continue;
+    }
+    outputString(format == FORMAT_JSONL ? ",\"support\":" : ",");
+    outputInt(implication->support);
+    outputString(format == FORMAT_JSONL ? ",\"antecedentSupport\":" : ",");
+    outputInt(implication->antecedentSupport);
+    outputString(format == FORMAT_JSONL ? ",\"confidence\":" : ",");
+    outputDouble(confidence);
+    outputString(format == FORMAT_JSONL ? "}\n" : "\n");
+  }
+  outputFlush();
+
+  free(all.implications);
+  free(miner.pairSupport);
+  free(miner.implied);
+  free(miner.languages);
+  freeComparison(&comparison);
+  free(masks);
+  freeInventory(&inventory);
+  return 0;
+}
+
+//===================================================================//
+//========================== Segment Classes ========================//
+//===================================================================//
+// A pattern is a sequence of classes of segments, e.g. "[Voiced & Stop] ɹ V":
+//  - a symbol, for its segment
+//  - C, V or ., for any consonant, vowel or segment
+//  - [...], for the segments matching values (e.g. Stop, Simple_Vowel or
+//    manner=Stop), symbols, C, V and . combined with ! (not), & (and) and
+//    | (or), in this order of precedence
+// and may start with ^ and end with $ to match at the start or end of words.
+// A segment matches a value if it is its value or its sub value. A class
+// is the set of codes of its segments, one bit per code.
+typedef unsigned long long SegmentClass;
+
+#define MAX_PATTERN 64
+
+typedef struct {
+  SegmentClass classes[MAX_PATTERN];
+  // Items (see Feature Itemsets) of a class that is exactly the segments
+  // having all of them, e.g. [Voiced & Stop], for pruning with summaries
+  unsigned long long items[MAX_PATTERN];
+  int itemsOnly[MAX_PATTERN];
+  int length;
+  int anchorStart;
+  int anchorEnd;
+} Pattern;
+
+// Codes of every segment of the table (or of one kind, if kind is 0 or 1)
+SegmentClass kindClass(int kind) {
+  SegmentClass class = 0;
+  int code;
+
+  for (code = 0; code < NUM_SEGMENT_CODES; code++) {
+    int number = CODE_NUMBER(code);
+    if (CODE_KIND(code) <= 1 && number >= 1 && number <= segmentCount[CODE_KIND(code)] &&
+        (kind < 0 || CODE_KIND(code) == kind)) {
+      class |= 1ULL << code;
+    }
+  }
+  return class;
+}
+
+// Item of the value of the dimension, in the numbering of featureItems
+int featureItem(int dimension, int value) {
+  int item = value - 1;
+  int d;
+  int v;
+
+  for (d = 0; d < dimension; d++) {
+    for (v = 1; v < MAX_VALUES && featureValues[d][v] != NULL; v++) {
+      item++;
+    }
+  }
+  return item;
+}
+
+// Class of one term: C, V, ., a value, "dimension=value" or a symbol. Set
+// *item to the item of a value, to -1 for ., and to -2 otherwise. Return 0
+// (after reporting) if the term is unknown.
+int classTerm(const char text[], size_t length, SegmentClass *class, int *item) {
+  char name[64];
+  const char *equals;
+  size_t i;
+  int entry;
+  int code;
+  int d;
+  int v;
+
+  *class = 0;
+  *item = -2;
+  if (length == 1 && (text[0] == 'C' || text[0] == 'V' || text[0] == '.')) {
+    *class = kindClass(text[0] == 'C' ? 0 : text[0] == 'V' ? 1 : -1);
+    *item = text[0] == '.' ? -1 : -2;
+    return 1;
+  }
+  if (length == 0 || length >= sizeof(name)) {
+    fprintf(stderr, "Unknown segment class '%.*s'\n", (int)length, text);
+    return 0;
+  }
+
+  // A value, with '_' for a space, after its dimension if given
+  for (i = 0; i < length; i++) {
+    name[i] = text[i] == '_' ? ' ' : text[i];
+  }
+  name[length] = '\0';
+  equals = strchr(name, '=');
+  for (d = 0; d < NUM_DIMENSIONS; d++) {
+    if (equals != NULL && (strlen(dimensionKeys[d]) != (size_t)(equals - name) ||
+                           strncmp(dimensionKeys[d], name, equals - name) != 0)) {
+      continue;
+    }
+    v = featureCode(d, equals != NULL ? equals + 1 : name);
+    if (v == 0) {
+      continue;
+    }
+    for (code = 0; code < NUM_SEGMENT_CODES; code++) {
+      const Segment *segment = &segmentTable[CODE_KIND(code)][CODE_NUMBER(code)];
+      if ((kindClass(-1) >> code & 1) &&
+          (segment->value[d] == v || segment->subValue[d] == v)) {
+        *class |= 1ULL << code;
+      }
+    }
+    *item = featureItem(d, v);
+    return 1;
+  }
+
+  entry = findSymbol(text, length);
+  if (entry < 0 || equals != NULL) {
+    fprintf(stderr, "Unknown segment class '%.*s' (expected a value, a symbol, "
+            "C, V or .)\n", (int)length, text);
+    return 0;
+  }
+  *class = 1ULL << SEGMENT_CODE(segmentSymbols[entry].consonantVowel,
+                                segmentSymbols[entry].number);
+  return 1;
+}
+
+// Parse the class text[*position, end) up to ']', e.g. "Voiced & Stop | m".
+// Return 0 (after reporting) if it is malformed.
+int parseClass(const char text[], size_t *position, size_t end,
+               SegmentClass *class, unsigned long long *items, int *itemsOnly) {
+  SegmentClass conjunction = 0;
+  unsigned long long conjunctionItems = 0;
+  int conjunctionOnly = 1;
+  int negations = 0;
+  int terms = 0;
+
+  *class = 0;
+  *items = 0;
+  *itemsOnly = 1;
+  while (1) {
+    size_t start;
+    size_t stop;
+    SegmentClass term;
+    int item;
+
+    while (*position < end && (text[*position] == ' ' || text[*position] == '!')) {
+      negations += text[(*position)++] == '!';
+    }
+    start = *position;
+    while (*position < end && strchr("&|!]", text[*position]) == NULL) {
+      (*position)++;
+    }
+    for (stop = *position; stop > start && text[stop - 1] == ' '; stop--) {
+    }
+    if (!classTerm(text + start, stop - start, &term, &item)) {
+      return 0;
+    }
+    if (negations % 2 == 1) {
+      term = ~term & kindClass(-1);
+    }
+    conjunction = terms++ == 0 ? term : conjunction & term;
+    if (item >= 0 && negations % 2 == 0) {
+      conjunctionItems |= 1ULL << item;
+    }
+    else if (item != -1 || negations % 2 == 1) {
+      conjunctionOnly = 0;
+    }
+    negations = 0;
+
+    if (*position >= end || text[*position] != '&') {
+      // End of a conjunction
+      *class |= conjunction;
+      *items = conjunctionItems;
+      *itemsOnly = *itemsOnly && conjunctionOnly && *class == conjunction;
+      terms = 0;
+      conjunctionItems = 0;
+      conjunctionOnly = 1;
+      if (*position < end && text[*position] == '|') {
+        *itemsOnly = 0;
+        (*position)++;
+        continue;
+      }
+      break;
+    }
+    (*position)++;
+  }
+
+  if (*position >= end || text[*position] != ']') {
+    fprintf(stderr, "Missing ']' in the pattern\n");
+    return 0;
+  }
+  (*position)++;
+  return 1;
+}
+
+// Parse a pattern, e.g. "[Nasal][Stop & Voiceless]". Return 0 (after
+// reporting) if it is malformed.
+int parsePattern(const char text[], Pattern *pattern) {
+  size_t length = strlen(text);
+  size_t position = 0;
+
+  pattern->length = 0;
+  pattern->anchorStart = 0;
+  pattern->anchorEnd = 0;
+  while (length > 0 && text[length - 1] == ' ') {
+    length--;
+  }
+  if (length > 0 && text[length - 1] == '$') {
+    pattern->anchorEnd = 1;
+    length--;
+  }
+  while (position < length && text[position] == ' ') {
+    position++;
+  }
+  if (position < length && text[position] == '^') {
+    pattern->anchorStart = 1;
+    position++;
+  }
+  while (position < length) {
+    SegmentClass *class = &pattern->classes[pattern->length];
+    unsigned long long *items = &pattern->items[pattern->length];
+    int *itemsOnly = &pattern->itemsOnly[pattern->length];
+    size_t start;
+    int item;
+
+    if (text[position] == ' ') {
+      position++;
+      continue;
+    }
+    if (pattern->length == MAX_PATTERN) {
+      fprintf(stderr, "A pattern has at most %d segments\n", MAX_PATTERN);
+      return 0;
+    }
+
+    if (text[position] == '[') {
+      position++;
+      if (!parseClass(text, &position, length, class, items, itemsOnly)) {
+        return 0;
+      }
+    }
+    else {
+      // C, V and . stand alone; a symbol runs up to a space or '['
+      start = position++;
+      if (strchr("CV.", text[start]) == NULL) {
+        while (position < length && text[position] != ' ' && text[position] != '[') {
+          position++;
+        }
+      }
+      if (!classTerm(text + start, position - start, class, &item)) {
+        return 0;
+      }
+      *items = 0;
+      *itemsOnly = item == -1;
+    }
+    pattern->length++;
+  }
+  return 1;
+}
+
+//===================================================================//
+//========================== Pattern Search =========================//
+//===================================================================//
+// Every word of a corpus that has a segment pattern (see Segment Classes)
+// is found with the bit-parallel Shift-And automaton: bit i of the state
+// says that the last i + 1 segments match the first i + 1 classes, and
+// each segment updates every bit at once with the mask of the classes it
+// belongs to, computed once per segment code.
+typedef struct {
+  unsigned long long masks[NUM_SEGMENT_CODES];
+  unsigned long long accept;    // Bit of the last class
+  int length;
+  int anchorStart;
+  int anchorEnd;
+} ShiftAnd;
+
+// Words that match, per worker, in the order of the corpus
+typedef struct {
+  ByteArray words;              // Codes of each word, ending with 0
+  ByteArray spans;              // Offset, start and end of each match
+  long long count;
+  long long scanned;
+} MatchList;
+
+typedef struct {
+  long long offset;
+  int start;                    // Segments [start, end) of the first match
+  int end;
+} MatchSpan;
+
+typedef struct {
+  const InputScanner *corpus;
+  const ShiftAnd *automaton;
+  MatchList *matches;           // Per worker
+  int failed;
+} PatternSearch;
+
+void compileShiftAnd(const Pattern *pattern, ShiftAnd *automaton) {
+  int code;
+  int i;
+
+  memset(automaton, 0, sizeof(*automaton));
+  for (i = 0; i < pattern->length; i++) {
+    for (code = 0; code < NUM_SEGMENT_CODES; code++) {
+      if (pattern->classes[i] >> code & 1) {
+        automaton->masks[code] |= 1ULL << i;
+      }
+    }
+  }
+  automaton->accept = pattern->length > 0 ? 1ULL << (pattern->length - 1) : 0;
+  automaton->length = pattern->length;
+  automaton->anchorStart = pattern->anchorStart;
+  automaton->anchorEnd = pattern->anchorEnd;
+}
+
+// End of the first match in the word, -1 if none. An empty pattern
+// matches at the start of the word, or at its end if anchored there ($).
+int shiftAndMatch(const ShiftAnd *automaton, const unsigned char codes[], int length) {
+  unsigned long long state = 0;
+  unsigned long long start = 1;
+  int i;
+
+  if (automaton->length == 0) {
+    if (automaton->anchorStart && automaton->anchorEnd && length > 0) {
+      return -1;
+    }
+    return automaton->anchorEnd ? length : 0;
+  }
+  for (i = 0; i < length; i++) {
+    // A match may start at every segment, or only at the first
+    state = (state << 1 | start) & automaton->masks[codes[i]];
+    start = !automaton->anchorStart;
+    if ((state & automaton->accept) != 0 && (!automaton->anchorEnd || i == length - 1)) {
+      return i + 1;
+    }
+    if (state == 0 && automaton->anchorStart) {
+      break;
+    }
+  }
+  return -1;
+}
+
+void patternSearchTask(int worker, int numWorkers, void *context) {
+  PatternSearch *search = context;
+  MatchList *matches = &search->matches[worker];
+  CorpusReader reader;
+  Word word = {NULL, 0, 0, 0};
+  unsigned char end = 0;
+  MatchSpan span;
+  int status;
+
+  corpusReader(&reader, search->corpus, worker, numWorkers);
+  while ((status = scanWord(&reader, &word)) > 0) {
+    int last = shiftAndMatch(search->automaton, word.codes, word.length);
+    matches->scanned++;
+    if (last < 0) {
+      continue;
+    }
+    span.offset = word.offset;
+    span.start = last - search->automaton->length;
+    span.end = last;
+    byteArrayAppend(&matches->spans, &span, sizeof(span));
+    byteArrayAppend(&matches->words, word.codes, word.length);
+    byteArrayAppend(&matches->words, &end, 1);
+    matches->count++;
+  }
+  if (status < 0) {
+    __atomic_store_n(&search->failed, 1, __ATOMIC_RELAXED);
+  }
+  free(word.codes);
+}
+
+void outputMatch(int format, const Word *word, const MatchSpan *span) {
+  if (format == FORMAT_BINARY) {
+    // Little-endian 8-byte offset, 4-byte start and 4-byte end
+    unsigned char bytes[16];
+    int i;
+    for (i = 0; i < 8; i++) {
+      bytes[i] = (unsigned char)((unsigned long long)span->offset >> (8 * i));
+    }
+    for (i = 0; i < 4; i++) {
+      bytes[8 + i] = (unsigned char)((unsigned int)span->start >> (8 * i));
+      bytes[12 + i] = (unsigned char)((unsigned int)span->end >> (8 * i));
+    }
+    outputBytes((const char *)bytes, sizeof(bytes));
+    return ;
+  }
+  if (format == FORMAT_JSONL) {
+    outputString("{\"offset\":");
+    outputInt(span->offset);
+    outputString(",\"word\":\"");
+    outputSymbols(word, 0, word->length, " ");
+    outputString("\",\"start\":");
+    outputInt(span->start);
+    outputString(",\"end\":");
+    outputInt(span->end);
+    outputString(",\"match\":\"");
+    outputSymbols(word, span->start, span->end, " ");
+    outputString("\"}\n");
+  }
+  else if (format == FORMAT_CSV) {
+    outputInt(span->offset);
+    outputString(",");
+    outputSymbols(word, 0, word->length, " ");
+    outputString(",");
+    outputInt(span->start);
+    outputString(",");
+    outputInt(span->end);
+    outputString("\n");
+  }
+  else {
+    // The match between brackets
+    outputSymbols(word, 0, span->start, " ");
+    outputString(span->start > 0 ? " [" : "[");
+    outputSymbols(word, span->start, span->end, " ");
+    outputString(span->end < word->length ? "] " : "]");
+    outputSymbols(word, span->end, word->length, " ");
+    outputString("\n");
+  }
+}
+
+// Write every word of the corpus that has the pattern, with its first
+// match. Return 0 on success.
+int runPatternSearch(const char *path, const char *text, int format) {
+  InputScanner corpus;
+  PatternSearch search;
+  Pattern pattern;
+  ShiftAnd automaton;
+  Word word = {NULL, 0, 0, 0};
+  int numWorkers = workerCount();
+  long long matches = 0;
+  long long scanned = 0;
+  int w;
+
+  if (!parsePattern(text, &pattern)) {
+    return 1;
+  }
+  compileShiftAnd(&pattern, &automaton);
+  if (!openCorpus(&corpus, path)) {
+    return 1;
+  }
+  search.corpus = &corpus;
+  search.automaton = &automaton;
+  search.matches = calloc(numWorkers, sizeof(MatchList));
+  search.failed = 0;
+  runParallel(patternSearchTask, &search, numWorkers);
+  scannerClose(&corpus);
+
+  if (format == FORMAT_CSV && !search.failed) {
+    outputString("offset,word,start,end\n");
+  }
+  for (w = 0; w < numWorkers; w++) {
+    MatchList *list = &search.matches[w];
+    const MatchSpan *spans = (const MatchSpan *)list->spans.bytes;
+    size_t position = 0;
+    long long m;
+
+    for (m = 0; m < list->count && !search.failed; m++) {
+      word.codes = (unsigned char *)list->words.bytes + position;
+      word.length = (int)strlen(list->words.bytes + position);
+      position += word.length + 1;
+      outputMatch(format, &word, &spans[m]);
+    }
+    matches += list->count;
+    scanned += list->scanned;
+    free(list->words.bytes);
+    free(list->spans.bytes);
+  }
+  free(search.matches);
+  if (format == FORMAT_TEXT && !search.failed) {
+    outputInt(matches);
+    outputString(" of ");
+    outputInt(scanned);
+    outputString(" words match\n");
+  }
+  outputFlush();
+  return search.failed ? 1 : 0;
+}
+
+//===================================================================//
+//=========================== Lexicon Tries =========================//
+//===================================================================//
+// The distinct words of a corpus or lexicon as a LOUDS trie over segment
+// codes: node 0 is the root, and the other nodes are numbered level by
+// level, the children of a node in the order of their codes. The shape is
+// one bit vector, with for every node in order a 1 per child and a 0, so
+// that the children of node v follow the (v-1)-th 0. A node is then its
+// code (one byte) and a summary of the segments of the words below it: the
+// items (see Feature Itemsets) that all of them have, and those that any
+// of them has. Few summaries are different, so each is stored once and a
+// node has the 2-byte number of its own. A query for the words starting
+// with a pattern skips every subtree whose summary cannot match the rest.
+#define MAX_TRIE_SUMMARIES 65536
+
+typedef struct {
+  unsigned int shared;          // Items of every segment below the node
+  unsigned int present;         // Items of any segment below the node
+} TrieSummary;
+
+typedef struct {
+  int numNodes;
+  int numWords;
+  long long numSegments;        // Of the distinct words
+  int maxLength;
+  Bitset *louds;                // 2 * numNodes - 1 bits
+  unsigned int *zerosBefore;    // Number of 0 bits before each word of louds
+  int loudsWords;
+  unsigned char *labels;        // Code of each node (the root's unused)
+  Bitset *terminal;             // Nodes ending a word
+  unsigned short *summaryOf;    // Summary of each node
+  TrieSummary *summaries;       // 0 says nothing, if there are too many
+  int numSummaries;
+} Trie;
+
+// Words of a corpus, each ending with 0 (codes are never 0), read by
+// every worker and joined in order
+typedef struct {
+  const InputScanner *corpus;
+  ByteArray *words;             // Per worker
+  int failed;
+} WordCollector;
+
+void collectWordsTask(int worker, int numWorkers, void *context) {
+  WordCollector *collector = context;
+  CorpusReader reader;
+  Word word = {NULL, 0, 0, 0};
+  unsigned char end = 0;
+  int status;
+
+  corpusReader(&reader, collector->corpus, worker, numWorkers);
+  while ((status = scanWord(&reader, &word)) > 0) {
+    byteArrayAppend(&collector->words[worker], word.codes, word.length);
+    byteArrayAppend(&collector->words[worker], &end, 1);
+  }
+  if (status < 0) {
+    __atomic_store_n(&collector->failed, 1, __ATOMIC_RELAXED);
+  }
+  free(word.codes);
+}
+
+// Read the words of the corpus into words. Return 0 on failure.
+int collectWords(const char *path, ByteArray *words) {
+  InputScanner corpus;
+  WordCollector collector;
+  int numWorkers = workerCount();
+  int w;
+
+  if (!openCorpus(&corpus, path)) {
+    return 0;
+  }
+  collector.corpus = &corpus;
+  collector.words = calloc(numWorkers, sizeof(ByteArray));
+  collector.failed = 0;
+  runParallel(collectWordsTask, &collector, numWorkers);
+  for (w = 0; w < numWorkers; w++) {
+    if (collector.words[w].length > 0) {
+      byteArrayAppend(words, collector.words[w].bytes, collector.words[w].length);
+    }
+    free(collector.words[w].bytes);
+  }
+  free(collector.words);
+  scannerClose(&corpus);
+  if (collector.failed) {
+    free(words->bytes);
+    memset(words, 0, sizeof(*words));
+    return 0;
+  }
+  return 1;
+}
+
+// Node of the trie while it is built: the range of sorted words that
+// start with its prefix, the length of the prefix and the node's children
+typedef struct {
+  int begin;
+  int end;
+  int depth;
+  int firstChild;
+  int numChildren;
+} TrieBuildNode;
+
+int compareTrieWords(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Position of the k-th 0 bit (from 0) of the trie's bit vector
+long long trieSelectZero(const Trie *trie, long long k) {
+  int low = 0;
+  int high = trie->loudsWords - 1;
+  Bitset zeros;
+  long long rank;
+
+  // Last word with at most k zeros before it
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    if (trie->zerosBefore[middle] <= k) {
+      low = middle;
+    }
+    else {
+      high = middle - 1;
+    }
+  }
+  zeros = ~trie->louds[low];
+  for (rank = k - trie->zerosBefore[low]; rank > 0; rank--) {
+    zeros &= zeros - 1;
+  }
+  return (long long)low * 64 + __builtin_ctzll(zeros);
+}
+
+// First child and number of children of the node
+void trieChildren(const Trie *trie, int node, int *firstChild, int *numChildren) {
+  long long start = node > 0 ? trieSelectZero(trie, node - 1) + 1 : 0;
+  long long end = trieSelectZero(trie, node);
+
+  // Every 1 before the node's is a child of an earlier node
+  *firstChild = (int)(start - node) + 1;
+  *numChildren = (int)(end - start);
+}
+
+// Build the trie of the distinct words of the corpus. Return 0 on failure.
+int buildTrie(const char *path, Trie *trie) {
+  ByteArray all = {NULL, 0, 0};
+  BinaryFeature features[MAX_FEATURES];
+  unsigned long long segmentItems[NUM_SEGMENT_CODES];
+  unsigned int allItems;
+  TrieSummary *summaries;
+  int *slots;
+  TrieBuildNode *nodes = NULL;
+  char **words;
+  long long numLines = 0;
+  long long bit = 0;
+  int capacity = 0;
+  int numItems;
+  size_t position;
+  int w;
+  int v;
+
+  memset(trie, 0, sizeof(*trie));
+  if (!collectWords(path, &all)) {
+    return 0;
+  }
+
+  // Sort the words, keeping one of each
+  for (position = 0; position < all.length; position++) {
+    numLines += all.bytes[position] == 0;
+  }
+  words = malloc(sizeof(char *) * (numLines + 1));
+  for (position = 0; position < all.length; position += strlen(all.bytes + position) + 1) {
+    words[trie->numWords++] = all.bytes + position;
+  }
+  qsort(words, trie->numWords, sizeof(char *), compareTrieWords);
+  for (numLines = trie->numWords, trie->numWords = 0, w = 0; w < numLines; w++) {
+    if (trie->numWords == 0 || strcmp(words[trie->numWords - 1], words[w]) != 0) {
+      words[trie->numWords++] = words[w];
+      trie->numSegments += strlen(words[w]);
+    }
+  }
+
+  // Nodes level by level: the children of a node are the runs of its words
+  // with the same next code, after the word that ends at the node if any
+  capacity = 1024;
+  nodes = malloc(sizeof(TrieBuildNode) * capacity);
+  nodes[0].begin = 0;
+  nodes[0].end = trie->numWords;
+  nodes[0].depth = 0;
+  trie->numNodes = 1;
+  trie->terminal = calloc(BITSET_WORDS(capacity), sizeof(Bitset));
+  trie->labels = malloc(capacity);
+  trie->labels[0] = 0;
+  for (v = 0; v < trie->numNodes; v++) {
+    int depth = nodes[v].depth;
+    int begin = nodes[v].begin;
+    int end = nodes[v].end;
+
+    if (begin < end && words[begin][depth] == '\0') {
+      trie->terminal[v / 64] |= 1ULL << (v % 64);
+      trie->maxLength = depth > trie->maxLength ? depth : trie->maxLength;
+      begin++;
+    }
+    nodes[v].firstChild = trie->numNodes;
+    nodes[v].numChildren = 0;
+    while (begin < end) {
+      char code = words[begin][depth];
+      int next = begin + 1;
+      while (next < end && words[next][depth] == code) {
+        next++;
+      }
+      if (trie->numNodes == capacity) {
+        capacity *= 2;
+        nodes = realloc(nodes, sizeof(TrieBuildNode) * capacity);
+        trie->labels = realloc(trie->labels, capacity);
+        trie->terminal = realloc(trie->terminal, sizeof(Bitset) * BITSET_WORDS(capacity));
+        memset(trie->terminal + BITSET_WORDS(capacity) / 2, 0,
+               sizeof(Bitset) * BITSET_WORDS(capacity) / 2);
+      }
+      nodes[trie->numNodes].begin = begin;
+      nodes[trie->numNodes].end = next;
+      nodes[trie->numNodes].depth = depth + 1;
+      trie->labels[trie->numNodes++] = (unsigned char)code;
+      nodes[v].numChildren++;
+      begin = next;
+    }
+  }
+  free(words);
+  free(all.bytes);
+
+  // The bit vector, and the number of 0 bits before each of its words
+  trie->loudsWords = (int)BITSET_WORDS(2LL * trie->numNodes - 1);
+  trie->louds = calloc(trie->loudsWords, sizeof(Bitset));
+  trie->zerosBefore = malloc(sizeof(unsigned int) * trie->loudsWords);
+  for (v = 0; v < trie->numNodes; v++) {
+    long long ones;
+    for (ones = 0; ones < nodes[v].numChildren; ones++, bit++) {
+      trie->louds[bit / 64] |= 1ULL << (bit % 64);
+    }
+    bit++;
+  }
+  for (w = 0, bit = 0; w < trie->loudsWords; w++) {
+    trie->zerosBefore[w] = (unsigned int)bit;
+    bit += 64 - __builtin_popcountll(trie->louds[w]);
+  }
+
+  // Summaries, children before their parents, each numbered once through
+  // a hash table
+  numItems = featureItems(features, segmentItems);
+  allItems = numItems < 32 ? (1U << numItems) - 1 : ~0U;
+  summaries = malloc(sizeof(TrieSummary) * trie->numNodes);
+  slots = malloc(sizeof(int) * 2 * MAX_TRIE_SUMMARIES);
+  memset(slots, -1, sizeof(int) * 2 * MAX_TRIE_SUMMARIES);
+  trie->summaryOf = malloc(sizeof(unsigned short) * trie->numNodes);
+  trie->summaries = malloc(sizeof(TrieSummary) * MAX_TRIE_SUMMARIES);
+  trie->summaries[0].shared = 0;
+  trie->summaries[0].present = allItems;
+  trie->numSummaries = 1;
+  for (v = trie->numNodes - 1; v >= 0; v--) {
+    TrieSummary *summary = &summaries[v];
+    unsigned int slot;
+    int child;
+
+    summary->shared = allItems;
+    summary->present = 0;
+    for (child = nodes[v].firstChild;
+         child < nodes[v].firstChild + nodes[v].numChildren; child++) {
+      unsigned int items = (unsigned int)segmentItems[trie->labels[child]];
+      summary->shared &= items & summaries[child].shared;
+      summary->present |= items | summaries[child].present;
+    }
+
+    slot = (summary->shared * 2654435761U ^ summary->present * 40503U) %
+           (2 * MAX_TRIE_SUMMARIES);
+    while (slots[slot] >= 0 &&
+           (trie->summaries[slots[slot]].shared != summary->shared ||
+            trie->summaries[slots[slot]].present != summary->present)) {
+      slot = (slot + 1) % (2 * MAX_TRIE_SUMMARIES);
+    }
+    if (slots[slot] < 0 && trie->numSummaries < MAX_TRIE_SUMMARIES) {
+      slots[slot] = trie->numSummaries;
+      trie->summaries[trie->numSummaries++] = *summary;
+    }
+    trie->summaryOf[v] = (unsigned short)(slots[slot] >= 0 ? slots[slot] : 0);
+  }
+  free(summaries);
+  free(slots);
+  free(nodes);
+  return 1;
+}
+
+void freeTrie(Trie *trie) {
+  free(trie->louds);
+  free(trie->zerosBefore);
+  free(trie->labels);
+  free(trie->terminal);
+  free(trie->summaryOf);
+  free(trie->summaries);
+}
+
+// Bytes of the trie, and an estimate for the same words as the keys of a
+// hash map: a 16-byte slot (pointer and hash) per word at a load of 3/4,
+// and each word in its own heap block (a 16-byte header, then its codes
+// and their end, rounded up to 16 bytes)
+long long trieBytes(const Trie *trie) {
+  return (long long)trie->loudsWords * (sizeof(Bitset) + sizeof(unsigned int)) +
+         (long long)trie->numNodes * (1 + sizeof(unsigned short)) +
+         (long long)BITSET_WORDS(trie->numNodes) * sizeof(Bitset) +
+         (long long)trie->numSummaries * sizeof(TrieSummary);
+}
+
+long long hashMapBytes(const Trie *trie) {
+  // Each block is at least 16 + (length + 1) bytes, and on average 8 more
+  return trie->numWords * (16LL * 4 / 3 + 16 + 1 + 8) + trie->numSegments;
+}
+
+typedef struct {
+  const Trie *trie;
+  const Pattern *pattern;
+  SegmentClass rest;            // Class of the segments after the pattern
+  unsigned long long restItems;
+  int restItemsOnly;
+  unsigned long long segmentItems[NUM_SEGMENT_CODES];
+  Word word;                    // Codes of the path to the current node
+  int format;
+  long long matches;
+  unsigned long long shared;    // Items of every segment after the pattern
+  int sharedSegments;
+} TrieQuery;
+
+void outputTrieWord(TrieQuery *query) {
+  const Word *word = &query->word;
+  int i;
+
+  for (i = query->pattern->length; i < word->length; i++) {
+    query->shared &= query->segmentItems[word->codes[i]];
+    query->sharedSegments = 1;
+  }
+  query->matches++;
+  if (query->format == FORMAT_BINARY) {
+    // The codes of the word, then 0
+    outputBytes((const char *)word->codes, word->length);
+    outputBytes("", 1);
+    return ;
+  }
+  outputString(query->format == FORMAT_JSONL ? "{\"word\":\"" : "");
+  outputSymbols(word, 0, word->length, " ");
+  outputString(query->format == FORMAT_JSONL ? "\"}\n" : "\n");
+}
+
+// Write the words below the node, whose prefix is the first depth codes of
+// the query's word, that match the pattern and then the rest class. If
+// check is 0, every word below the node is known to match.
+void trieSearch(TrieQuery *query, int node, int depth, int check) {
+  const Trie *trie = query->trie;
+  const Pattern *pattern = query->pattern;
+  const TrieSummary *summary = &trie->summaries[trie->summaryOf[node]];
+  int firstChild;
+  int numChildren;
+  int child;
+  int k;
+
+  query->word.length = depth;
+  if (depth >= pattern->length && (trie->terminal[node / 64] >> (node % 64) & 1)) {
+    outputTrieWord(query);
+  }
+  if (depth >= pattern->length && pattern->anchorEnd) {
+    return ;
+  }
+
+  // The segment of every later class of the pattern, and every segment
+  // after it, is below the node
+  if (check) {
+    for (k = depth; k < pattern->length; k++) {
+      if (pattern->itemsOnly[k] &&
+          (summary->present & pattern->items[k]) != pattern->items[k]) {
+        return ;
+      }
+    }
+    if (depth >= pattern->length && query->restItemsOnly) {
+      if ((summary->shared & query->restItems) == query->restItems) {
+        check = 0;
+      }
+      else if ((summary->present & query->restItems) != query->restItems) {
+        return ;
+      }
+    }
+  }
+
+  trieChildren(trie, node, &firstChild, &numChildren);
+  for (child = firstChild; child < firstChild + numChildren; child++) {
+    int code = trie->labels[child];
+    SegmentClass class = depth < pattern->length ? pattern->classes[depth]
+                                                 : query->rest;
+    if (check && (class >> code & 1) == 0) {
+      continue;
+    }
+    query->word.codes[depth] = (unsigned char)code;
+    trieSearch(query, child, depth + 1, check);
+  }
+}
+
+// Build the trie of the corpus, and write its size or the words that
+// start with the prefix pattern and continue with segments of the rest
+// class. Return 0 on success.
+int runTrie(const char *path, const char *prefix, const char *rest, int format) {
+  BinaryFeature features[MAX_FEATURES];
+  Pattern pattern;
+  Pattern restPattern;
+  TrieQuery query;
+  Trie trie;
+  int numItems;
+
+  memset(&query, 0, sizeof(query));
+  if (!parsePattern(prefix != NULL ? prefix : "", &pattern) ||
+      !parsePattern(rest != NULL ? rest : ".", &restPattern)) {
+    return 1;
+  }
+  if (restPattern.length != 1) {
+    fprintf(stderr, "--rest needs one segment class, e.g. [Voiced]\n");
+    return 1;
+  }
+  if (!buildTrie(path, &trie)) {
+    return 1;
+  }
+
+  if (format == FORMAT_TEXT) {
+    outputInt(trie.numWords);
+    outputString(" words, ");
+    outputInt(trie.numNodes);
+    outputString(" nodes, ");
+    outputInt(trieBytes(&trie));
+    outputString(" bytes (about ");
+    outputInt(hashMapBytes(&trie));
+    outputString(" for the words in a hash map)\n");
+  }
+  else if (prefix == NULL && rest == NULL && format != FORMAT_BINARY) {
+    outputString(format == FORMAT_JSONL ? "{\"words\":" : "words,nodes,bytes,hash_map_bytes\n");
+    outputInt(trie.numWords);
+    outputString(format == FORMAT_JSONL ? ",\"nodes\":" : ",");
+    outputInt(trie.numNodes);
+    outputString(format == FORMAT_JSONL ? ",\"bytes\":" : ",");
+    outputInt(trieBytes(&trie));
+    outputString(format == FORMAT_JSONL ? ",\"hashMapBytes\":" : ",");
+    outputInt(hashMapBytes(&trie));
+    outputString(format == FORMAT_JSONL ? "}\n" : "\n");
+  }
+
+  if (prefix != NULL || rest != NULL) {
+    if (format == FORMAT_CSV) {
+      outputString("word\n");
+    }
+    numItems = featureItems(features, query.segmentItems);
+    query.trie = &trie;
+    query.pattern = &pattern;
+    query.rest = restPattern.classes[0];
+    query.restItems = restPattern.items[0];
+    query.restItemsOnly = restPattern.itemsOnly[0];
+    query.word.codes = malloc(trie.maxLength + 1);
+    query.word.capacity = trie.maxLength + 1;
+    query.format = format;
+    query.shared = ~0ULL;
+    trieSearch(&query, 0, 0, 1);
+    if (format == FORMAT_TEXT) {
+      outputInt(query.matches);
+      outputString(" words match");
+      if (query.matches > 0 && query.sharedSegments) {
+        outputString("; every segment after the prefix has: ");
+        if ((query.shared & ((1ULL << numItems) - 1)) == 0) {
+          outputString("no common value");
+        }
+        outputItems(features, numItems, query.shared, FORMAT_TEXT);
+      }
+      outputString("\n");
+    }
+    free(query.word.codes);
+  }
+  outputFlush();
+  freeTrie(&trie);
+  return 0;
+}
+
+//===================================================================//
+//========================= Positional Index ========================//
+//===================================================================//
+// A persistent index of the words of a corpus for pattern search (see
+// Pattern Search): for every segment code, the words that have it at each
+// of the first INDEX_POSITIONS positions, at each of the last ones, and
+// anywhere. The numbers of the words of each key are compressed as in
+// Roaring bitmaps: split by their high 16 bits into containers, each a
+// sorted array of the low 16 bits if it has at most INDEX_ARRAY_MAX of
+// them, or else a bitmap of 65536 bits. A query ORs the containers of the
+// codes of each class and ANDs those of the classes, 65536 words at a
+// time, and checks the remaining words with the Shift-And automaton, the
+// codes of the words being in the index too.
+// Index file, in the byte order of the machine that wrote it, every part
+// starting at a multiple of 8 bytes:
+//  - "CFIX", the version (4 bytes), the number of words, of segments and
+//    of containers, and the bytes of container data (8 bytes each)
+//  - the first container of each key, INDEX_KEYS + 1 8-byte numbers
+//  - the containers: high 16 bits and number of words (4 bytes each), and
+//    the offset of the container's data (8 bytes)
+//  - where the segments of each word start, numWords + 1 8-byte offsets
+//  - the code of every segment, 1 byte each
+//  - the data of the containers, 2 bytes per word of an array, padded to
+//    8 bytes, and 8192 bytes per bitmap
+#define INDEX_VERSION 1
+#define INDEX_HEADER_SIZE 40
+#define INDEX_POSITIONS 8
+#define INDEX_ANYWHERE (2 * INDEX_POSITIONS)
+#define INDEX_KEYS ((INDEX_ANYWHERE + 1) * NUM_SEGMENT_CODES)
+#define INDEX_KEY(slot, code) ((slot) * NUM_SEGMENT_CODES + (code))
+#define INDEX_ARRAY_MAX 4096
+#define INDEX_CHUNK_WORDS (65536 / 64)
+
+typedef struct {
+  unsigned int high;
+  unsigned int count;
+  unsigned long long offset;
+} IndexContainer;
+
+typedef struct {
+  unsigned long long numWords;
+  unsigned long long numSegments;
+  unsigned long long numContainers;
+  unsigned long long dataBytes;
+  const unsigned long long *keyStart;
+  const IndexContainer *containers;
+  const unsigned long long *wordStart;
+  const unsigned char *codes;
+  const unsigned char *data;
+} PositionalIndex;
+
+#define ALIGN8(bytes) (((bytes) + 7) / 8 * 8)
+
+// Words of one key while the index is built, in increasing order
+typedef struct {
+  unsigned int *words;
+  long long count;
+  long long capacity;
+} Posting;
+
+void postingAdd(Posting *posting, unsigned int word) {
+  if (posting->count == posting->capacity) {
+    posting->capacity = posting->capacity > 0 ? 2 * posting->capacity : 64;
+    posting->words = realloc(posting->words, sizeof(unsigned int) * posting->capacity);
+  }
+  posting->words[posting->count++] = word;
+}
+
+// Build the index of the words of the corpus and write it. Return 0 on
+// failure.
+int buildIndex(const char *path, const char *indexPath) {
+  ByteArray words = {NULL, 0, 0};
+  ByteArray containers = {NULL, 0, 0};
+  ByteArray data = {NULL, 0, 0};
+  ByteArray wordStart = {NULL, 0, 0};
+  unsigned long long keyStart[INDEX_KEYS + 1];
+  unsigned long long header[4];
+  unsigned int version = INDEX_VERSION;
+  Posting *postings;
+  unsigned long long start;
+  unsigned int numWords = 0;
+  size_t position;
+  int status = 1;
+  int key;
+  FILE *file;
+
+  if (!collectWords(path, &words)) {
+    return 0;
+  }
+  postings = calloc(INDEX_KEYS, sizeof(Posting));
+  for (position = 0; position < words.length; numWords++) {
+    const unsigned char *codes = (const unsigned char *)words.bytes + position;
+    int length = (int)strlen(words.bytes + position);
+    unsigned long long present = 0;
+    int i;
+
+    start = position - numWords;
+    byteArrayAppend(&wordStart, &start, sizeof(start));
+    for (i = 0; i < length; i++) {
+      if (i < INDEX_POSITIONS) {
+        postingAdd(&postings[INDEX_KEY(i, codes[i])], numWords);
+      }
+      if (length - i <= INDEX_POSITIONS) {
+        postingAdd(&postings[INDEX_KEY(INDEX_POSITIONS + length - 1 - i, codes[i])],
+                   numWords);
+      }
+      present |= 1ULL << codes[i];
+    }
+    while (present != 0) {
+      postingAdd(&postings[INDEX_KEY(INDEX_ANYWHERE, __builtin_ctzll(present))],
+                 numWords);
+      present &= present - 1;
+    }
+    position += length + 1;
+  }
+  start = words.length - numWords;
+  byteArrayAppend(&wordStart, &start, sizeof(start));
+
+  // Containers of every key
+  for (key = 0; key < INDEX_KEYS; key++) {
+    const Posting *posting = &postings[key];
+    long long begin = 0;
+
+    keyStart[key] = containers.length / sizeof(IndexContainer);
+    while (begin < posting->count) {
+      IndexContainer container;
+      long long end = begin;
+      container.high = posting->words[begin] >> 16;
+      while (end < posting->count && posting->words[end] >> 16 == container.high) {
+        end++;
+      }
+      container.count = (unsigned int)(end - begin);
+      container.offset = data.length;
+      if (container.count <= INDEX_ARRAY_MAX) {
+        unsigned short low;
+        unsigned long long padding = 0;
+        long long w;
+        for (w = begin; w < end; w++) {
+          low = (unsigned short)posting->words[w];
+          byteArrayAppend(&data, &low, sizeof(low));
+        }
+        byteArrayAppend(&data, &padding, ALIGN8(data.length) - data.length);
+      }
+      else {
+        Bitset bitmap[INDEX_CHUNK_WORDS];
+        long long w;
+        memset(bitmap, 0, sizeof(bitmap));
+        for (w = begin; w < end; w++) {
+          bitmap[(posting->words[w] & 0xFFFF) / 64] |= 1ULL << (posting->words[w] % 64);
+        }
+        byteArrayAppend(&data, bitmap, sizeof(bitmap));
+      }
+      byteArrayAppend(&containers, &container, sizeof(container));
+      begin = end;
+    }
+    free(posting->words);
+  }
+  keyStart[INDEX_KEYS] = containers.length / sizeof(IndexContainer);
+  free(postings);
+
+  header[0] = numWords;
+  header[1] = words.length - numWords;
+  header[2] = keyStart[INDEX_KEYS];
+  header[3] = data.length;
+  file = fopen(indexPath, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot write %s\n", indexPath);
+    status = 0;
+  }
+  else {
+    unsigned long long padding = 0;
+    fwrite("CFIX", 1, 4, file);
+    fwrite(&version, sizeof(version), 1, file);
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(keyStart, sizeof(keyStart), 1, file);
+    fwrite(containers.bytes, 1, containers.length, file);
+    fwrite(wordStart.bytes, 1, wordStart.length, file);
+    // The codes, without the end of each word
+    for (position = 0; position < words.length; position += strlen(words.bytes + position) + 1) {
+      fwrite(words.bytes + position, 1, strlen(words.bytes + position), file);
+    }
+    fwrite(&padding, 1, ALIGN8(header[1]) - header[1], file);
+    fwrite(data.bytes, 1, data.length, file);
+    if (fclose(file) != 0) {
+      fprintf(stderr, "Cannot write %s\n", indexPath);
+      status = 0;
+    }
+    else {
+      outputInt((long long)header[0]);
+      outputString(" words, ");
+      outputInt((long long)header[2]);
+      outputString(" containers, ");
+      outputInt((long long)header[3]);
+      outputString(" bytes of postings written to ");
+      outputString(indexPath);
+      outputString("\n");
+      outputFlush();
+    }
+  }
+
+  free(words.bytes);
+  free(containers.bytes);
+  free(data.bytes);
+  free(wordStart.bytes);
+  return status;
+}
+
+// View the bytes as an index. Return 0 (after reporting) if they are not
+// a valid one.
+int indexView(const char *bytes, size_t length, PositionalIndex *index) {
+  unsigned int version;
+  unsigned long long counts[4];
+  unsigned long long size;
+  unsigned long long i;
+  unsigned long long c;
+  const char *part;
+
+  memset(index, 0, sizeof(*index));
+  if (length < INDEX_HEADER_SIZE || memcmp(bytes, "CFIX", 4) != 0) {
+    fprintf(stderr, "Not an index (see --index)\n");
+    return 0;
+  }
+  memcpy(&version, bytes + 4, sizeof(version));
+  memcpy(counts, bytes + 8, sizeof(counts));
+  // Bound each count by the length first, so that the size cannot overflow
+  if (version != INDEX_VERSION || counts[0] >= length / 8 || counts[1] > length ||
+      counts[2] > length / sizeof(IndexContainer) || counts[3] > length) {
+    fprintf(stderr, "Damaged or incompatible index\n");
+    return 0;
+  }
+  size = INDEX_HEADER_SIZE + 8 * (INDEX_KEYS + 1) + sizeof(IndexContainer) * counts[2] +
+         8 * (counts[0] + 1) + ALIGN8(counts[1]) + counts[3];
+  if (size != length) {
+    fprintf(stderr, "Damaged or incompatible index\n");
+    return 0;
+  }
+
+  index->numWords = counts[0];
+  index->numSegments = counts[1];
+  index->numContainers = counts[2];
+  index->dataBytes = counts[3];
+  part = bytes + INDEX_HEADER_SIZE;
+  index->keyStart = (const unsigned long long *)part;
+  part += 8 * (INDEX_KEYS + 1);
+  index->containers = (const IndexContainer *)part;
+  part += sizeof(IndexContainer) * counts[2];
+  index->wordStart = (const unsigned long long *)part;
+  part += 8 * (counts[0] + 1);
+  index->codes = (const unsigned char *)part;
+  index->data = index->codes + ALIGN8(counts[1]);
+  if (index->keyStart[0] != 0 || index->keyStart[INDEX_KEYS] != counts[2] ||
+      index->wordStart[0] != 0 || index->wordStart[counts[0]] != counts[1]) {
+    fprintf(stderr, "Damaged or incompatible index\n");
+    return 0;
+  }
+
+  // The containers of each key, in order of their high bits, with their
+  // data inside that of the index
+  for (i = 0; i < INDEX_KEYS; i++) {
+    if (index->keyStart[i] > index->keyStart[i + 1]) {
+      fprintf(stderr, "Damaged index: the containers of key %llu are out of order\n", i);
+      return 0;
+    }
+    for (c = index->keyStart[i]; c < index->keyStart[i + 1]; c++) {
+      const IndexContainer *container = &index->containers[c];
+      unsigned long long dataSize = container->count <= INDEX_ARRAY_MAX
+                                 ? 2ULL * container->count : 8 * INDEX_CHUNK_WORDS;
+      if (container->count == 0 || container->count > 65536 ||
+          container->offset % 8 != 0 || container->offset > counts[3] ||
+          dataSize > counts[3] - container->offset ||
+          (c > index->keyStart[i] && container[-1].high >= container->high)) {
+        fprintf(stderr, "Damaged index: container %llu is out of place\n", c);
+        return 0;
+      }
+    }
+  }
+
+  // The segments of each word, in order, each word short enough for an int
+  for (i = 0; i < counts[0]; i++) {
+    if (index->wordStart[i] > index->wordStart[i + 1] ||
+        index->wordStart[i + 1] - index->wordStart[i] > INT_MAX) {
+      fprintf(stderr, "Damaged index: the segments of word %llu are out of order\n", i);
+      return 0;
+    }
+  }
+  return segmentCodesValid(index->codes, index->numSegments);
+}
+
+// Container of the key for the words with these high 16 bits, NULL if none
+const IndexContainer *indexContainer(const PositionalIndex *index, int key,
+                                     unsigned int high) {
+  unsigned long long low = index->keyStart[key];
+  unsigned long long end = index->keyStart[key + 1];
+
+  while (low < end) {
+    unsigned long long middle = (low + end) / 2;
+    if (index->containers[middle].high < high) {
+      low = middle + 1;
+    }
+    else {
+      end = middle;
+    }
+  }
+  if (low < index->keyStart[key + 1] && index->containers[low].high == high) {
+    return &index->containers[low];
+  }
+  return NULL;
+}
+
+// OR the words of the container into the bitmap of its 65536 words
+void orContainer(const PositionalIndex *index, const IndexContainer *container,
+                 Bitset bitmap[]) {
+  const unsigned char *data = index->data + container->offset;
+  unsigned int i;
+
+  if (container->count <= INDEX_ARRAY_MAX) {
+    const unsigned short *words = (const unsigned short *)data;
+    for (i = 0; i < container->count; i++) {
+      bitmap[words[i] / 64] |= 1ULL << (words[i] % 64);
+    }
+  }
+  else {
+    const Bitset *words = (const Bitset *)data;
+    for (i = 0; i < INDEX_CHUNK_WORDS; i++) {
+      bitmap[i] |= words[i];
+    }
+  }
+}
+
+// Find the words of the index that have the pattern, writing them if list
+// is not 0. Return their number.
+long long indexSearch(const PositionalIndex *index, const Pattern *pattern,
+                      int format, int list) {
+  ShiftAnd automaton;
+  Bitset candidates[INDEX_CHUNK_WORDS];
+  Bitset classWords[INDEX_CHUNK_WORDS];
+  int slots[2 * MAX_PATTERN];
+  SegmentClass classes[2 * MAX_PATTERN];
+  SegmentClass all = kindClass(-1);
+  int numConstraints = 0;
+  long long matches = 0;
+  unsigned int high;
+  int exact;
+  int i;
+
+  // A class constrains the words at its position from the start or the
+  // end if the pattern is anchored there and it is close enough, and else
+  // only the words that have one of its segments anywhere. If the pattern
+  // is anchored at one end only and every class is at its position, the
+  // candidates are exactly the words that match.
+  compileShiftAnd(pattern, &automaton);
+  exact = pattern->anchorStart != pattern->anchorEnd &&
+          pattern->length > 0 && pattern->length <= INDEX_POSITIONS;
+  for (i = 0; i < pattern->length; i++) {
+    int fromEnd = pattern->length - 1 - i;
+    int anywhere = 1;
+    if ((pattern->classes[i] & all) == all && !exact) {
+      continue;
+    }
+    if (pattern->anchorStart && i < INDEX_POSITIONS) {
+      slots[numConstraints] = i;
+      classes[numConstraints++] = pattern->classes[i];
+      anywhere = 0;
+    }
+    if (pattern->anchorEnd && fromEnd < INDEX_POSITIONS) {
+      slots[numConstraints] = INDEX_POSITIONS + fromEnd;
+      classes[numConstraints++] = pattern->classes[i];
+      anywhere = 0;
+    }
+    if (anywhere) {
+      slots[numConstraints] = INDEX_ANYWHERE;
+      classes[numConstraints++] = pattern->classes[i];
+    }
+  }
+
+  for (high = 0; (unsigned long long)high << 16 < index->numWords; high++) {
+    unsigned long long first = (unsigned long long)high << 16;
+    int c;
+    int w;
+
+    memset(candidates, 0xFF, sizeof(candidates));
+    for (c = 0; c < numConstraints; c++) {
+      SegmentClass codes = classes[c];
+      Bitset any = 0;
+      memset(classWords, 0, sizeof(classWords));
+      while (codes != 0) {
+        const IndexContainer *container =
+            indexContainer(index, INDEX_KEY(slots[c], __builtin_ctzll(codes)), high);
+        if (container != NULL) {
+          orContainer(index, container, classWords);
+        }
+        codes &= codes - 1;
+      }
+      for (w = 0; w < INDEX_CHUNK_WORDS; w++) {
+        candidates[w] &= classWords[w];
+        any |= candidates[w];
+      }
+      if (any == 0) {
+        break;
+      }
+    }
+
+    if (exact && !list) {
+      for (w = 0; w < INDEX_CHUNK_WORDS && first + w * 64 < index->numWords; w++) {
+        matches += __builtin_popcountll(candidates[w]);
+      }
+      continue;
+    }
+    for (w = 0; w < INDEX_CHUNK_WORDS; w++) {
+      Bitset bits = candidates[w];
+      while (bits != 0) {
+        unsigned long long id = first + w * 64 + __builtin_ctzll(bits);
+        unsigned long long begin;
+        int length;
+        int last;
+        bits &= bits - 1;
+        if (id >= index->numWords) {
+          break;
+        }
+        begin = index->wordStart[id];
+        length = (int)(index->wordStart[id + 1] - begin);
+        last = shiftAndMatch(&automaton, index->codes + begin, length);
+        if (last < 0) {
+          continue;
+        }
+        matches++;
+        if (list) {
+          Word word;
+          MatchSpan span;
+          word.codes = (unsigned char *)index->codes + begin;
+          word.length = length;
+          span.offset = (long long)id;
+          span.start = last - automaton.length;
+          span.end = last;
+          outputMatch(format, &word, &span);
+        }
+      }
+    }
+  }
+  return matches;
+}
+
+// Answer the pattern, or every pattern of the standard input (one per
+// line) with the number of words that have it, from the index. Return 0
+// on success.
+int runIndexSearch(const char *indexPath, const char *text, int format) {
+  InputScanner file;
+  InputScanner queries;
+  PositionalIndex index;
+  Pattern pattern;
+  ByteArray line = {NULL, 0, 0};
+  unsigned char count[8];
+  size_t position = 0;
+  long long numQueries = 0;
+  long long matches;
+  int status = 0;
+
+  if (!scannerOpen(&file, indexPath)) {
+    return 1;
+  }
+  if (!scannerReadAll(&file) || !indexView(file.data, file.length, &index)) {
+    scannerClose(&file);
+    return 1;
+  }
+
+  if (text != NULL) {
+    if (!parsePattern(text, &pattern)) {
+      scannerClose(&file);
+      return 1;
+    }
+    if (format == FORMAT_CSV) {
+      outputString("offset,word,start,end\n");
+    }
+    matches = indexSearch(&index, &pattern, format, 1);
+    if (format == FORMAT_TEXT) {
+      outputInt(matches);
+      outputString(" of ");
+      outputInt((long long)index.numWords);
+      outputString(" words match\n");
+    }
+    outputFlush();
+    scannerClose(&file);
+    return 0;
+  }
+
+  if (format == FORMAT_CSV) {
+    outputString("query,matches\n");
+  }
+  if (!scannerOpen(&queries, NULL) || !scannerReadAll(&queries)) {
+    scannerClose(&file);
+    return 1;
+  }
+  while (position < queries.length && status == 0) {
+    size_t end = position;
+
+    while (end < queries.length && queries.data[end] != '\n') {
+      end++;
+    }
+    line.length = 0;
+    byteArrayAppend(&line, queries.data + position, end - position);
+    byteArrayAppend(&line, "", 1);
+    position = end + 1;
+    line.bytes[strcspn(line.bytes, "\r")] = '\0';
+    if (line.bytes[strspn(line.bytes, " \t")] == '\0') {
+      continue;
+    }
+    if (!parsePattern(line.bytes, &pattern)) {
+      status = 1;
+      break;
+    }
+
+    matches = indexSearch(&index, &pattern, format, 0);
+    numQueries++;
+    if (format == FORMAT_BINARY) {
+      putLittleEndian(count, (unsigned long long)matches, 8);
+      outputBytes((const char *)count, sizeof(count));
+    }
+    else if (format == FORMAT_JSONL) {
+      outputString("{\"query\":");
+      outputInt(numQueries);
+      outputString(",\"matches\":");
+      outputInt(matches);
+      outputString("}\n");
+    }
+    else if (format == FORMAT_CSV) {
+      outputInt(numQueries);
+      outputString(",");
+      outputInt(matches);
+      outputString("\n");
+    }
+    else {
+      outputString(line.bytes);
+      outputString(": ");
+      outputInt(matches);
+      outputString(" words\n");
+    }
+  }
+  outputFlush();
+  free(line.bytes);
+  scannerClose(&queries);
+  scannerClose(&file);
+  return status;
+}
+
+//===================================================================//
+//============================= Query Log ===========================//
+//===================================================================//
+// Binary log of the queries answered in batch mode (--log), to replay them
+// later (--replay). The file starts with "CFQL", a 4-byte version and the
+// 8-byte Unix time of the start, then has one record per query: the 8-byte
+// time in nanoseconds since the start at which it was read, its 4-byte
+// number of segments and kind, then its 4-byte segments, all little-endian.
+// Every thread appends its records to its own buffer without locking, and
+// writes the buffer whole with one fwrite when it is full and at the end.
+// The records of a thread stay in order, but those of different threads
+// are interleaved by buffers, so the replay sorts them by time.
+#define QUERY_LOG_VERSION 1
+#define QUERY_LOG_HEADER_SIZE 16
+#define QUERY_LOG_RECORD_SIZE 16
+#define QUERY_LOG_BUFFER_SIZE (1 << 16)
+
+typedef struct QueryLogBuffer {
+  unsigned char bytes[QUERY_LOG_BUFFER_SIZE];
+  size_t length;
+  struct QueryLogBuffer *next;    // Buffer of another thread
+} QueryLogBuffer;
+
+typedef struct {
+  FILE *file;
+  const char *path;
+  unsigned long long start;
+  QueryLogBuffer *buffers;        // Of every thread that logged a query
+  int failed;                     // 1 if a write fell short
+} QueryLog;
+
+QueryLog queryLog;
+__thread QueryLogBuffer *threadLogBuffer;
+
+// Write the bytes to the log, noting a failure for closeQueryLog
+void writeQueryLog(const void *bytes, size_t size) {
+  if (fwrite(bytes, 1, size, queryLog.file) != size) {
+    __atomic_store_n(&queryLog.failed, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Start logging the queries to the file. Return 0 on failure.
+int openQueryLog(const char *path) {
+  unsigned char header[QUERY_LOG_HEADER_SIZE];
+
+  memset(&queryLog, 0, sizeof(queryLog));
+  queryLog.file = fopen(path, "wb");
+  if (queryLog.file == NULL) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    return 0;
+  }
+  queryLog.path = path;
+  queryLog.start = nowNanoseconds();
+  memcpy(header, "CFQL", 4);
+  putLittleEndian(header + 4, QUERY_LOG_VERSION, 4);
+  putLittleEndian(header + 8, (unsigned long long)time(NULL), 8);
+  writeQueryLog(header, sizeof(header));
+  return 1;
+}
+
+void flushQueryLogBuffer(QueryLogBuffer *buffer) {
+  if (buffer->length > 0) {
+    writeQueryLog(buffer->bytes, buffer->length);
+    buffer->length = 0;
+  }
+}
+
+// Record the query in the buffer of the thread, if the queries are logged
+void logQuery(const Query *query) {
+  QueryLogBuffer *buffer = threadLogBuffer;
+  size_t size = QUERY_LOG_RECORD_SIZE + 4 * (size_t)query->num;
+  unsigned char *record;
+  int i;
+
+  if (queryLog.file == NULL) {
+    return ;
+  }
+  if (buffer == NULL) {
+    // First query of the thread: add its buffer to the list
+    buffer = threadLogBuffer = calloc(1, sizeof(QueryLogBuffer));
+    buffer->next = __atomic_load_n(&queryLog.buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&queryLog.buffers, &buffer->next, buffer, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+  }
+  if (buffer->length + size > QUERY_LOG_BUFFER_SIZE) {
+    flushQueryLogBuffer(buffer);
+  }
+  // A record larger than the buffer is written on its own
+  record = size > QUERY_LOG_BUFFER_SIZE ? malloc(size) : buffer->bytes + buffer->length;
+  putLittleEndian(record, nowNanoseconds() - queryLog.start, 8);
+  putLittleEndian(record + 8, (unsigned int)query->num, 4);
+  putLittleEndian(record + 12, (unsigned int)query->consonantVowel, 4);
+  for (i = 0; i < query->num; i++) {
+    putLittleEndian(record + QUERY_LOG_RECORD_SIZE + 4 * i,
+                    (unsigned int)query->intArray[i], 4);
+  }
+  if (size > QUERY_LOG_BUFFER_SIZE) {
+    writeQueryLog(record, size);
+    free(record);
+  }
+  else {
+    buffer->length += size;
+  }
+}
+
+// Write what is left in the buffers and close the log, once every thread
+// that logged is done. Return 0 (after reporting) if it was not all written.
+int closeQueryLog(void) {
+  QueryLogBuffer *buffer = queryLog.buffers;
+  int status = 1;
+
+  if (queryLog.file == NULL) {
+    return 1;
+  }
+  while (buffer != NULL) {
+    QueryLogBuffer *next = buffer->next;
+    flushQueryLogBuffer(buffer);
+    free(buffer);
+    buffer = next;
+  }
+  if (fclose(queryLog.file) != 0 || queryLog.failed) {
+    fprintf(stderr, "Cannot write %s\n", queryLog.path);
+    status = 0;
+  }
+  memset(&queryLog, 0, sizeof(queryLog));
+  threadLogBuffer = NULL;
+  return status;
+}
+
+// A record of the log, by its time and position
+typedef struct {
+  unsigned long long time;
+  size_t offset;
+} QueryLogRecord;
+
+int compareQueryLogRecords(const void *a, const void *b) {
+  const QueryLogRecord *first = a;
+  const QueryLogRecord *second = b;
+
+  if (first->time != second->time) {
+    return first->time < second->time ? -1 : 1;
+  }
+  return first->offset < second->offset ? -1 : first->offset > second->offset;
+}
+
+// Records of the log (to free) in the order of their times. Return their
+// number, or -1 (after reporting) if the log is not valid.
+long long readQueryLog(const InputScanner *log, QueryLogRecord **records) {
+  const unsigned char *bytes = (const unsigned char *)log->data;
+  long long count = 0;
+  long long capacity = 0;
+  size_t offset = QUERY_LOG_HEADER_SIZE;
+
+  *records = NULL;
+  if (log->length < QUERY_LOG_HEADER_SIZE || memcmp(bytes, "CFQL", 4) != 0 ||
+      getLittleEndian(bytes + 4, 4) != QUERY_LOG_VERSION) {
+    fprintf(stderr, "Not a query log of version %d\n", QUERY_LOG_VERSION);
+    return -1;
+  }
+  while (offset < log->length) {
+    unsigned long long num;
+    if (log->length - offset < QUERY_LOG_RECORD_SIZE ||
+        (num = getLittleEndian(bytes + offset + 8, 4)) >
+            (log->length - offset - QUERY_LOG_RECORD_SIZE) / 4) {
+      fprintf(stderr, "Truncated query log at byte %zu\n", offset);
+      free(*records);
+      *records = NULL;
+      return -1;
+    }
+    if (count == capacity) {
+      capacity = capacity > 0 ? 2 * capacity : 4096;
+      *records = realloc(*records, sizeof(QueryLogRecord) * capacity);
+    }
+    (*records)[count].time = getLittleEndian(bytes + offset, 8);
+    (*records)[count].offset = offset;
+    count++;
+    offset += QUERY_LOG_RECORD_SIZE + 4 * num;
+  }
+  qsort(*records, count, sizeof(QueryLogRecord), compareQueryLogRecords);
+  return count;
+}
+
+// Query of the record at the offset of the log. Return 0 (after
+// reporting) if there is no memory for it.
+int queryLogQuery(const InputScanner *log, size_t offset, Query *query) {
+  const unsigned char *record = (const unsigned char *)log->data + offset;
+  int i;
+
+  query->num = (int)getLittleEndian(record + 8, 4);
+  query->consonantVowel = (int)getLittleEndian(record + 12, 4);
+  if (!queryReserve(query, query->num)) {
+    return 0;
+  }
+  for (i = 0; i < query->num; i++) {
+    query->intArray[i] = (int)getLittleEndian(record + QUERY_LOG_RECORD_SIZE + 4 * i, 4);
+  }
+  return 1;
+}
+
+// Wait until the time of nowNanoseconds(): sleep until a millisecond
+// before, since sleeps end late, then spin
+void waitUntil(unsigned long long deadline) {
+  unsigned long long now;
+
+  while ((now = nowNanoseconds()) < deadline) {
+    if (deadline - now > 2000000) {
+      struct timespec pause;
+      pause.tv_sec = (time_t)((deadline - now - 1000000) / 1000000000ULL);
+      pause.tv_nsec = (long)((deadline - now - 1000000) % 1000000000ULL);
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+//===================================================================//
+//============================ Statistics ===========================//
+//===================================================================//
+#ifdef FEATURE_STATS
+// Write the counters to the standard error
+void printStats(void) {
+  const double fractions[4] = {0.5, 0.9, 0.99, 0.999};
+  unsigned long long percentiles[4];
+  unsigned long long longest = __atomic_load_n(&statsLatencyMax, __ATOMIC_RELAXED);
+  int d;
+  int b;
+  int p;
+
+  fprintf(stderr, "dimension     calls      completed  early exits by position\n");
+  for (d = 0; d < NUM_DIMENSIONS; d++) {
+    fprintf(stderr, "%-12s %-10llu %-10llu", dimensionKeys[d],
+            statsCalls[d], statsCompleted[d]);
+    for (b = 0; b < STATS_BUCKETS; b++) {
+      if (statsExits[d][b] > 0) {
+        fprintf(stderr, " %llu:%llu", statsBucketValue(b), statsExits[d][b]);
+      }
+    }
+    fprintf(stderr, "\n");
+  }
+  // A percentile is the end of its bucket, at most the longest latency
+  for (p = 0; p < 4; p++) {
+    percentiles[p] = statsPercentile(statsLatency, fractions[p]);
+    if (percentiles[p] > longest) {
+      percentiles[p] = longest;
+    }
+  }
+  fprintf(stderr, "query latency (ns): p50 %llu, p90 %llu, p99 %llu, "
+          "p99.9 %llu, max %llu\n",
+          percentiles[0], percentiles[1], percentiles[2], percentiles[3], longest);
+  if (cacheLines > 0) {
+    printCacheStats();
+  }
+}
+
+void requestStats(int signalNumber) {
+  (void)signalNumber;
+  statsRequested = 1;
+}
+
+// Print the counters if they were requested with SIGUSR1
+void checkStatsRequest(void) {
+  if (statsRequested) {
+    statsRequested = 0;
+    printStats();
+  }
+}
+#else
+void checkStatsRequest(void) {
+}
+#endif
+
+#if defined(FEATURE_PERF) && defined(__linux__)
+// Write the counters per call of each dimension and size of query to the
+// standard error
+void printPerf(void) {
+  const char *sizes[PERF_SIZE_BUCKETS] = {
+    "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64", "65-128", "129+"
+  };
+  int d;
+  int b;
+  int e;
+
+  fprintf(stderr, "%-12s %-7s %-10s", "dimension", "size", "calls");
+  for (e = 0; e < PERF_EVENTS; e++) {
+    fprintf(stderr, " %13s", perfEvents[e].name);
+  }
+  fprintf(stderr, " %6s\n", "IPC");
+  for (d = 0; d < NUM_DIMENSIONS; d++) {
+    for (b = 0; b < PERF_SIZE_BUCKETS; b++) {
+      unsigned long long calls = perfCalls[d][b];
+      if (calls == 0) {
+        continue;
+      }
+      fprintf(stderr, "%-12s %-7s %-10llu", dimensionKeys[d], sizes[b], calls);
+      for (e = 0; e < PERF_EVENTS; e++) {
+        if (perfAvailable[e]) {
+          fprintf(stderr, " %13.2f", (double)perfCounts[d][b][e] / calls);
+        }
+        else {
+          fprintf(stderr, " %13s", "-");
+        }
+      }
+      fprintf(stderr, " %6.2f\n", perfCounts[d][b][0] > 0
+                                      ? (double)perfCounts[d][b][1] / perfCounts[d][b][0]
+                                      : 0.0);
+    }
+  }
+  if (perfFailures > 0) {
+    fprintf(stderr, "The counters of %d threads could not be opened: their queries "
+            "are not counted\n", perfFailures);
+  }
+}
+#endif
+
+//==================================================================//
+//============================== Main ==============================//
+//===================================================================//
+void printUsage(FILE *stream) {
+  fprintf(stream,
+          "Usage: commonFeature [options]\n"
+          "  Without options, the questions are asked interactively.\n"
+          "  --format text|jsonl|csv|binary\n"
+          "      Read queries from the standard input until the end of file,\n"
+          "      each as: <num> <segment>... <0|1>, where a segment is its\n"
+          "      assigned number or its IPA symbol.\n"
+          "  --engine reference|table\n"
+          "      Answer with the helper functions or the feature table (default).\n"
+          "  --explain\n"
+          "      For every dimension, also report the value most segments\n"
+          "      share, how many share it and the segments that do not.\n"
+          "  --threshold <fraction>\n"
+          "      Instead of the common features, report every value shared by\n"
+          "      at least this fraction (e.g. 0.9) of the segments, with its\n"
+          "      support.\n"
+          "  --cache <entries>\n"
+          "      Answer repeated queries, in any order and with duplicates, from\n"
+          "      a cache of this many entries; the hits and misses are printed\n"
+          "      at the end.\n"
+          "  --log <file>\n"
+          "      Record every query of the batch mode, and the time it was\n"
+          "      read, in a binary query log.\n"
+          "  --replay <file> [--replay-rate max|recorded]\n"
+          "      Answer the queries of a log, as fast as possible (max) or at\n"
+          "      the times they were read, and print the throughput and the\n"
+          "      latency percentiles.\n"
+          "  --serve [host:]port\n"
+          "      Answer the queries of TCP clients, one request per line, in\n"
+          "      --format (text), with one event loop per worker until SIGINT\n"
+          "      or SIGTERM (on localhost unless a host is given; POSIX only).\n"
+          "  --profile standard|split|w-bilabial|cot-caught|<file>\n"
+          "      Split, merge or change segments of the feature table for a\n"
+          "      dialect before answering (with the table engine only).\n"
+          "  --verify [length]\n"
+          "      Compare the table engine against the helper functions on every\n"
+          "      sequence of up to length (4, at most 12) segments, every subset\n"
+          "      and random multisets.\n"
+          "  --random <count>   Number of random multisets to verify (1000000)\n"
+          "  --seed <seed>      Seed of the random multisets\n"
+          "  --cooccurrence <corpus>\n"
+          "      Count how often each feature value follows another in the\n"
+          "      corpus (one word of IPA symbols per line, - for the standard\n"
+          "      input), written in --format (text).\n"
+          "  --syllabify <corpus>\n"
+          "      Split every word into syllables by sonority and the maximal\n"
+          "      onset principle, with the common features of each onset and\n"
+          "      coda, reading the corpus in constant memory.\n"
+          "  --ngram <corpus> [--ngram-order <n>] [--model <file>]\n"
+          "      Train an n-gram model (order 3) of feature classes on the\n"
+          "      corpus, and save it to the model file.\n"
+          "  --score <words> [--model <file>]\n"
+          "      Score every word by its log2 probability under the model.\n"
+          "  --economy <inventory>\n"
+          "      Find the smallest set of dimensions and of feature values that\n"
+          "      tells every segment of the inventory apart (consonants, vowels,\n"
+          "      all, or a file with one segment per line).\n"
+          "  --hierarchy <inventory> [--order <dimension,...>|all]\n"
+          "      Contrastive specification of every segment by successive\n"
+          "      division in the order of the dimensions, or the ranking of\n"
+          "      every ordering by depth and redundancy (all, the default).\n"
+          "  --cluster <inventory> [--linkage average|complete|single]\n"
+          "      Cluster the segments by the number of features that tell them\n"
+          "      apart, and write the dendrogram (Newick in text format).\n"
+          "  --compare <languages> [--segments <inventory>]\n"
+          "      Compare every pair of languages, one per line (a name, then\n"
+          "      the symbols of its segments in the inventory, all by default),\n"
+          "      by the Jaccard similarity of their segments and features.\n"
+          "  --universals <languages> [--segments <inventory>]\n"
+          "               [--min-support <fraction|count>] [--min-confidence <c>]\n"
+          "      Find every implication between the feature values and segments\n"
+          "      of the languages (\"with X, also Y\", \"with X and Y, also Z\"),\n"
+          "      ranked by confidence (0.9) and support (0.01).\n"
+          "  --cmudict <dictionary> --lexicon <file>\n"
+          "      Import a CMU Pronouncing Dictionary (ARPAbet, with stress) into\n"
+          "      a binary lexicon, usable wherever a corpus is.\n"
+          "  --itemsets <file> [--min-support <fraction|count>]\n"
+          "      Mine the combinations of feature values shared by at least\n"
+          "      the support (0.01) of the sets of segments, one set per line.\n"
+          "  --match <pattern> [--corpus <corpus>]\n"
+          "      List the words of the corpus (the standard input by default)\n"
+          "      that have the pattern of segment classes, e.g.\n"
+          "      \"[Nasal][Stop & Voiceless]\" or \"^V[Alveolar]V\".\n"
+          "  --index <corpus> --index-file <file>\n"
+          "      Write a positional index of the words of the corpus.\n"
+          "  --index-file <file> [--match <pattern>]\n"
+          "      List the words that have the pattern from the index, or count\n"
+          "      those of every pattern of the standard input, one per line.\n"
+          "  --trie <corpus> [--prefix <pattern>] [--rest <class>]\n"
+          "      Store the distinct words in a trie with a summary of the\n"
+          "      features below every node, and list the words that start with\n"
+          "      the pattern (e.g. \"[Voiced & Stop] V\") and continue with\n"
+          "      segments of the class (e.g. \"[Voiced]\").\n"
+          "  --threads <count>  Number of worker threads (one per processor)\n"
+          "  --stats            Print the instrumentation counters at the end\n"
+          "                     (compiled with -DFEATURE_STATS, also on SIGUSR1)\n"
+          "  --perf             Print the hardware counters of every dimension\n"
+          "                     at the end (compiled with -DFEATURE_PERF, Linux)\n");
+}
+
+// Count the values of a query and write those that reach the threshold
+void thresholdAndOutput(int format, const Query *query) {
+  ValueCounts counts;
+
+  memset(&counts, 0, sizeof(counts));
+  if (query->consonantVowel == 0 || query->consonantVowel == 1) {
+    countValues(query->intArray, query->num, query->consonantVowel, &counts);
+  }
+  outputThreshold(format, query->consonantVowel, query->intArray, query->num,
+                  &counts);
+}
+
+// Explain the common features of a query and write them
+void explainAndOutput(int format, const Query *query, const unsigned char common[]) {
+  Explanation explanation;
+
+  memset(&explanation, 0, sizeof(explanation));
+  if (query->consonantVowel == 0 || query->consonantVowel == 1) {
+    explainQuery(query->intArray, query->num, query->consonantVowel, &explanation);
+  }
+  outputExplanation(format, query->consonantVowel, query->intArray, query->num,
+                    common, &explanation);
+}
+
+// Ask the three questions and answer with the common features
+int runInteractive(void) {
+  InputScanner scanner;
+  Token token;
+  Query query = {NULL, 0, 0, 0};
+  long long symbolOffset[2] = {-1, -1};
+  unsigned char common[NUM_DIMENSIONS];
+
+  scannerOpen(&scanner, NULL);
+
+  // Number of consonants/vowels to compare
+  printf("How many consonants/vowels?\n");
+  fflush(stdout);
+  if (scanToken(&scanner, &token) != TOKEN_INT || token.value < 0) {
+    printf("Invalid Input\n");
+    scannerClose(&scanner);
+    return 0;
+  }
+  query.num = token.value;
+  if (!queryReserve(&query, query.num)) {
+    scannerClose(&scanner);
+    return 1;
+  }
+
+  // Create an array of consonants/vowels
+  for (int i = 0; i < query.num; i++) {
+    printf("Enter intArray[%d].\n", i);
+    fflush(stdout);
+    if (scanToken(&scanner, &token) != TOKEN_INT && token.type != TOKEN_SYMBOL) {
+      printf("Invalid Input\n");
+      free(query.intArray);
+      scannerClose(&scanner);
+      return 0;
+    }
+    if (token.type == TOKEN_SYMBOL && symbolOffset[token.consonantVowel] < 0) {
+      symbolOffset[token.consonantVowel] = token.offset;
+    }
+    query.intArray[i] = token.value;
+  }
+
+  printf("Vowel or consonant? Enter 0 if consonant, 1 if vowel.\n");
+  fflush(stdout);
+  query.consonantVowel = scanToken(&scanner, &token) == TOKEN_INT ? token.value : -1;
+  // As in the batch mode, a symbol of the other kind makes it invalid
+  if (!symbolKindsMatch(symbolOffset, query.consonantVowel)) {
+    query.consonantVowel = -1;
+  }
+
+  findCommonFeatures(query.intArray, query.num, query.consonantVowel, common);
+  if (thresholdFraction > 0) {
+    thresholdAndOutput(FORMAT_TEXT, &query);
+  }
+  else if (explainMode) {
+    explainAndOutput(FORMAT_TEXT, &query, common);
+  }
+  else {
+    outputRecord(FORMAT_TEXT, query.consonantVowel, query.intArray, query.num,
+                 common);
+  }
+  outputFlush();
+
+  free(query.intArray);
+  scannerClose(&scanner);
+  return 0;
+}
+
+// Header of the answers of the batch mode
+void outputAnswerHeader(int format) {
+  if (thresholdFraction > 0) {
+    outputThresholdHeader(format);
+  }
+  else if (explainMode) {
+    outputExplanationHeader(format);
+  }
+  else {
+    outputHeader(format);
+  }
+}
+
+// Answer a query as the batch mode does and write the answer
+void answerQuery(int format, const Query *query) {
+  unsigned char common[NUM_DIMENSIONS];
+
+  if (thresholdFraction > 0) {
+    thresholdAndOutput(format, query);
+    return ;
+  }
+  findCommonFeatures(query->intArray, query->num, query->consonantVowel, common);
+  if (explainMode) {
+    explainAndOutput(format, query, common);
+  }
+  else {
+    outputRecord(format, query->consonantVowel, query->intArray, query->num, common);
+  }
+}
+
+// The parallel batch mode reads the queries in batches of BATCH_QUERIES,
+// BATCHES_PER_WORKER batches per worker at a time, which the workers answer
+// in turn into their own output, written in the order of the batches once
+// all are answered. The cache, if any, is shared by every worker.
+#define BATCH_QUERIES 4096
+#define BATCHES_PER_WORKER 4
+
+typedef struct {
+  int *segments;                  // Of every query, one after the other
+  long long numSegments;
+  long long capacity;
+  int num[BATCH_QUERIES];
+  int consonantVowel[BATCH_QUERIES];
+  int numQueries;
+  OutputCapture output;
+} QueryBatch;
+
+typedef struct {
+  QueryBatch *batches;
+  int numBatches;
+  int format;
+  int nextBatch;                  // Next batch to give to a worker
+} ParallelBatch;
+
+// Add the query to the batch. Return 0 (after reporting) if there is no
+// memory for its segments.
+int batchAdd(QueryBatch *batch, const Query *query) {
+  if (batch->numSegments + query->num > batch->capacity) {
+    long long capacity = 2 * (batch->numSegments + query->num);
+    int *segments;
+    if ((unsigned long long)capacity > SIZE_MAX / sizeof(int) ||
+        (segments = realloc(batch->segments, sizeof(int) * (size_t)capacity)) == NULL) {
+      fprintf(stderr, "No memory for a batch of %lld segments\n", capacity);
+      return 0;
+    }
+    batch->segments = segments;
+    batch->capacity = capacity;
+  }
+  if (query->num > 0) {
+    memcpy(batch->segments + batch->numSegments, query->intArray,
+           sizeof(int) * query->num);
+  }
+  batch->numSegments += query->num;
+  batch->num[batch->numQueries] = query->num;
+  batch->consonantVowel[batch->numQueries] = query->consonantVowel;
+  batch->numQueries++;
+  return 1;
+}
+
+void batchTask(int worker, int numWorkers, void *context) {
+  ParallelBatch *parallel = context;
+  int b;
+
+  (void)worker;
+  (void)numWorkers;
+  while ((b = __atomic_fetch_add(&parallel->nextBatch, 1, __ATOMIC_RELAXED)) <
+         parallel->numBatches) {
+    QueryBatch *batch = &parallel->batches[b];
+    long long offset = 0;
+    int q;
+
+    batch->output.length = 0;
+    outputCapture = &batch->output;
+    for (q = 0; q < batch->numQueries; q++) {
+      Query query;
+      query.intArray = batch->segments + offset;
+      query.num = query.capacity = batch->num[q];
+      query.consonantVowel = batch->consonantVowel[q];
+      answerQuery(parallel->format, &query);
+      offset += query.num;
+    }
+    outputCapture = NULL;
+  }
+}
+
+// Answer the queries of the scanner with the workers, writing the answers
+// in the order of the queries. Return the status of the last scanQuery.
+int answerParallel(InputScanner *scanner, int format, int numWorkers) {
+  ParallelBatch parallel;
+  Query query = {NULL, 0, 0, 0};
+  int status = 1;
+  int b;
+
+  memset(&parallel, 0, sizeof(parallel));
+  parallel.batches = calloc((size_t)numWorkers * BATCHES_PER_WORKER, sizeof(QueryBatch));
+  parallel.format = format;
+  while (status > 0) {
+    parallel.numBatches = 0;
+    while (parallel.numBatches < numWorkers * BATCHES_PER_WORKER && status > 0) {
+      QueryBatch *batch = &parallel.batches[parallel.numBatches];
+      batch->numQueries = 0;
+      batch->numSegments = 0;
+      while (batch->numQueries < BATCH_QUERIES &&
+             (status = scanQuery(scanner, &query)) > 0) {
+        checkStatsRequest();
+        logQuery(&query);
+        if (!batchAdd(batch, &query)) {
+          status = -1;
+          break;
+        }
+      }
+      if (batch->numQueries > 0) {
+        parallel.numBatches++;
+      }
+    }
+    parallel.nextBatch = 0;
+    runParallel(batchTask, &parallel, numWorkers);
+    for (b = 0; b < parallel.numBatches; b++) {
+      outputBytes(parallel.batches[b].output.bytes, parallel.batches[b].output.length);
+    }
+  }
+
+  for (b = 0; b < numWorkers * BATCHES_PER_WORKER; b++) {
+    free(parallel.batches[b].segments);
+    free(parallel.batches[b].output.bytes);
+  }
+  free(parallel.batches);
+  free(query.intArray);
+  return status;
+}
+
+// Answer every query of the standard input without asking questions, with
+// one worker per processor (--threads)
+int runBatch(int format) {
+  InputScanner scanner;
+  Query query = {NULL, 0, 0, 0};
+  int numWorkers = workerCount();
+  int status;
+
+  if (!scannerOpen(&scanner, NULL)) {
+    return 1;
+  }
+  outputAnswerHeader(format);
+  if (numWorkers > 1) {
+    status = answerParallel(&scanner, format, numWorkers);
+  }
+  else {
+    while ((status = scanQuery(&scanner, &query)) > 0) {
+      checkStatsRequest();
+      logQuery(&query);
+      answerQuery(format, &query);
+    }
+  }
+  outputFlush();
+
+  free(query.intArray);
+  scannerClose(&scanner);
+  return status < 0 ? 1 : 0;
+}
+
+enum ReplayRate { REPLAY_MAX, REPLAY_RECORDED };
+
+const char *replayRateNames[] = {"max", "recorded"};
+
+// Answer the queries of the log in the order they were read, as fast as
+// possible or at the times they were read, writing the answers as the
+// batch mode does. The throughput and the latencies go to the standard
+// error. At the recorded rate, the latency of a query counts from the time
+// it was due, so that the queries delayed by a slow one count the delay.
+int runReplay(const char *path, int rate, int format) {
+  InputScanner log;
+  QueryLogRecord *records;
+  Query query = {NULL, 0, 0, 0};
+  unsigned long long *latencies = calloc(STATS_BUCKETS, sizeof(unsigned long long));
+  const double fractions[4] = {0.5, 0.9, 0.99, 0.999};
+  unsigned long long percentiles[4];
+  unsigned long long longest = 0;
+  unsigned long long start;
+  double seconds;
+  long long count;
+  long long r;
+  int status = 0;
+  int p;
+
+  if (!scannerOpen(&log, path)) {
+    free(latencies);
+    return 1;
+  }
+  if (!scannerReadAll(&log) || (count = readQueryLog(&log, &records)) < 0) {
+    scannerClose(&log);
+    free(latencies);
+    return 1;
+  }
+
+  outputAnswerHeader(format);
+  start = nowNanoseconds();
+  for (r = 0; r < count; r++) {
+    unsigned long long due;
+    unsigned long long latency;
+    if (!queryLogQuery(&log, records[r].offset, &query)) {
+      status = 1;
+      count = r;
+      break;
+    }
+    if (rate == REPLAY_RECORDED) {
+      due = start + (records[r].time - records[0].time);
+      waitUntil(due);
+    }
+    else {
+      due = nowNanoseconds();
+    }
+    answerQuery(format, &query);
+    latency = nowNanoseconds() - due;
+    latencies[statsBucket(latency)]++;
+    if (latency > longest) {
+      longest = latency;
+    }
+  }
+  outputFlush();
+  seconds = (nowNanoseconds() - start) / 1e9;
+
+  // A percentile is the end of its bucket, at most the longest latency
+  for (p = 0; p < 4; p++) {
+    percentiles[p] = statsPercentile(latencies, fractions[p]);
+    if (percentiles[p] > longest) {
+      percentiles[p] = longest;
+    }
+  }
+  fprintf(stderr, "replay: %lld queries in %.3f s (%.0f queries/s)\n", count, seconds,
+          seconds > 0 ? count / seconds : 0.0);
+  fprintf(stderr, "query latency (ns): p50 %llu, p90 %llu, p99 %llu, "
+          "p99.9 %llu, max %llu\n",
+          percentiles[0], percentiles[1], percentiles[2], percentiles[3], longest);
+
+  free(query.intArray);
+  free(records);
+  free(latencies);
+  scannerClose(&log);
+  return status;
+}
+
+// The server mode (--serve) answers the queries of TCP clients, written as
+// in the batch mode with one line per request, by one event loop per
+// worker (--threads) sharing the listening socket. A loop never blocks:
+// each connection is a small state machine that reads and answers its
+// lines while its socket takes the answers, and once the socket is full
+// keeps the rest, stops reading and continues with the next line when the
+// answers are written, so that a slow client only holds back itself. An
+// idle connection costs its Connection (a few hundred bytes) and its socket
+// buffers in the kernel; the input grows for a longer line and shrinks back
+// once it is answered. The loops wait with epoll on Linux, poll elsewhere.
+#define CONNECTION_INPUT 256
+#define CONNECTION_MAX_LINE (1 << 20)
+#define SERVER_FLUSH (1 << 16)    // Write the answers every so many bytes
+#define SERVER_EVENTS 256
+#define SERVER_TICK 250           // Milliseconds between checks for a stop
+
+enum ConnectionState { CONNECTION_READING, CONNECTION_WRITING };
+
+typedef struct {
+  int fd;
+  int state;
+  int closing;                    // The client is done, close once answered
+  int slot;                       // Index in the connections of the loop
+  char *input;                    // Bytes not answered yet, in inlineInput
+  size_t inputLength;             // unless they do not fit
+  size_t inputCapacity;
+  char *pending;                  // Answers the socket did not take
+  size_t pendingLength;
+  size_t pendingSent;
+  char inlineInput[CONNECTION_INPUT];
+} Connection;
+
+typedef struct {
+  int listener;
+  int format;
+  int accepting;                  // 0 while out of file descriptors
+#ifdef __linux__
+  int epoll;
+#else
+  struct pollfd *polls;           // The listener, then the connections
+#endif
+  Connection **connections;
+  int numConnections;
+  int capacity;
+  OutputCapture output;           // Answers of the connection being served
+  Query query;
+  long long accepted;
+  long long answered;
+} EventLoop;
+
+// Set by SIGINT or SIGTERM in whichever thread receives it, read by every loop
+int serverStopping = 0;
+
+void stopServer(int signalNumber) {
+  (void)signalNumber;
+  __atomic_store_n(&serverStopping, 1, __ATOMIC_RELAXED);
+}
+
+// Wait for the listening socket to accept connections, or stop waiting
+void loopListen(EventLoop *loop, int accepting) {
+#ifdef __linux__
+  struct epoll_event event;
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+  // Wake one of the loops for a new connection, not all of them
+  event.events |= EPOLLEXCLUSIVE;
+#endif
+  event.data.ptr = NULL;
+  epoll_ctl(loop->epoll, accepting ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, loop->listener,
+            &event);
+#else
+  loop->polls[0].events = accepting ? POLLIN : 0;
+#endif
+  loop->accepting = accepting;
+}
+
+// Wait for the connection to be readable, or writable while it is writing
+void loopWatch(EventLoop *loop, Connection *connection, int add) {
+#ifdef __linux__
+  struct epoll_event event;
+
+  memset(&event, 0, sizeof(event));
+  event.events = connection->state == CONNECTION_WRITING ? EPOLLOUT : EPOLLIN;
+  event.data.ptr = connection;
+  epoll_ctl(loop->epoll, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, connection->fd, &event);
+#else
+  (void)add;
+  loop->polls[connection->slot + 1].events =
+      connection->state == CONNECTION_WRITING ? POLLOUT : POLLIN;
+#endif
+}
+
+// Add a connection to the loop. Return NULL if there is no memory for it.
+Connection *addConnection(EventLoop *loop, int fd) {
+  Connection *connection = calloc(1, sizeof(Connection));
+
+  if (connection == NULL) {
+    return NULL;
+  }
+  if (loop->numConnections == loop->capacity) {
+    int capacity = loop->capacity > 0 ? 2 * loop->capacity : 64;
+    Connection **connections = realloc(loop->connections,
+                                       sizeof(Connection *) * capacity);
+    if (connections == NULL) {
+      free(connection);
+      return NULL;
+    }
+    loop->connections = connections;
+#ifndef __linux__
+    {
+      struct pollfd *polls = realloc(loop->polls, sizeof(struct pollfd) * (capacity + 1));
+      if (polls == NULL) {
+        free(connection);
+        return NULL;
+      }
+      loop->polls = polls;
+    }
+#endif
+    loop->capacity = capacity;
+  }
+  connection->fd = fd;
+  connection->state = CONNECTION_READING;
+  connection->slot = loop->numConnections++;
+  connection->input = connection->inlineInput;
+  connection->inputCapacity = CONNECTION_INPUT;
+  loop->connections[connection->slot] = connection;
+#ifndef __linux__
+  loop->polls[connection->slot + 1].fd = fd;
+  loop->polls[connection->slot + 1].revents = 0;
+#endif
+  loopWatch(loop, connection, 1);
+  loop->accepted++;
+  return connection;
+}
+
+// Close the connection, moving the last one of the loop to its slot
+void closeConnection(EventLoop *loop, Connection *connection) {
+  Connection *last = loop->connections[--loop->numConnections];
+
+  last->slot = connection->slot;
+  loop->connections[last->slot] = last;
+#ifndef __linux__
+  loop->polls[last->slot + 1] = loop->polls[loop->numConnections + 1];
+#endif
+  close(connection->fd);
+  if (connection->input != connection->inlineInput) {
+    free(connection->input);
+  }
+  free(connection->pending);
+  free(connection);
+  if (!loop->accepting) {
+    loopListen(loop, 1);
+  }
+}
+
+// Write the answers of the loop to the connection, and keep what its
+// socket does not take for later. Return 0 if the connection failed.
+int flushAnswers(EventLoop *loop, Connection *connection) {
+  const char *bytes = loop->output.bytes;
+  size_t length = loop->output.length;
+  ssize_t written;
+
+  loop->output.length = 0;
+  while (length > 0) {
+    written = write(connection->fd, bytes, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return 0;
+      }
+      break;
+    }
+    bytes += written;
+    length -= written;
+  }
+  if (length > 0) {
+    if ((connection->pending = malloc(length)) == NULL) {
+      fprintf(stderr, "No memory for the answers of a connection, which is closed\n");
+      return 0;
+    }
+    memcpy(connection->pending, bytes, length);
+    connection->pendingLength = length;
+    connection->pendingSent = 0;
+    connection->state = CONNECTION_WRITING;
+    loopWatch(loop, connection, 0);
+  }
+  return 1;
+}
+
+// Answer every query of a line, or say that it is invalid from the first
+// malformed token on
+void serveLine(EventLoop *loop, const char *line, size_t length) {
+  InputScanner scanner;
+  int status;
+
+  memset(&scanner, 0, sizeof(scanner));
+  scanner.data = line;
+  scanner.length = length;
+  scanner.eof = 1;
+  // The error goes back to the client, in its answer
+  queryErrorKept = 1;
+  queryError[0] = '\0';
+  while ((status = scanQuery(&scanner, &loop->query)) > 0) {
+    logQuery(&loop->query);
+    answerQuery(loop->format, &loop->query);
+    loop->answered++;
+  }
+  if (status < 0) {
+    loop->query.num = 0;
+    loop->query.consonantVowel = -1;
+    answerQuery(loop->format, &loop->query);
+  }
+  queryErrorKept = 0;
+}
+
+// Answer the complete lines of the input while the connection is reading,
+// and the last line without its newline once the client is done. Return 0
+// if the connection failed or is done.
+int serveLines(EventLoop *loop, Connection *connection) {
+  size_t start = 0;
+  size_t end;
+  char *newline;
+  int open = 1;
+
+  outputCapture = &loop->output;
+  while (open && connection->state == CONNECTION_READING) {
+    newline = memchr(connection->input + start, '\n', connection->inputLength - start);
+    if (newline != NULL) {
+      end = newline - connection->input;
+    }
+    else if (connection->closing && start < connection->inputLength) {
+      end = connection->inputLength;
+    }
+    else {
+      break;
+    }
+    serveLine(loop, connection->input + start, end - start);
+    start = newline != NULL ? end + 1 : end;
+    if (loop->output.length >= SERVER_FLUSH) {
+      open = flushAnswers(loop, connection);
+    }
+  }
+  outputCapture = NULL;
+  if (open) {
+    open = flushAnswers(loop, connection);
+  }
+
+  memmove(connection->input, connection->input + start, connection->inputLength - start);
+  connection->inputLength -= start;
+  if (connection->input != connection->inlineInput &&
+      connection->inputLength <= CONNECTION_INPUT) {
+    memcpy(connection->inlineInput, connection->input, connection->inputLength);
+    free(connection->input);
+    connection->input = connection->inlineInput;
+    connection->inputCapacity = CONNECTION_INPUT;
+  }
+  return open && !(connection->closing && connection->state == CONNECTION_READING);
+}
+
+// Read what the client sent and answer it. Return 0 if the connection
+// failed or is done.
+int readConnection(EventLoop *loop, Connection *connection) {
+  char *input;
+  ssize_t bytes;
+
+  if (connection->inputLength == connection->inputCapacity) {
+    if (connection->inputCapacity >= CONNECTION_MAX_LINE) {
+      fprintf(stderr, "A line is longer than %d bytes, its connection is closed\n",
+              CONNECTION_MAX_LINE);
+      return 0;
+    }
+    input = connection->input == connection->inlineInput
+                ? malloc(2 * connection->inputCapacity)
+                : realloc(connection->input, 2 * connection->inputCapacity);
+    if (input == NULL) {
+      fprintf(stderr, "No memory for the input of a connection, which is closed\n");
+      return 0;
+    }
+    if (connection->input == connection->inlineInput) {
+      memcpy(input, connection->inlineInput, connection->inputLength);
+    }
+    connection->input = input;
+    connection->inputCapacity *= 2;
+  }
+
+  bytes = read(connection->fd, connection->input + connection->inputLength,
+               connection->inputCapacity - connection->inputLength);
+  if (bytes < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+  if (bytes == 0) {
+    connection->closing = 1;
+  }
+  connection->inputLength += bytes;
+  return serveLines(loop, connection);
+}
+
+// Write the answers kept for the connection, then continue with its next
+// lines. Return 0 if the connection failed or is done.
+int writePending(EventLoop *loop, Connection *connection) {
+  ssize_t written;
+
+  while (connection->pendingSent < connection->pendingLength) {
+    written = write(connection->fd, connection->pending + connection->pendingSent,
+                    connection->pendingLength - connection->pendingSent);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    connection->pendingSent += written;
+  }
+  free(connection->pending);
+  connection->pending = NULL;
+  connection->pendingLength = 0;
+  connection->pendingSent = 0;
+  connection->state = CONNECTION_READING;
+  loopWatch(loop, connection, 0);
+  return serveLines(loop, connection);
+}
+
+// Continue the connection from its state once its socket is ready
+void serveConnection(EventLoop *loop, Connection *connection) {
+  int open = connection->state == CONNECTION_WRITING ? writePending(loop, connection)
+                                                      : readConnection(loop, connection);
+  if (!open) {
+    closeConnection(loop, connection);
+  }
+}
+
+// Accept the waiting connections, and send each the header of the answers
+void acceptConnections(EventLoop *loop) {
+  Connection *connection;
+  int one = 1;
+  int fd;
+  int n;
+
+  for (n = 0; n < SERVER_EVENTS; n++) {
+    fd = accept(loop->listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EMFILE || errno == ENFILE) {
+        fprintf(stderr, "accept: %s; waiting for a connection to close\n",
+                strerror(errno));
+        loopListen(loop, 0);
+      }
+      return ;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if ((connection = addConnection(loop, fd)) == NULL) {
+      // As without file descriptors, until a connection closes
+      fprintf(stderr, "No memory for a connection; waiting for one to close\n");
+      close(fd);
+      loopListen(loop, 0);
+      return ;
+    }
+    outputCapture = &loop->output;
+    outputAnswerHeader(loop->format);
+    outputCapture = NULL;
+    if (!flushAnswers(loop, connection)) {
+      closeConnection(loop, connection);
+    }
+  }
+}
+
+void serverTask(int worker, int numWorkers, void *context) {
+  EventLoop *loop = (EventLoop *)context + worker;
+#ifdef __linux__
+  struct epoll_event events[SERVER_EVENTS];
+#endif
+  int ready;
+  int e;
+
+  (void)numWorkers;
+  while (!__atomic_load_n(&serverStopping, __ATOMIC_RELAXED)) {
+#ifdef __linux__
+    ready = epoll_wait(loop->epoll, events, SERVER_EVENTS, SERVER_TICK);
+#else
+    ready = poll(loop->polls, loop->numConnections + 1, SERVER_TICK);
+#endif
+    if (worker == 0) {
+      checkStatsRequest();
+    }
+    if (ready <= 0) {
+      // Try to accept again after running out of file descriptors
+      if (ready == 0 && !loop->accepting) {
+        loopListen(loop, 1);
+      }
+      continue;
+    }
+#ifdef __linux__
+    for (e = 0; e < ready; e++) {
+      if (events[e].data.ptr == NULL) {
+        acceptConnections(loop);
+      }
+      else {
+        serveConnection(loop, events[e].data.ptr);
+      }
+    }
+#else
+    // From the last one, so that a closed connection only moves one served
+    // already
+    for (e = loop->numConnections - 1; e >= 0; e--) {
+      if (loop->polls[e + 1].revents != 0) {
+        serveConnection(loop, loop->connections[e]);
+      }
+    }
+    if (loop->polls[0].revents & POLLIN) {
+      acceptConnections(loop);
+    }
+#endif
+  }
+
+  while (loop->numConnections > 0) {
+    closeConnection(loop, loop->connections[0]);
+  }
+}
+
+// Open the listening socket of "[host:]port", on localhost by default.
+// Return -1 (after reporting) on failure.
+int openListener(const char *address) {
+  struct addrinfo hints;
+  struct addrinfo *addresses;
+  struct addrinfo *a;
+  char host[256] = "127.0.0.1";
+  const char *name = address;
+  const char *port = address;
+  const char *colon = strrchr(address, ':');
+  int listener = -1;
+  int one = 1;
+  int error = 0;
+
+  if (colon != NULL) {
+    size_t length = colon - address;
+    // [::1]:8080 for an IPv6 address
+    if (length >= 2 && address[0] == '[' && address[length - 1] == ']') {
+      name++;
+      length -= 2;
+    }
+    if (length >= sizeof(host)) {
+      fprintf(stderr, "Invalid address: %s\n", address);
+      return -1;
+    }
+    memcpy(host, name, length);
+    host[length] = '\0';
+    port = colon + 1;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if ((error = getaddrinfo(host, port, &hints, &addresses)) != 0) {
+    fprintf(stderr, "%s: %s\n", address, gai_strerror(error));
+    return -1;
+  }
+  for (a = addresses; a != NULL && listener < 0; a = a->ai_next) {
+    listener = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (listener < 0) {
+      error = errno;
+      continue;
+    }
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listener, a->ai_addr, a->ai_addrlen) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+      error = errno;
+      close(listener);
+      listener = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (listener < 0) {
+    fprintf(stderr, "Cannot listen on %s: %s\n", address, strerror(error));
+    return -1;
+  }
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+  return listener;
+}
+
+// Answer the queries of every client of the address until SIGINT or
+// SIGTERM, with one event loop per worker, writing the answers as the
+// batch mode does
+int runServer(const char *address, int format) {
+  EventLoop *loops;
+  struct rlimit limit;
+  int numWorkers = workerCount();
+  long long accepted = 0;
+  long long answered = 0;
+  int listener;
+  int w;
+
+  if ((listener = openListener(address)) < 0) {
+    return 1;
+  }
+  // As many connections as the system allows
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stopServer);
+  signal(SIGTERM, stopServer);
+
+  loops = calloc(numWorkers, sizeof(EventLoop));
+  for (w = 0; w < numWorkers; w++) {
+    loops[w].listener = listener;
+    loops[w].format = format;
+#ifdef __linux__
+    loops[w].epoll = epoll_create1(0);
+#else
+    loops[w].polls = calloc(1, sizeof(struct pollfd));
+    loops[w].polls[0].fd = listener;
+#endif
+    loopListen(&loops[w], 1);
+  }
+  fprintf(stderr, "Serving on %s with %d event loops\n", address, numWorkers);
+  runParallel(serverTask, loops, numWorkers);
+
+  for (w = 0; w < numWorkers; w++) {
+    accepted += loops[w].accepted;
+    answered += loops[w].answered;
+#ifdef __linux__
+    close(loops[w].epoll);
+#else
+    free(loops[w].polls);
+#endif
+    free(loops[w].connections);
+    free(loops[w].output.bytes);
+    free(loops[w].query.intArray);
+  }
+  fprintf(stderr, "server: %lld queries answered on %lld connections\n", answered,
+          accepted);
+  free(loops);
+  close(listener);
+  return 0;
+}
+
+// Value of the option at argv[*i + 1], or NULL (after reporting) if missing
+const char *optionValue(int argc, char *argv[], int *i) {
+  if (*i + 1 >= argc) {
+    fprintf(stderr, "Missing value of %s\n", argv[*i]);
+    return NULL;
+  }
+  (*i)++;
+  return argv[*i];
+}
+
+// Index of name in names[count], or -1 (after reporting) if unknown
+int optionChoice(const char *name, const char *names[], int count) {
+  int choice;
+
+  if (name == NULL) {
+    return -1;
+  }
+  for (choice = 0; choice < count; choice++) {
+    if (strcmp(name, names[choice]) == 0) {
+      return choice;
+    }
+  }
+  fprintf(stderr, "Unknown value: %s\n", name);
+  return -1;
+}
+
+// Whole number of text from min to max. Return 0 (after reporting) if it
+// is anything else.
+int parseInteger(const char *option, const char *text, long long min, long long max,
+                 long long *value) {
+  char *end;
+
+  errno = 0;
+  *value = strtoll(text, &end, 10);
+  if (end == text || *end != '\0' || errno == ERANGE || *value < min || *value > max) {
+    fprintf(stderr, "Invalid value of %s: %s (a whole number from %lld to %lld)\n",
+            option, text, min, max);
+    return 0;
+  }
+  return 1;
+}
+
+// Number of text from min to max. Return 0 (after reporting) if it is
+// anything else.
+int parseNumber(const char *option, const char *text, double min, double max,
+                double *value) {
+  char *end;
+
+  errno = 0;
+  *value = strtod(text, &end);
+  if (end == text || *end != '\0' || errno == ERANGE || !(*value >= min && *value <= max)) {
+    fprintf(stderr, "Invalid value of %s: %s (a number from %.10g to %.10g)\n",
+            option, text, min, max);
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  int format = -1;
+  int verify = 0;
+  const char *cooccurrencePath = NULL;
+  const char *syllabifyPath = NULL;
+  const char *ngramPath = NULL;
+  const char *modelPath = NULL;
+  const char *scorePath = NULL;
+  int ngramOrder = 0;
+  const char *economyInventory = NULL;
+  const char *hierarchyInventory = NULL;
+  const char *itemsetPath = NULL;
+  const char *triePath = NULL;
+  const char *matchPattern = NULL;
+  const char *corpusPath = "-";
+  const char *indexCorpus = NULL;
+  const char *indexPath = NULL;
+  const char *prefixPattern = NULL;
+  const char *restClass = NULL;
+  const char *cmudictPath = NULL;
+  const char *lexiconPath = NULL;
+  double minSupport = 0.01;
+  long long cacheEntries = 0;
+  const char *ordering = "all";
+  const char *clusterInventory = NULL;
+  const char *comparePath = NULL;
+  const char *universalsPath = NULL;
+  const char *logPath = NULL;
+  const char *replayPath = NULL;
+  int replayRate = REPLAY_MAX;
+  const char *serveAddress = NULL;
+  double minConfidence = 0.9;
+  const char *segmentInventory = "all";
+  int linkage = LINKAGE_AVERAGE;
+  const char *profile = "standard";
+#ifdef FEATURE_STATS
+  int stats = 0;
+#endif
+#if defined(FEATURE_PERF) && defined(__linux__)
+  int perf = 0;
+#endif
+  int status;
+  const char *value;
+  long long number;
+  int i = 1;
+
+  initSymbolIndex();
+  initSegmentTable();
+#ifdef FEATURE_STATS
+  signal(SIGUSR1, requestStats);
+#endif
+
+  while (i < argc) {
+    if (strcmp(argv[i], "--format") == 0 || strcmp(argv[i], "-f") == 0) {
+      format = optionChoice(optionValue(argc, argv, &i), formatNames, 4);
+      if (format < 0) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--engine") == 0) {
+      engine = optionChoice(optionValue(argc, argv, &i), engineNames, 2);
+      if (engine < 0) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--explain") == 0) {
+      explainMode = 1;
+    }
+    else if (strcmp(argv[i], "--threshold") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      if (!parseNumber("--threshold", value, 0, 1, &thresholdFraction)) {
+        return 1;
+      }
+      if (thresholdFraction == 0) {
+        fprintf(stderr, "--threshold needs a fraction in (0, 1], e.g. 0.9\n");
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--cache") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      cacheEntries = atoll(value);
+    }
+    else if (strcmp(argv[i], "--profile") == 0) {
+      if ((profile = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--log") == 0) {
+      if ((logPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--replay") == 0) {
+      if ((replayPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--replay-rate") == 0) {
+      replayRate = optionChoice(optionValue(argc, argv, &i), replayRateNames, 2);
+      if (replayRate < 0) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--serve") == 0) {
+      if ((serveAddress = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--verify") == 0) {
+      verify = 1;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        long long length;
+        if (!parseInteger("--verify", argv[++i], 0, MAX_VERIFY_LENGTH, &length)) {
+          return 1;
+        }
+        verifyLength = (int)length;
+      }
+    }
+    else if (strcmp(argv[i], "--cooccurrence") == 0) {
+      if ((cooccurrencePath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--syllabify") == 0) {
+      if ((syllabifyPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--ngram") == 0) {
+      if ((ngramPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--ngram-order") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      if (!parseInteger("--ngram-order", value, 1, MAX_NGRAM_ORDER, &number)) {
+        return 1;
+      }
+      ngramOrder = (int)number;
+    }
+    else if (strcmp(argv[i], "--model") == 0) {
+      if ((modelPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--score") == 0) {
+      if ((scorePath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--economy") == 0) {
+      if ((economyInventory = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--hierarchy") == 0) {
+      if ((hierarchyInventory = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--cluster") == 0) {
+      if ((clusterInventory = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--linkage") == 0) {
+      linkage = optionChoice(optionValue(argc, argv, &i), linkageNames, 3);
+      if (linkage < 0) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--compare") == 0) {
+      if ((comparePath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--universals") == 0) {
+      if ((universalsPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--min-confidence") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      if (!parseNumber("--min-confidence", value, 0, 1, &minConfidence)) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--segments") == 0) {
+      if ((segmentInventory = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--cmudict") == 0) {
+      if ((cmudictPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--lexicon") == 0) {
+      if ((lexiconPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--itemsets") == 0) {
+      if ((itemsetPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--match") == 0) {
+      if ((matchPattern = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--corpus") == 0) {
+      if ((corpusPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--index") == 0) {
+      if ((indexCorpus = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--index-file") == 0) {
+      if ((indexPath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--trie") == 0) {
+      if ((triePath = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--prefix") == 0) {
+      if ((prefixPattern = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--rest") == 0) {
+      if ((restClass = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--min-support") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      // A fraction of the sets below 1, a count from 1
+      if (!parseNumber("--min-support", value, 0, INT_MAX, &minSupport)) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--order") == 0) {
+      if ((ordering = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--random") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      verifyRandom = atoll(value);
+    }
+    else if (strcmp(argv[i], "--seed") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      verifySeed = strtoull(value, NULL, 10);
+    }
+    else if (strcmp(argv[i], "--threads") == 0 || strcmp(argv[i], "-j") == 0) {
+      if ((value = optionValue(argc, argv, &i)) == NULL) {
+        return 1;
+      }
+      numThreads = atoi(value);
+    }
+    else if (strcmp(argv[i], "--stats") == 0) {
+#ifdef FEATURE_STATS
+      stats = 1;
+#else
+      fprintf(stderr, "--stats needs the program compiled with -DFEATURE_STATS\n");
+      return 1;
+#endif
+    }
+    else if (strcmp(argv[i], "--perf") == 0) {
+#if defined(FEATURE_PERF) && defined(__linux__)
+      perf = perfEnabled = 1;
+#else
+      fprintf(stderr, "--perf needs the program compiled with -DFEATURE_PERF on Linux\n");
+      return 1;
+#endif
+    }
+    else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+      printUsage(stdout);
+      return 0;
+    }
+    else {
+      printUsage(stderr);
+      return 1;
+    }
+    i++;
+  }
+
+  if ((explainMode || thresholdFraction > 0) && format == FORMAT_BINARY) {
+    fprintf(stderr, "--explain and --threshold need --format text, jsonl or csv\n");
+    return 1;
+  }
+  if (explainMode && thresholdFraction > 0) {
+    fprintf(stderr, "--explain cannot be combined with --threshold\n");
+    return 1;
+  }
+  if (strcmp(profile, "standard") != 0) {
+    // The helper functions only know the standard table
+    if (verify || engine == ENGINE_REFERENCE) {
+      fprintf(stderr, "--profile cannot be used with --verify or --engine reference\n");
+      return 1;
+    }
+    if (!applyProfile(profile)) {
+      return 1;
+    }
+  }
+  if (cacheEntries > 0) {
+    initCache(cacheEntries);
+  }
+  if (logPath != NULL &&
+      (cmudictPath != NULL || verify || cooccurrencePath != NULL || syllabifyPath != NULL ||
+       ngramPath != NULL || scorePath != NULL || economyInventory != NULL ||
+       hierarchyInventory != NULL || clusterInventory != NULL || comparePath != NULL ||
+       universalsPath != NULL || itemsetPath != NULL || indexCorpus != NULL ||
+       indexPath != NULL || matchPattern != NULL || triePath != NULL ||
+       replayPath != NULL || (serveAddress == NULL && format < 0))) {
+    fprintf(stderr, "--log needs the batch mode (--format) or --serve\n");
+    return 1;
+  }
+  if (logPath != NULL && !openQueryLog(logPath)) {
+    return 1;
+  }
+  if (cmudictPath != NULL) {
+    if (lexiconPath == NULL) {
+      fprintf(stderr, "--cmudict needs --lexicon <file> to write\n");
+      return 1;
+    }
+    status = importCmudict(cmudictPath, lexiconPath) ? 0 : 1;
+  }
+  else if (verify) {
+    status = runVerification(ENGINE_TABLE) == 0 ? 0 : 1;
+  }
+  else if (cooccurrencePath != NULL) {
+    status = runCooccurrence(cooccurrencePath, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (syllabifyPath != NULL) {
+    status = runSyllabify(syllabifyPath, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (ngramPath != NULL || scorePath != NULL) {
+    status = runNgrams(ngramPath, ngramOrder, modelPath, scorePath,
+                       format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (economyInventory != NULL) {
+    status = runEconomy(economyInventory, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (hierarchyInventory != NULL) {
+    status = runHierarchy(hierarchyInventory, ordering,
+                          format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (clusterInventory != NULL) {
+    status = runClustering(clusterInventory, linkage, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (comparePath != NULL) {
+    status = runComparison(comparePath, segmentInventory,
+                           format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (universalsPath != NULL) {
+    status = runUniversals(universalsPath, segmentInventory, minSupport, minConfidence,
+                           format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (itemsetPath != NULL) {
+    status = runItemsets(itemsetPath, minSupport, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (indexCorpus != NULL) {
+    if (indexPath == NULL) {
+      fprintf(stderr, "--index needs --index-file <file> to write\n");
+      return 1;
+    }
+    status = buildIndex(indexCorpus, indexPath) ? 0 : 1;
+  }
+  else if (indexPath != NULL) {
+    status = runIndexSearch(indexPath, matchPattern, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (matchPattern != NULL) {
+    status = runPatternSearch(corpusPath, matchPattern,
+                              format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (triePath != NULL) {
+    status = runTrie(triePath, prefixPattern, restClass,
+                     format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (replayPath != NULL) {
+    status = runReplay(replayPath, replayRate, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (serveAddress != NULL) {
+    status = runServer(serveAddress, format < 0 ? FORMAT_TEXT : format);
+  }
+  else if (format < 0) {
+    status = runInteractive();
+  }
+  else {
+    status = runBatch(format);
+  }
+  if (!closeQueryLog()) {
+    status = 1;
+  }
+
+#ifdef FEATURE_STATS
+  if (stats) {
+    printStats();
+  }
+  else if (cacheLines > 0) {
+    printCacheStats();
+  }
+#else
+  if (cacheLines > 0) {
+    printCacheStats();
+  }
+#endif
+#if defined(FEATURE_PERF) && defined(__linux__)
+  if (perf) {
+    printPerf();
+  }
+#endif
+  return status;
+}